@@ -221,6 +221,16 @@ int main(int argc, char **argv)
 	if(periodic){
 		time = double(t)/double(image.GetT());
 	}
+
+    // Displacements of all voxels at once, B-spline FFDs evaluate these in separable passes
+    irtkGenericImage<double> field;
+    if (invert == false) {
+      irtkImageAttributes attr = image.GetImageAttributes();
+      attr._t = 3;
+      field.Initialize(attr);
+      transform->Displacement(field, time);
+    }
+
     for (z = 0; z < image.GetZ(); z++) {
       for (y = 0; y < image.GetY(); y++) {
         for (x = 0; x < image.GetX(); x++) {
@@ -235,7 +245,9 @@ int main(int argc, char **argv)
             if (invert == true) {
               transform->Inverse(p2[0], p2[1], p2[2], time);
             } else {
-              transform->Transform(p2[0], p2[1], p2[2], time);
+              p2[0] += field(x, y, z, 0);
+              p2[1] += field(x, y, z, 1);
+              p2[2] += field(x, y, z, 2);
             }
             if (imaged) {
               image.WorldToImage(p2[0],p2[1],p2[2]);
@@ -20,7 +20,7 @@ Changes   : $Author$
 #include <irtkResampling.h>
 
 // Default filenames
-char *input_name = NULL, *output_name = NULL, *dof_name  = NULL;
+char *input_name = NULL, *output_name = NULL, *dof_name  = NULL, *cache_name = NULL;
 
 void usage()
 {
@@ -50,6 +50,11 @@ void usage()
     cerr << "<-Tp value>        Target padding value" << endl;
     cerr << "<-Sp value>        Source padding value" << endl;
     cerr << "<-invert>          Invert transformation" << endl;
+    cerr << "<-cache>           Bake transformation into a displacement field on" << endl;
+    cerr << "                   the target lattice first (faster for images with" << endl;
+    cerr << "                   many frames, not for time-varying transformations" << endl;
+    cerr << "                   of images with more than one frame)" << endl;
+    cerr << "<-cacheout file>   Write baked transformation, implies -cache" << endl;
     cerr << "<-nn>              Nearst Neighbor interpolation" << endl;
     cerr << "<-linear>          Linear interpolation" << endl;
     cerr << "<-bspline>         B-spline interpolation" << endl;
@@ -66,9 +71,26 @@ void usage()
     exit(1);
 }
 
+// Returns whether a transformation may vary over time
+bool IsTimeVarying(irtkTransformation *transformation)
+{
+    int i;
+
+    if (dynamic_cast<irtkFreeFormTransformation4D *>(transformation) != NULL) return true;
+    if (dynamic_cast<irtkTemporalHomogeneousTransformation *>(transformation) != NULL) return true;
+
+    irtkMultiLevelFreeFormTransformation *mffd = dynamic_cast<irtkMultiLevelFreeFormTransformation *>(transformation);
+    if (mffd != NULL) {
+        for (i = 0; i < mffd->NumberOfLevels(); i++) {
+            if (dynamic_cast<irtkFreeFormTransformation4D *>(mffd->GetLocalTransformation(i)) != NULL) return true;
+        }
+    }
+    return false;
+}
+
 int main(int argc, char **argv)
 {
-    int ok, invert, twod;
+    int ok, invert, twod, cache;
     int target_padding, source_padding;
     int target_x1, target_y1, target_z1, target_x2, target_y2, target_z2;
     int source_x1, source_y1, source_z1, source_x2, source_y2, source_z2;
@@ -118,6 +140,7 @@ int main(int argc, char **argv)
     // Other options
     invert = false;
     twod = false;
+    cache = false;
     source_padding = 0;
     target_padding = MIN_GREY;
     matchSourceType = false;
@@ -314,6 +337,21 @@ int main(int argc, char **argv)
             invert = true;
             ok = true;
         }
+        if ((ok == false) && (strcmp(argv[1], "-cache") == 0)) {
+            argc--;
+            argv++;
+            cache = true;
+            ok = true;
+        }
+        if ((ok == false) && (strcmp(argv[1], "-cacheout") == 0)) {
+            argc--;
+            argv++;
+            cache = true;
+            cache_name = argv[1];
+            argc--;
+            argv++;
+            ok = true;
+        }
         if ((ok == false) && (strcmp(argv[1], "-2d") == 0)) {
             argc--;
             argv++;
@@ -435,6 +473,28 @@ int main(int argc, char **argv)
         transformation = new irtkRigidTransformation;
     }
 
+    // Replace transformation by a displacement field on the target lattice
+    if (cache == true) {
+        if (invert == true) {
+            cerr << "Can not cache an inverted transformation" << endl;
+            exit(1);
+        }
+        if ((target->GetT() > 1) && IsTimeVarying(transformation)) {
+            cerr << "Can not cache a time-varying transformation for a target with more than one frame" << endl;
+            exit(1);
+        }
+        if ((target->GetX() < 2) || (target->GetY() < 2)) {
+            cerr << "Can not cache a transformation for a target with less than two voxels along x or y" << endl;
+            exit(1);
+        }
+        cout << "Caching transformation ... "; cout.flush();
+        irtkTransformation *cached = transformation->DisplacementCache(target->GetImageAttributes(), target->ImageToTime(0));
+        delete transformation;
+        transformation = cached;
+        cout << "done" << endl;
+        if (cache_name != NULL) transformation->Write(cache_name);
+    }
+
 
     // Create image transformation
     irtkImageTransformation *imagetransformation =
@@ -215,6 +215,8 @@ public:
   virtual GetMacro(TargetPadding, int);
   virtual SetMacro(OptimizationMethod, irtkOptimizationMethod);
   virtual GetMacro(OptimizationMethod, irtkOptimizationMethod);
+  virtual SetMacro(SimilarityMeasure, irtkSimilarityMeasure);
+  virtual GetMacro(SimilarityMeasure, irtkSimilarityMeasure);
 
 };
 
@@ -242,6 +244,8 @@ inline void irtkImageRegistration::Debug(string message)
 #include <irtkImageFluidRegistration2D.h>
 #include <irtkImageEigenFreeFormRegistration2D.h>
 
+#include <irtkMultiSliceRigidRegistration.h>
+
 #include <irtkMultipleImageRegistration.h>
 #include <irtkMultipleImageFreeFormRegistration.h>
 
@@ -14,6 +14,47 @@
 
 #define _IRTKIMAGEREGISTRATIONWITHPADDING_H
 
+/**
+ * Source image pre-processed for every level of a registration pyramid.
+ *
+ * The cache is filled once by irtkImageRegistrationWithPadding::InitializeSourceCache
+ * and can then be shared read-only by any number of registrations which use the
+ * same source and the same source parameters, e.g. slice-to-volume registrations
+ * running concurrently against one volume.
+**/
+
+class irtkRegistrationSourceCache
+{
+
+public:
+
+  /// Number of levels held in the cache
+  int _NumberOfLevels;
+
+  /// Blurred, resampled and intensity shifted source image for each level
+  irtkGreyImage *_image[MAX_NO_RESOLUTIONS];
+
+  /// Initialized interpolator of the source image for each level
+  irtkInterpolateImageFunction *_interpolator[MAX_NO_RESOLUTIONS];
+
+  /// Number of histogram bins of the source image for each level
+  int _nbins[MAX_NO_RESOLUTIONS];
+
+  /// Source image domain which can be interpolated fast for each level
+  double _x1[MAX_NO_RESOLUTIONS], _y1[MAX_NO_RESOLUTIONS], _z1[MAX_NO_RESOLUTIONS];
+  double _x2[MAX_NO_RESOLUTIONS], _y2[MAX_NO_RESOLUTIONS], _z2[MAX_NO_RESOLUTIONS];
+
+  /// Constructor
+  irtkRegistrationSourceCache();
+
+  /// Destructor
+  ~irtkRegistrationSourceCache();
+
+  /// Release all images and interpolators
+  void Clear();
+
+};
+
 /**
  * Generic for image registration extended by source padding
 **/
@@ -28,13 +69,38 @@ protected:
   
   //irtkGreyImage *tmp_target, *tmp_source;
 
+  /// Pre-processed source shared with other registrations (not owned)
+  irtkRegistrationSourceCache *_SourceCache;
+
+  /// Blur, resample and shift the source image for a multiresolution level
+  virtual void PrepareSource(int, irtkGreyImage *, int &);
+
   /// Overload initial set up for the registration at a multiresolution level
   virtual void Initialize(int);
 
+  /// Overload final set up for the registration at a multiresolution level
+  virtual void Finalize(int);
+
 public:
   irtkImageRegistrationWithPadding();
+
+  /** Fills the cache with the source image pre-processed for every level,
+   *  using the current source image and source parameters of the registration.
+   */
+  virtual void InitializeSourceCache(irtkRegistrationSourceCache *);
+
+  /** Uses a pre-processed source cache instead of preparing the source at
+   *  every level. The cache must have been initialized with the same source
+   *  parameters and must outlive the call to Run().
+   */
+  virtual void SetSourceCache(irtkRegistrationSourceCache *);
 };
 
+inline void irtkImageRegistrationWithPadding::SetSourceCache(irtkRegistrationSourceCache *cache)
+{
+  _SourceCache = cache;
+}
+
 #include <irtkImageRigidRegistrationWithPadding.h>
 
 #endif
@@ -22,11 +22,19 @@
 class irtkImageRigidRegistrationWithPadding : public irtkImageRegistrationWithPadding
 {
 
+  friend class irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate;
+
 protected:
 
+  /// Similarity metrics of the target slabs, combined in order by Evaluate()
+  vector<irtkSimilarityMetric *> _slabMetrics;
+
   /// Evaluate the similarity measure for a given transformation.
   virtual double Evaluate();
 
+  /// Final set up for the registration at a multiresolution level
+  virtual void Finalize(int);
+
   //// Initial set up for the registration
   //virtual void Initialize();
 
@@ -35,6 +43,9 @@ protected:
 
 public:
 
+  /// Destructor
+  virtual ~irtkImageRigidRegistrationWithPadding();
+
   /** Sets the output for the registration filter. The output must be a rigid
    *  transformation. The current parameters of the rigid transformation are
    *  used as initial guess for the rigid registration. After execution of the
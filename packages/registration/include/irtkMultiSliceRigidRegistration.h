@@ -0,0 +1,219 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+              Visual Information Processing (VIP), 2008 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+=========================================================================*/
+
+#ifndef _IRTKMULTISLICERIGIDREGISTRATION_H
+
+#define _IRTKMULTISLICERIGIDREGISTRATION_H
+
+#include <vector>
+
+/**
+ * Target samples and optimizer state of one slice in irtkMultiSliceRigidRegistration.
+ */
+
+class irtkMultiSliceRigidRegistrationSlice
+{
+
+public:
+
+  /// Target image (not owned)
+  irtkGreyImage *_target;
+
+  /// Transformation which is optimized (not owned)
+  irtkRigidTransformation *_transformation;
+
+  /// Voxel coordinates of valid target voxels at the current level
+  vector<float> _x, _y, _z;
+
+  /// Pre-processed intensities of valid target voxels at the current level
+  vector<irtkGreyPixel> _value;
+
+  /// Image to world matrix of the pre-processed target
+  irtkMatrix _i2w;
+
+  /// Similarity metric of the slice at the current level
+  irtkSimilarityMetric *_metric;
+
+  /// Current step size and delta
+  double _step, _delta;
+
+  /// Current step and iteration of the optimization at this level
+  int _stepIndex, _iteration;
+
+  /// Whether the slice has converged at the current level
+  bool _done;
+
+  irtkMultiSliceRigidRegistrationSlice();
+
+};
+
+/**
+ * Rigid registration of many slices against a single source volume.
+ *
+ * The filter runs the same multi-resolution gradient descent as
+ * irtkImageRigidRegistrationWithPadding with GuessParameterSliceToVolume(), but
+ * for a batch of slices at once. The source is pre-processed once per level
+ * and shared by all slices (see irtkRegistrationSourceCache). Valid target
+ * voxels are packed into coordinate lists, so that each similarity evaluation
+ * is one contiguous sweep which maps a block of samples into the source and
+ * then gathers them with trilinear interpolation. Each parallel pass over the
+ * batch advances every slice which has not converged by one optimizer
+ * iteration. Only linear interpolation and the SSD, CC and NMI similarity
+ * measures are supported.
+ */
+
+class irtkMultiSliceRigidRegistration : public irtkObject
+{
+
+  friend class irtkMultiThreadedMultiSliceRigidRegistrationStep;
+  friend class irtkMultiThreadedMultiSliceRigidRegistrationInitialize;
+
+protected:
+
+  /// Source image shared by all slices
+  irtkGreyImage *_source;
+
+  /// Slices of the batch
+  vector<irtkMultiSliceRigidRegistrationSlice> _slices;
+
+  /// Pre-processed source, owned unless set with SetSourceCache
+  irtkRegistrationSourceCache *_SourceCache;
+  bool _OwnSourceCache;
+
+  /// Similarity measure for registration
+  irtkSimilarityMeasure _SimilarityMeasure;
+
+  /// Number of levels of multiresolution pyramid
+  int _NumberOfLevels;
+
+  /// Max. number of bins for histogram
+  int _NumberOfBins;
+
+  /// Number of step sizes
+  int _NumberOfSteps[MAX_NO_RESOLUTIONS];
+
+  /// Length of steps
+  double _LengthOfSteps[MAX_NO_RESOLUTIONS];
+
+  /// Max. number of iterations per step size
+  int _NumberOfIterations[MAX_NO_RESOLUTIONS];
+
+  /// Convergence parameter for optimization based on change in similarity
+  double _Epsilon;
+
+  /// Convergence parameter for optimization based on change in the transformation
+  double _Delta[MAX_NO_RESOLUTIONS];
+
+  /// Padding value of target images
+  short _TargetPadding;
+
+  /// Debugging flag
+  int _DebugFlag;
+
+  /// Pre-process the target of a slice and collect its samples for a level
+  virtual void Initialize(irtkMultiSliceRigidRegistrationSlice &, int);
+
+  /// Release the samples and metric of a slice
+  virtual void Finalize(irtkMultiSliceRigidRegistrationSlice &);
+
+  /// Evaluate the similarity of a slice for its current transformation
+  virtual double Evaluate(irtkMultiSliceRigidRegistrationSlice &, int);
+
+  /// Run one gradient descent iteration for a slice
+  virtual void Step(irtkMultiSliceRigidRegistrationSlice &, int);
+
+public:
+
+  /// Constructor
+  irtkMultiSliceRigidRegistration();
+
+  /// Destructor
+  virtual ~irtkMultiSliceRigidRegistration();
+
+  /// Sets the source volume
+  virtual void SetSource(irtkGreyImage *);
+
+  /// Adds a slice and the rigid transformation to optimize for it
+  virtual void AddSlice(irtkGreyImage *, irtkRigidTransformation *);
+
+  /// Removes all slices
+  virtual void ClearSlices();
+
+  /// Returns the number of slices in the batch
+  virtual int GetNumberOfSlices();
+
+  /** Uses a source cache initialized with the parameters of
+   *  irtkImageRigidRegistrationWithPadding::GuessParameterSliceToVolume()
+   *  instead of pre-processing the source again.
+   */
+  virtual void SetSourceCache(irtkRegistrationSourceCache *);
+
+  /// Guess parameters for slice to volume registration
+  virtual void GuessParameter();
+
+  /// Returns whether a similarity measure is supported
+  static bool IsSupported(irtkSimilarityMeasure);
+
+  /// Runs the registration filter
+  virtual void Run();
+
+  /// Returns the name of the class
+  virtual const char *NameOfClass();
+
+  // Access parameters
+  virtual SetMacro(SimilarityMeasure, irtkSimilarityMeasure);
+  virtual GetMacro(SimilarityMeasure, irtkSimilarityMeasure);
+  virtual SetMacro(TargetPadding, short);
+  virtual GetMacro(TargetPadding, short);
+  virtual SetMacro(DebugFlag, int);
+  virtual GetMacro(DebugFlag, int);
+
+};
+
+inline irtkMultiSliceRigidRegistrationSlice::irtkMultiSliceRigidRegistrationSlice()
+{
+  _target         = NULL;
+  _transformation = NULL;
+  _metric         = NULL;
+  _step           = 0;
+  _delta          = 0;
+  _stepIndex      = 0;
+  _iteration      = 0;
+  _done           = true;
+}
+
+inline void irtkMultiSliceRigidRegistration::SetSource(irtkGreyImage *source)
+{
+  _source = source;
+}
+
+inline void irtkMultiSliceRigidRegistration::ClearSlices()
+{
+  _slices.clear();
+}
+
+inline int irtkMultiSliceRigidRegistration::GetNumberOfSlices()
+{
+  return _slices.size();
+}
+
+inline bool irtkMultiSliceRigidRegistration::IsSupported(irtkSimilarityMeasure measure)
+{
+  return (measure == SSD) || (measure == CC) || (measure == NMI);
+}
+
+inline const char *irtkMultiSliceRigidRegistration::NameOfClass()
+{
+  return "irtkMultiSliceRigidRegistration";
+}
+
+#endif
@@ -10,9 +10,17 @@
 
 =========================================================================*/
 
-#ifdef HAS_TBB
-
-extern tbb::deprecated::concurrent_queue<irtkSimilarityMetric *> sim_queue;
+/// Number of target slices which form one slab of the parallel Evaluate()
+#define IRTK_RIGID_PADDING_SLAB 4
+
+/**
+ * Parallel body of irtkImageRigidRegistrationWithPadding::Evaluate().
+ *
+ * The target is split into slabs of IRTK_RIGID_PADDING_SLAB slices. Every slab
+ * fills its own similarity metric, and Evaluate() combines the metrics in slab
+ * order. The partition does not depend on the number of threads or on the
+ * scheduling, so the similarity is the same for any number of threads.
+ */
 
 class irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate
 {
@@ -20,89 +28,64 @@ class irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate
   /// Pointer to image transformation class
   irtkImageRigidRegistrationWithPadding *_filter;
 
-  /// Pointer to metric
-  irtkSimilarityMetric *_metric;
-
 public:
 
   irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate(irtkImageRigidRegistrationWithPadding *filter) {
     // Initialize filter
     _filter = filter;
-
-    // Initialize metric
-    _metric = filter->_metric;
-    _metric->Reset();
   }
 
-  irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate(irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate &r, split) {
-
-    // Initialize filter
-    _filter = r._filter;
-
-    // Copy similarity metric
-    if (sim_queue.pop_if_present(_metric) == false) {
-      _metric = irtkSimilarityMetric::New(_filter->_metric);
-    }
-
-    // Reset similarity metric
-    _metric->Reset();
-  }
-
-  ~irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate() {
-    if (_metric != _filter->_metric) sim_queue.push(_metric);
-  }
-
-  void join(irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate &rhs) {
-    // Combine metrics
-    _metric->Combine(rhs._metric);
-  }
-
-  void operator()(const blocked_range<int> &r) {
-    int i, j, k, t;
+  void operator()(const blocked_range<int> &r) const {
+    int i, j, k, t, s, k1, k2;
 
     // Create iterator
     irtkHomogeneousTransformationIterator iterator((irtkHomogeneousTransformation *)_filter->_transformation);
 
-    // Loop over all voxels in the target (reference) volume
-
-    for (t = 0; t < _filter->_target->GetT(); t++) {
-      for (k = r.begin(); k != r.end(); k++) {
-
-        // Initialize iterator
-        iterator.Initialize(_filter->_target, _filter->_source, 0, 0, k);
-
-        // Pointer to voxels in target image
-        irtkGreyPixel *ptr2target = _filter->_target->GetPointerToVoxels(0, 0, k, t);
-
-        for (j = 0; j < _filter->_target->GetY(); j++) {
-          for (i = 0; i < _filter->_target->GetX(); i++) {
-            // Check whether reference point is valid
-            if (*ptr2target >= 0) {
-              // Check whether transformed point is inside source volume
-              if ((iterator._x > _filter->_source_x1) && (iterator._x < _filter->_source_x2) &&
-                  (iterator._y > _filter->_source_y1) && (iterator._y < _filter->_source_y2) &&
-                  (iterator._z > _filter->_source_z1) && (iterator._z < _filter->_source_z2)) {
-                // Add sample to metric
-                //_metric->Add(*ptr2target, round(_filter->_interpolator->EvaluateInside(iterator._x, iterator._y, iterator._z, t)));
-                double value = _filter->_interpolator->EvaluateInside(iterator._x, iterator._y, iterator._z, t);
-	            if (value >= 0)
-                  _metric->Add(*ptr2target, round(value));
-             }
-              iterator.NextX();
-            } else {
-              // Advance iterator by offset
-              iterator.NextX(*ptr2target * -1);
-              i          -= (*ptr2target) + 1;
-              ptr2target -= (*ptr2target) + 1;
+    for (s = r.begin(); s != r.end(); s++) {
+
+      // Metric and slices of this slab
+      irtkSimilarityMetric *metric = _filter->_slabMetrics[s];
+      metric->Reset();
+      k1 = s * IRTK_RIGID_PADDING_SLAB;
+      k2 = k1 + IRTK_RIGID_PADDING_SLAB;
+      if (k2 > _filter->_target->GetZ()) k2 = _filter->_target->GetZ();
+
+      // Loop over all voxels in the target (reference) volume
+      for (t = 0; t < _filter->_target->GetT(); t++) {
+        for (k = k1; k < k2; k++) {
+
+          // Initialize iterator
+          iterator.Initialize(_filter->_target, _filter->_source, 0, 0, k);
+
+          // Pointer to voxels in target image
+          irtkGreyPixel *ptr2target = _filter->_target->GetPointerToVoxels(0, 0, k, t);
+
+          for (j = 0; j < _filter->_target->GetY(); j++) {
+            for (i = 0; i < _filter->_target->GetX(); i++) {
+              // Check whether reference point is valid
+              if (*ptr2target >= 0) {
+                // Check whether transformed point is inside source volume
+                if ((iterator._x > _filter->_source_x1) && (iterator._x < _filter->_source_x2) &&
+                    (iterator._y > _filter->_source_y1) && (iterator._y < _filter->_source_y2) &&
+                    (iterator._z > _filter->_source_z1) && (iterator._z < _filter->_source_z2)) {
+                  // Add sample to metric
+                  double value = _filter->_interpolator->EvaluateInside(iterator._x, iterator._y, iterator._z, t);
+                  if (value >= 0)
+                    metric->Add(*ptr2target, round(value));
+                }
+                iterator.NextX();
+              } else {
+                // Advance iterator by offset (padded runs end within a row)
+                iterator.NextX(*ptr2target * -1);
+                i          -= (*ptr2target) + 1;
+                ptr2target -= (*ptr2target) + 1;
+              }
+              ptr2target++;
             }
-            ptr2target++;
+            iterator.NextY();
           }
-          iterator.NextY();
         }
-        iterator.NextZ();
       }
     }
   }
 };
-
-#endif
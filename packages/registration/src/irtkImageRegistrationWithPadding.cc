@@ -21,30 +21,183 @@ extern irtkGreyImage *tmp_target, *tmp_source;
 irtkImageRegistrationWithPadding::irtkImageRegistrationWithPadding() : irtkImageRegistration()
 {
   _SourcePadding   = MIN_GREY;
+  _SourceCache     = NULL;
 }
 
 
+irtkRegistrationSourceCache::irtkRegistrationSourceCache()
+{
+  int level;
+
+  _NumberOfLevels = 0;
+  for (level = 0; level < MAX_NO_RESOLUTIONS; level++) {
+    _image[level]        = NULL;
+    _interpolator[level] = NULL;
+    _nbins[level]        = 0;
+  }
+}
+
+irtkRegistrationSourceCache::~irtkRegistrationSourceCache()
+{
+  this->Clear();
+}
+
+void irtkRegistrationSourceCache::Clear()
+{
+  int level;
+
+  for (level = 0; level < MAX_NO_RESOLUTIONS; level++) {
+    delete _interpolator[level];
+    delete _image[level];
+    _image[level]        = NULL;
+    _interpolator[level] = NULL;
+    _nbins[level]        = 0;
+  }
+  _NumberOfLevels = 0;
+}
+
+void irtkImageRegistrationWithPadding::PrepareSource(int level, irtkGreyImage *source, int &source_nbins)
+{
+  int i, j, k, t;
+  double dx, dy, dz, temp;
+  irtkGreyPixel source_min, source_max;
+
+  if (_SourceBlurring[level] > 0) {
+    cout << "Blurring source ... ";
+    irtkGaussianBlurringWithPadding<irtkGreyPixel> blurring(_SourceBlurring[level],_SourcePadding);
+    blurring.SetInput (source);
+    blurring.SetOutput(source);
+    blurring.Run();
+    cout << "done" << endl;
+  }
+
+  source->GetPixelSize(&dx, &dy, &dz);
+  temp = fabs(_SourceResolution[0][0]-dx) + fabs(_SourceResolution[0][1]-dy) + fabs(_SourceResolution[0][2]-dz);
+
+  if (level > 0 || temp > 0.000001) {
+    cout << "Resampling source ... ";
+    // Create resampling filter
+    irtkResamplingWithPadding<irtkGreyPixel> resample(_SourceResolution[level][0],
+        _SourceResolution[level][1],
+        _SourceResolution[level][2], _SourcePadding);
+
+    resample.SetInput (source);
+    resample.SetOutput(source);
+    resample.Run();
+    cout << "done" << endl;
+  }
+
+  // Find out the min and max values in source image, ignoring padding
+  source_max = MIN_GREY;
+  source_min = MAX_GREY;
+  for (t = 0; t < source->GetT(); t++) {
+    for (k = 0; k < source->GetZ(); k++) {
+      for (j = 0; j < source->GetY(); j++) {
+        for (i = 0; i < source->GetX(); i++) {
+          if (source->Get(i, j, k, t) > _SourcePadding){
+            if (source->Get(i, j, k, t) > source_max)
+              source_max = source->Get(i, j, k, t);
+            if (source->Get(i, j, k, t) < source_min)
+              source_min = source->Get(i, j, k, t);
+	  } else {
+	    source->Put(i, j, k, t, _SourcePadding);
+	  }
+        }
+      }
+    }
+  }
+
+  if (source_max - source_min > MAX_GREY) {
+    cerr << this->NameOfClass()
+         << "::Initialize: Dynamic range of source is too large" << endl;
+    exit(1);
+  } else {
+    for (t = 0; t < source->GetT(); t++) {
+      for (k = 0; k < source->GetZ(); k++) {
+        for (j = 0; j < source->GetY(); j++) {
+          for (i = 0; i < source->GetX(); i++) {
+            if (source->Get(i, j, k, t) > _SourcePadding) {
+              source->Put(i, j, k, t, source->Get(i, j, k, t) - source_min);
+	    } else {
+	      source->Put(i, j, k, t, -1);
+	    }
+          }
+        }
+      }
+    }
+  }
+
+  // Rescale intensities to the number of bins if the metric uses a histogram
+  switch (_SimilarityMeasure) {
+  case JE:
+  case MI:
+  case NMI:
+  case CR_XY:
+  case CR_YX:
+  case K:
+    source_nbins = irtkCalculateNumberOfBins(source, _NumberOfBins,
+                   source_min, source_max);
+    break;
+  default:
+    source_nbins = 0;
+    break;
+  }
+
+  cout << "Source range is from " << source_min << " to " << source_max << endl;
+}
+
+void irtkImageRegistrationWithPadding::InitializeSourceCache(irtkRegistrationSourceCache *cache)
+{
+  int level;
+
+  if (_source == NULL) {
+    cerr << this->NameOfClass() << "::InitializeSourceCache: Filter has no source input" << endl;
+    exit(1);
+  }
+
+  cache->Clear();
+  cache->_NumberOfLevels = _NumberOfLevels;
+
+  for (level = 0; level < _NumberOfLevels; level++) {
+    cache->_image[level] = new irtkGreyImage(*_source);
+    this->PrepareSource(level, cache->_image[level], cache->_nbins[level]);
+
+    // Setup interpolation for the pre-processed source image
+    cache->_interpolator[level] = irtkInterpolateImageFunction::New(_InterpolationMode, cache->_image[level]);
+    cache->_interpolator[level]->SetInput(cache->_image[level]);
+    cache->_interpolator[level]->Initialize();
+    cache->_interpolator[level]->Inside(cache->_x1[level], cache->_y1[level], cache->_z1[level],
+                                        cache->_x2[level], cache->_y2[level], cache->_z2[level]);
+  }
+}
+
 void irtkImageRegistrationWithPadding::Initialize(int level)
 {
   int i, j, k, t;
   double dx, dy, dz, temp;
   irtkGreyPixel target_min, target_max, target_nbins;
-  irtkGreyPixel source_min, source_max, source_nbins;
-  char buffer[256];
+  int source_nbins;
 
-  // Copy source and target to temp space
+  // Copy target to temp space and swap
   tmp_target = new irtkGreyImage(*_target);
-  tmp_source = new irtkGreyImage(*_source);
-
-  // Swap source and target with temp space copies
   swap(tmp_target, _target);
-  swap(tmp_source, _source);
-
-  /*sprintf(buffer,"_otarget%i.nii.gz",level);
-  _target->Write(buffer);
-  sprintf(buffer,"_osource%i.nii.gz",level);
-  _source->Write(buffer);*/
 
+  if (_SourceCache == NULL) {
+    // Copy source to temp space, swap and prepare it for this level
+    tmp_source = new irtkGreyImage(*_source);
+    swap(tmp_source, _source);
+    this->PrepareSource(level, _source, source_nbins);
+  } else {
+    if (level >= _SourceCache->_NumberOfLevels) {
+      cerr << this->NameOfClass()
+           << "::Initialize: Source cache has no level " << level+1 << endl;
+      exit(1);
+    }
+    // Use the shared pre-processed source, keeping the input in temp space
+    tmp_source   = _source;
+    _source      = _SourceCache->_image[level];
+    source_nbins = _SourceCache->_nbins[level];
+  }
 
   // Blur images if necessary
   if (_TargetBlurring[level] > 0) {
@@ -56,20 +209,6 @@ void irtkImageRegistrationWithPadding::Initialize(int level)
     cout << "done" << endl;
   }
 
-  if (_SourceBlurring[level] > 0) {
-    cout << "Blurring source ... ";
-    irtkGaussianBlurringWithPadding<irtkGreyPixel> blurring(_SourceBlurring[level],_SourcePadding);
-    blurring.SetInput (_source);
-    blurring.SetOutput(_source);
-    blurring.Run();
-    cout << "done" << endl;
-  }
-  
-  /*sprintf(buffer,"_btarget%i.nii.gz",level);
-  _target->Write(buffer);
-  sprintf(buffer,"_bsource%i.nii.gz",level);
-  _source->Write(buffer);*/
-
   _target->GetPixelSize(&dx, &dy, &dz);
   temp = fabs(_TargetResolution[0][0]-dx) + fabs(_TargetResolution[0][1]-dy) + fabs(_TargetResolution[0][2]-dz);
 
@@ -86,27 +225,6 @@ void irtkImageRegistrationWithPadding::Initialize(int level)
     cout << "done" << endl;
   }
 
-  _source->GetPixelSize(&dx, &dy, &dz);
-  temp = fabs(_SourceResolution[0][0]-dx) + fabs(_SourceResolution[0][1]-dy) + fabs(_SourceResolution[0][2]-dz);
-
-  if (level > 0 || temp > 0.000001) {
-    cout << "Resampling source ... ";
-    // Create resampling filter
-    irtkResamplingWithPadding<irtkGreyPixel> resample(_SourceResolution[level][0],
-        _SourceResolution[level][1],
-        _SourceResolution[level][2], _SourcePadding);
-
-    resample.SetInput (_source);
-    resample.SetOutput(_source);
-    resample.Run();
-    cout << "done" << endl;
-  }
-
-  /*sprintf(buffer,"_rtarget%i.nii.gz",level);
-  _target->Write(buffer);
-  sprintf(buffer,"_rsource%i.nii.gz",level);
-  _source->Write(buffer);*/
-
   // Find out the min and max values in target image, ignoring padding
   target_max = MIN_GREY;
   target_min = MAX_GREY;
@@ -127,26 +245,6 @@ void irtkImageRegistrationWithPadding::Initialize(int level)
     }
   }
 
-  // Find out the min and max values in source image, ignoring padding
-  source_max = MIN_GREY;
-  source_min = MAX_GREY;
-  for (t = 0; t < _source->GetT(); t++) {
-    for (k = 0; k < _source->GetZ(); k++) {
-      for (j = 0; j < _source->GetY(); j++) {
-        for (i = 0; i < _source->GetX(); i++) {
-          if (_source->Get(i, j, k, t) > _SourcePadding){
-            if (_source->Get(i, j, k, t) > source_max)
-              source_max = _source->Get(i, j, k, t);
-            if (_source->Get(i, j, k, t) < source_min)
-              source_min = _source->Get(i, j, k, t);
-	  } else {
-	    _source->Put(i, j, k, t, _SourcePadding);
-	  }
-        }
-      }
-    }
-  }
-
   // Check whether dynamic range of data is not to large
   if (target_max - target_min > MAX_GREY) {
     cerr << this->NameOfClass()
@@ -168,63 +266,6 @@ void irtkImageRegistrationWithPadding::Initialize(int level)
     }
   }
 
-    if (source_max - source_min > MAX_GREY) {
-      cerr << this->NameOfClass()
-           << "::Initialize: Dynamic range of source is too large" << endl;
-      exit(1);
-    } else {
-      for (t = 0; t < _source->GetT(); t++) {
-        for (k = 0; k < _source->GetZ(); k++) {
-          for (j = 0; j < _source->GetY(); j++) {
-            for (i = 0; i < _source->GetX(); i++) {
-              if (_source->Get(i, j, k, t) > _SourcePadding) {
-                _source->Put(i, j, k, t, _source->Get(i, j, k, t) - source_min);
-	      } else {
-		_source->Put(i, j, k, t, -1);  
-	      }
-            }
-          }
-        }
-      }
-    }
-
-/*if ((_SimilarityMeasure == SSD) || (_SimilarityMeasure == CC) ||
-      (_SimilarityMeasure == LC)  || (_SimilarityMeasure == K) || (_SimilarityMeasure == ML)) {
-    if (source_max - target_min > MAX_GREY) {
-      cerr << this->NameOfClass()
-           << "::Initialize: Dynamic range of source is too large" << endl;
-      exit(1);
-    } else {
-      for (t = 0; t < _source->GetT(); t++) {
-        for (k = 0; k < _source->GetZ(); k++) {
-          for (j = 0; j < _source->GetY(); j++) {
-            for (i = 0; i < _source->GetX(); i++) {
-              _source->Put(i, j, k, t, _source->Get(i, j, k, t) - source_min);
-            }
-          }
-        }
-      }
-    }
-  } else {
-  
-    if (source_max - source_min > MAX_GREY) {
-      cerr << this->NameOfClass()
-           << "::Initialize: Dynamic range of source is too large" << endl;
-      exit(1);
-    } else {
-      for (t = 0; t < _source->GetT(); t++) {
-        for (k = 0; k < _source->GetZ(); k++) {
-          for (j = 0; j < _source->GetY(); j++) {
-            for (i = 0; i < _source->GetX(); i++) {
-              _source->Put(i, j, k, t, _source->Get(i, j, k, t) - source_min);
-            }
-          }
-        }
-      }
-    }
-  }
-  */
-
   // Pad target image if necessary
   irtkPadding(*_target, _TargetPadding);
 
@@ -241,40 +282,30 @@ void irtkImageRegistrationWithPadding::Initialize(int level)
     // Rescale images by an integer factor if necessary
     target_nbins = irtkCalculateNumberOfBins(_target, _NumberOfBins,
                    target_min, target_max);
-    source_nbins = irtkCalculateNumberOfBins(_source, _NumberOfBins,
-                   source_min, source_max);
     _metric = new irtkJointEntropySimilarityMetric(target_nbins, source_nbins);
     break;
   case MI:
     // Rescale images by an integer factor if necessary
     target_nbins = irtkCalculateNumberOfBins(_target, _NumberOfBins,
                    target_min, target_max);
-    source_nbins = irtkCalculateNumberOfBins(_source, _NumberOfBins,
-                   source_min, source_max);
     _metric = new irtkMutualInformationSimilarityMetric(target_nbins, source_nbins);
     break;
   case NMI:
     // Rescale images by an integer factor if necessary
     target_nbins = irtkCalculateNumberOfBins(_target, _NumberOfBins,
                    target_min, target_max);
-    source_nbins = irtkCalculateNumberOfBins(_source, _NumberOfBins,
-                   source_min, source_max);
     _metric = new irtkNormalisedMutualInformationSimilarityMetric(target_nbins, source_nbins);
     break;
   case CR_XY:
     // Rescale images by an integer factor if necessary
     target_nbins = irtkCalculateNumberOfBins(_target, _NumberOfBins,
                    target_min, target_max);
-    source_nbins = irtkCalculateNumberOfBins(_source, _NumberOfBins,
-                   source_min, source_max);
     _metric = new irtkCorrelationRatioXYSimilarityMetric(target_nbins, source_nbins);
     break;
   case CR_YX:
     // Rescale images by an integer factor if necessary
     target_nbins = irtkCalculateNumberOfBins(_target, _NumberOfBins,
                    target_min, target_max);
-    source_nbins = irtkCalculateNumberOfBins(_source, _NumberOfBins,
-                   source_min, source_max);
     _metric = new irtkCorrelationRatioYXSimilarityMetric(target_nbins, source_nbins);
     break;
   case LC:
@@ -284,8 +315,6 @@ void irtkImageRegistrationWithPadding::Initialize(int level)
     // Rescale images by an integer factor if necessary
     target_nbins = irtkCalculateNumberOfBins(_target, _NumberOfBins,
                    target_min, target_max);
-    source_nbins = irtkCalculateNumberOfBins(_source, _NumberOfBins,
-                   source_min, source_max);
     _metric = new irtkKappaSimilarityMetric(target_nbins, source_nbins);
     break;
   case ML:
@@ -297,17 +326,28 @@ void irtkImageRegistrationWithPadding::Initialize(int level)
     break;
   }
 
-  // Setup the interpolator - currently only linear supported
-  //_interpolator = irtkInterpolateImageFunction::New(Interpolation_Linear, _source);
-  _interpolator = irtkInterpolateImageFunction::New(_InterpolationMode, _source);
+  if (_SourceCache == NULL) {
+    // Setup the interpolator - currently only linear supported
+    //_interpolator = irtkInterpolateImageFunction::New(Interpolation_Linear, _source);
+    _interpolator = irtkInterpolateImageFunction::New(_InterpolationMode, _source);
 
-  // Setup interpolation for the source image
-  _interpolator->SetInput(_source);
-  _interpolator->Initialize();
+    // Setup interpolation for the source image
+    _interpolator->SetInput(_source);
+    _interpolator->Initialize();
 
-  // Calculate the source image domain in which we can interpolate
-  _interpolator->Inside(_source_x1, _source_y1, _source_z1,
-                        _source_x2, _source_y2, _source_z2);
+    // Calculate the source image domain in which we can interpolate
+    _interpolator->Inside(_source_x1, _source_y1, _source_z1,
+                          _source_x2, _source_y2, _source_z2);
+  } else {
+    // Interpolation of the shared source has been set up by the cache
+    _interpolator = _SourceCache->_interpolator[level];
+    _source_x1 = _SourceCache->_x1[level];
+    _source_y1 = _SourceCache->_y1[level];
+    _source_z1 = _SourceCache->_z1[level];
+    _source_x2 = _SourceCache->_x2[level];
+    _source_y2 = _SourceCache->_y2[level];
+    _source_z2 = _SourceCache->_z2[level];
+  }
 
   // Setup the optimizer
   switch (_OptimizationMethod) {
@@ -340,16 +380,19 @@ void irtkImageRegistrationWithPadding::Initialize(int level)
 
   cout << "Source image (transform)" << endl;
   _source->Print();
-  cout << "Range is from " << source_min << " to " << source_max << endl;
 
   // Print initial transformation
   cout << "Initial transformation for level = " << level+1 << endl;;
   _transformation->Print();
+}
 
+void irtkImageRegistrationWithPadding::Finalize(int level)
+{
+  if (_SourceCache != NULL) {
+    // Source and interpolator belong to the cache, restore only the input
+    _source       = NULL;
+    _interpolator = NULL;
+  }
 
-  /*sprintf(buffer,"_target%i.nii.gz",level);
-  _target->Write(buffer);
-  sprintf(buffer,"_source%i.nii.gz",level);
-  _source->Write(buffer);*/
-
+  this->irtkImageRegistration::Finalize(level);
 }
@@ -18,6 +18,14 @@
 
 #include <irtkMultiThreadedImageRigidRegistrationWithPadding.h>
 
+irtkImageRigidRegistrationWithPadding::~irtkImageRigidRegistrationWithPadding()
+{
+  unsigned int s;
+
+  // Slab metrics of a registration which did not finish its level
+  for (s = 0; s < _slabMetrics.size(); s++) delete _slabMetrics[s];
+}
+
 void irtkImageRigidRegistrationWithPadding::GuessParameter()
 {
   int i;
@@ -533,77 +541,39 @@ void irtkImageRigidRegistrationWithPadding::Finalize()
 */
 double irtkImageRigidRegistrationWithPadding::Evaluate()
 {
-
-//  #ifndef HAS_TBB
-  int i, j, k, t;
-//  #endif
-
-  // Pointer to reference data
-  irtkGreyPixel *ptr2target;
+  unsigned int s, slabs;
 
   // Print debugging information
   this->Debug("irtkImageRigidRegistrationWithPadding::Evaluate");
 
-  // Invert transformation
-  //((irtkRigidTransformation *)_transformation)->Invert();
+  // One metric per slab of target slices
+  slabs = (_target->GetZ() + IRTK_RIGID_PADDING_SLAB - 1) / IRTK_RIGID_PADDING_SLAB;
+  if (_slabMetrics.size() != slabs) {
+    for (s = 0; s < _slabMetrics.size(); s++) delete _slabMetrics[s];
+    _slabMetrics.resize(slabs);
+    for (s = 0; s < slabs; s++) _slabMetrics[s] = irtkSimilarityMetric::New(_metric);
+  }
 
-  // Create iterator
-  irtkHomogeneousTransformationIterator
-  iterator((irtkHomogeneousTransformation *)_transformation);
+  // Fill the metric of each slab in parallel
+  irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate evaluate(this);
+  parallel_for(blocked_range<int>(0, slabs, 1), evaluate);
 
-  // Initialize metric
+  // Combine the slabs in a fixed order
   _metric->Reset();
-
-  // Pointer to voxels in target image
-  ptr2target = _target->GetPointerToVoxels();
-
-// #ifdef HAS_TBB
-//   irtkMultiThreadedImageRigidRegistrationWithPaddingEvaluate evaluate(this);
-//   parallel_reduce(blocked_range<int>(0, _target->GetZ(), 20), evaluate);
-// #else
-
-  for (t = 0; t < _target->GetT(); t++) {
-
-    // Initialize iterator
-    iterator.Initialize(_target, _source);
-
-    // Loop over all voxels in the target (reference) volume
-    for (k = 0; k < _target->GetZ(); k++) {
-      for (j = 0; j < _target->GetY(); j++) {
-        for (i = 0; i < _target->GetX(); i++) {
-          // Check whether reference point is valid
-          if (*ptr2target >= 0) {
-            // Check whether transformed point is inside source volume
-            if ((iterator._x > _source_x1) && (iterator._x < _source_x2) &&
-                (iterator._y > _source_y1) && (iterator._y < _source_y2) &&
-                (iterator._z > _source_z1) && (iterator._z < _source_z2)) {
-              // Add sample to metric. Note: only linear interpolation supported at present
-	      //double value = (static_cast<irtkLinearInterpolateImageFunction*> (_interpolator))->EvaluateWithPadding(-1,iterator._x, iterator._y, iterator._z, t);
-	      double value = _interpolator->EvaluateInside(iterator._x, iterator._y, iterator._z, t);
-	      if (value >= 0)
-                _metric->Add(*ptr2target, round(value));
-            }
-            iterator.NextX();
-          } else {
-            // Advance iterator by offset
-            iterator.NextX(*ptr2target * -1);
-            i          -= (*ptr2target) + 1;
-            ptr2target -= (*ptr2target) + 1;
-          }
-          ptr2target++;
-        }
-        iterator.NextY();
-      }
-      iterator.NextZ();
-    }
-  }
-
-//  #endif
-
-
-  // Invert transformation
-  //((irtkRigidTransformation *)_transformation)->Invert();
+  for (s = 0; s < slabs; s++) {
+    _metric->Combine(_slabMetrics[s]);
+  }
 
   // Evaluate similarity measure
   return _metric->Evaluate();
 }
+
+void irtkImageRigidRegistrationWithPadding::Finalize(int level)
+{
+  unsigned int s;
+
+  for (s = 0; s < _slabMetrics.size(); s++) delete _slabMetrics[s];
+  _slabMetrics.clear();
+
+  this->irtkImageRegistrationWithPadding::Finalize(level);
+}
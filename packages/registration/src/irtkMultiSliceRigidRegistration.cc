@@ -0,0 +1,415 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+              Visual Information Processing (VIP), 2008 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+=========================================================================*/
+
+#include <irtkRegistration.h>
+
+#include <irtkGaussianBlurringWithPadding.h>
+
+// Number of samples mapped into the source before they are interpolated
+#define IRTK_MULTISLICE_CHUNK 256
+
+class irtkMultiThreadedMultiSliceRigidRegistrationInitialize
+{
+
+  irtkMultiSliceRigidRegistration *_filter;
+
+  int _level;
+
+public:
+
+  irtkMultiThreadedMultiSliceRigidRegistrationInitialize(irtkMultiSliceRigidRegistration *filter, int level) {
+    _filter = filter;
+    _level  = level;
+  }
+
+  void operator()(const blocked_range<int> &r) const {
+    for (int i = r.begin(); i != r.end(); i++) {
+      _filter->Initialize(_filter->_slices[i], _level);
+    }
+  }
+
+};
+
+class irtkMultiThreadedMultiSliceRigidRegistrationStep
+{
+
+  irtkMultiSliceRigidRegistration *_filter;
+
+  vector<int> &_active;
+
+  int _level;
+
+public:
+
+  irtkMultiThreadedMultiSliceRigidRegistrationStep(irtkMultiSliceRigidRegistration *filter, vector<int> &active, int level) : _active(active) {
+    _filter = filter;
+    _level  = level;
+  }
+
+  void operator()(const blocked_range<int> &r) const {
+    for (int i = r.begin(); i != r.end(); i++) {
+      _filter->Step(_filter->_slices[_active[i]], _level);
+    }
+  }
+
+};
+
+irtkMultiSliceRigidRegistration::irtkMultiSliceRigidRegistration()
+{
+  _source         = NULL;
+  _SourceCache    = NULL;
+  _OwnSourceCache = false;
+  _TargetPadding  = -1;
+  _DebugFlag      = false;
+
+  this->GuessParameter();
+}
+
+irtkMultiSliceRigidRegistration::~irtkMultiSliceRigidRegistration()
+{
+  if (_OwnSourceCache == true) delete _SourceCache;
+}
+
+void irtkMultiSliceRigidRegistration::AddSlice(irtkGreyImage *target, irtkRigidTransformation *transformation)
+{
+  irtkMultiSliceRigidRegistrationSlice slice;
+
+  slice._target         = target;
+  slice._transformation = transformation;
+  _slices.push_back(slice);
+}
+
+void irtkMultiSliceRigidRegistration::SetSourceCache(irtkRegistrationSourceCache *cache)
+{
+  if (_OwnSourceCache == true) delete _SourceCache;
+  _SourceCache    = cache;
+  _OwnSourceCache = false;
+}
+
+void irtkMultiSliceRigidRegistration::GuessParameter()
+{
+  int i;
+
+  // Same defaults as irtkImageRigidRegistrationWithPadding::GuessParameterSliceToVolume
+  _NumberOfLevels    = 2;
+  _NumberOfBins      = 64;
+  _SimilarityMeasure = CC;
+  _Epsilon           = 0.0001;
+
+  for (i = 0; i < MAX_NO_RESOLUTIONS; i++) {
+    _NumberOfIterations[i] = 20;
+    _NumberOfSteps[i]      = 4;
+    _LengthOfSteps[i]      = 2 * pow(2.0, i);
+    _Delta[i]              = 0;
+  }
+}
+
+void irtkMultiSliceRigidRegistration::Initialize(irtkMultiSliceRigidRegistrationSlice &slice, int level)
+{
+  int i, j, k, target_nbins;
+  double xsize, ysize, zsize, size, dx, dy, dz, blurring, resolution[3];
+  irtkGreyPixel target_min, target_max, *ptr;
+
+  // Target parameters as guessed for slice to volume registration
+  slice._target->GetPixelSize(&xsize, &ysize, &zsize);
+  size          = (ysize < xsize) ? ysize : xsize;
+  blurring      = size / 2.0 * pow(2.0, level);
+  resolution[0] = size * pow(2.0, level);
+  resolution[1] = size * pow(2.0, level);
+  resolution[2] = zsize;
+
+  irtkGreyImage target(*slice._target);
+
+  if (blurring > 0) {
+    irtkGaussianBlurringWithPadding<irtkGreyPixel> blur(blurring, _TargetPadding);
+    blur.SetInput (&target);
+    blur.SetOutput(&target);
+    blur.Run();
+  }
+
+  target.GetPixelSize(&dx, &dy, &dz);
+  if (level > 0 || fabs(size-dx) + fabs(size-dy) + fabs(zsize-dz) > 0.000001) {
+    irtkResamplingWithPadding<irtkGreyPixel> resample(resolution[0], resolution[1], resolution[2], _TargetPadding);
+    resample.SetInput (&target);
+    resample.SetOutput(&target);
+    resample.Run();
+  }
+
+  // Find out the min and max values in target image, ignoring padding
+  target_max = MIN_GREY;
+  target_min = MAX_GREY;
+  ptr = target.GetPointerToVoxels();
+  for (i = 0; i < target.GetNumberOfVoxels(); i++) {
+    if (ptr[i] > _TargetPadding) {
+      if (ptr[i] > target_max) target_max = ptr[i];
+      if (ptr[i] < target_min) target_min = ptr[i];
+    }
+  }
+  if (target_max - target_min > MAX_GREY) {
+    cerr << this->NameOfClass()
+         << "::Initialize: Dynamic range of target is too large" << endl;
+    exit(1);
+  }
+  for (i = 0; i < target.GetNumberOfVoxels(); i++) {
+    ptr[i] = (ptr[i] > _TargetPadding) ? ptr[i] - target_min : -1;
+  }
+
+  // Allocate memory for metric
+  switch (_SimilarityMeasure) {
+  case SSD:
+    slice._metric = new irtkSSDSimilarityMetric;
+    break;
+  case CC:
+    slice._metric = new irtkCrossCorrelationSimilarityMetric;
+    break;
+  case NMI:
+    target_nbins  = irtkCalculateNumberOfBins(&target, _NumberOfBins, target_min, target_max);
+    slice._metric = new irtkNormalisedMutualInformationSimilarityMetric(target_nbins, _SourceCache->_nbins[level]);
+    break;
+  default:
+    cerr << this->NameOfClass() << "::Initialize: Similarity measure not supported" << endl;
+    exit(1);
+  }
+
+  // Pack the valid target voxels
+  slice._x.clear();
+  slice._y.clear();
+  slice._z.clear();
+  slice._value.clear();
+  ptr = target.GetPointerToVoxels();
+  for (k = 0; k < target.GetZ(); k++) {
+    for (j = 0; j < target.GetY(); j++) {
+      for (i = 0; i < target.GetX(); i++) {
+        if (*ptr >= 0) {
+          slice._x.push_back(i);
+          slice._y.push_back(j);
+          slice._z.push_back(k);
+          slice._value.push_back(*ptr);
+        }
+        ptr++;
+      }
+    }
+  }
+  slice._i2w = target.GetImageToWorldMatrix();
+
+  // Reset the optimizer state for this level
+  slice._step      = _LengthOfSteps[level];
+  slice._delta     = _Delta[level];
+  slice._stepIndex = 0;
+  slice._iteration = 0;
+  slice._done      = slice._value.empty();
+}
+
+void irtkMultiSliceRigidRegistration::Finalize(irtkMultiSliceRigidRegistrationSlice &slice)
+{
+  delete slice._metric;
+  slice._metric = NULL;
+  vector<float>().swap(slice._x);
+  vector<float>().swap(slice._y);
+  vector<float>().swap(slice._z);
+  vector<irtkGreyPixel>().swap(slice._value);
+}
+
+double irtkMultiSliceRigidRegistration::Evaluate(irtkMultiSliceRigidRegistrationSlice &slice, int level)
+{
+  int c, n, nc, i, j, k, N;
+  double t1, t2, u1, u2, v1, v2, value;
+  double px[IRTK_MULTISLICE_CHUNK], py[IRTK_MULTISLICE_CHUNK], pz[IRTK_MULTISLICE_CHUNK];
+
+  irtkGreyImage *source = _SourceCache->_image[level];
+  const double x1 = _SourceCache->_x1[level], x2 = _SourceCache->_x2[level];
+  const double y1 = _SourceCache->_y1[level], y2 = _SourceCache->_y2[level];
+  const double z1 = _SourceCache->_z1[level], z2 = _SourceCache->_z2[level];
+  const int X  = source->GetX();
+  const int XY = source->GetX() * source->GetY();
+  const irtkGreyPixel *data = source->GetPointerToVoxels();
+
+  // Target voxel to source voxel
+  irtkMatrix m = source->GetWorldToImageMatrix() * slice._transformation->GetMatrix() * slice._i2w;
+  const double a00 = m(0, 0), a01 = m(0, 1), a02 = m(0, 2), a03 = m(0, 3);
+  const double a10 = m(1, 0), a11 = m(1, 1), a12 = m(1, 2), a13 = m(1, 3);
+  const double a20 = m(2, 0), a21 = m(2, 1), a22 = m(2, 2), a23 = m(2, 3);
+
+  const float *sx = &slice._x[0], *sy = &slice._y[0], *sz = &slice._z[0];
+  const irtkGreyPixel *sv = &slice._value[0];
+  N = slice._value.size();
+
+  slice._metric->Reset();
+
+  for (n = 0; n < N; n += IRTK_MULTISLICE_CHUNK) {
+    nc = (N - n < IRTK_MULTISLICE_CHUNK) ? N - n : IRTK_MULTISLICE_CHUNK;
+
+    // Map a block of samples into the source
+    for (c = 0; c < nc; c++) {
+      px[c] = a00 * sx[n+c] + a01 * sy[n+c] + a02 * sz[n+c] + a03;
+      py[c] = a10 * sx[n+c] + a11 * sy[n+c] + a12 * sz[n+c] + a13;
+      pz[c] = a20 * sx[n+c] + a21 * sy[n+c] + a22 * sz[n+c] + a23;
+    }
+
+    // Gather with linear interpolation as irtkLinearInterpolateImageFunction::EvaluateInside
+    for (c = 0; c < nc; c++) {
+      if ((px[c] > x1) && (px[c] < x2) &&
+          (py[c] > y1) && (py[c] < y2) &&
+          (pz[c] > z1) && (pz[c] < z2)) {
+        i  = int(px[c]);
+        j  = int(py[c]);
+        k  = int(pz[c]);
+        t1 = px[c] - i;
+        u1 = py[c] - j;
+        v1 = pz[c] - k;
+        t2 = 1 - t1;
+        u2 = 1 - u1;
+        v2 = 1 - v1;
+
+        const irtkGreyPixel *ptr = data + i + j * X + k * XY;
+        value = (t1 * (u2 * (v2 * ptr[1]      + v1 * ptr[XY+1]) +
+                       u1 * (v2 * ptr[X+1]    + v1 * ptr[XY+X+1])) +
+                 t2 * (u2 * (v2 * ptr[0]      + v1 * ptr[XY]) +
+                       u1 * (v2 * ptr[X]      + v1 * ptr[XY+X])));
+        if (value >= 0)
+          slice._metric->Add(sv[n+c], round(value));
+      }
+    }
+  }
+
+  return slice._metric->Evaluate();
+}
+
+void irtkMultiSliceRigidRegistration::Step(irtkMultiSliceRigidRegistrationSlice &slice, int level)
+{
+  int i, n;
+  double similarity, new_similarity, old_similarity, s1, s2, norm, epsilon, maxChange, diff;
+  irtkRigidTransformation *transformation = slice._transformation;
+
+  n = transformation->NumberOfDOFs();
+  double *params = new double[n];
+  double *dx     = new double[n];
+
+  for (i = 0; i < n; i++) {
+    params[i] = transformation->Get(i);
+  }
+
+  // Assume that the transformation is the optimal transformation
+  old_similarity = new_similarity = similarity = this->Evaluate(slice, level);
+
+  // Gradient by central differences with the current step size
+  float step = slice._step;
+  norm = 0;
+  for (i = 0; i < n; i++) {
+    if (transformation->irtkTransformation::GetStatus(i) == _Active) {
+      transformation->Put(i, params[i] + step);
+      s1 = this->Evaluate(slice, level);
+      transformation->Put(i, params[i] - step);
+      s2 = this->Evaluate(slice, level);
+      transformation->Put(i, params[i]);
+      dx[i] = s1 - s2;
+    } else {
+      dx[i] = 0;
+    }
+    norm += dx[i] * dx[i];
+  }
+  norm = sqrt(norm);
+  for (i = 0; i < n; i++) {
+    dx[i] = (norm > 0) ? dx[i] / norm : 0;
+  }
+
+  // Step along gradient direction until no further improvement is necessary
+  do {
+    new_similarity = similarity;
+    for (i = 0; i < n; i++) {
+      transformation->Put(i, transformation->Get(i) + slice._step * dx[i]);
+    }
+    similarity = this->Evaluate(slice, level);
+  } while (similarity > new_similarity + _Epsilon);
+
+  // Last step was no improvement, so back track
+  for (i = 0; i < n; i++) {
+    transformation->Put(i, transformation->Get(i) - slice._step * dx[i]);
+  }
+
+  epsilon   = (new_similarity > old_similarity) ? new_similarity - old_similarity : 0;
+  maxChange = 0;
+  for (i = 0; i < n; i++) {
+    diff = fabs(transformation->Get(i) - params[i]);
+    if (maxChange < diff) maxChange = diff;
+  }
+
+  delete []params;
+  delete []dx;
+
+  // Advance to the next step size when converged or out of iterations
+  slice._iteration++;
+  if ((epsilon <= _Epsilon) || (maxChange <= slice._delta) ||
+      (slice._iteration == _NumberOfIterations[level])) {
+    slice._step      /= 2;
+    slice._delta     /= 2.0;
+    slice._iteration  = 0;
+    slice._stepIndex++;
+    if (slice._stepIndex == _NumberOfSteps[level]) slice._done = true;
+  }
+}
+
+void irtkMultiSliceRigidRegistration::Run()
+{
+  int i, level, pass;
+  vector<int> active;
+
+  if (_source == NULL && _SourceCache == NULL) {
+    cerr << this->NameOfClass() << "::Run: Filter has no source input" << endl;
+    exit(1);
+  }
+
+  // Pre-process the source once for all slices
+  if (_SourceCache == NULL) {
+    irtkImageRigidRegistrationWithPadding registration;
+    registration.SetInput(_source, _source);
+    registration.GuessParameterSliceToVolume();
+    registration.SetSimilarityMeasure(_SimilarityMeasure);
+    _SourceCache    = new irtkRegistrationSourceCache;
+    _OwnSourceCache = true;
+    registration.InitializeSourceCache(_SourceCache);
+  }
+  if (_SourceCache->_NumberOfLevels < _NumberOfLevels) {
+    cerr << this->NameOfClass() << "::Run: Source cache has too few levels" << endl;
+    exit(1);
+  }
+
+  task_scheduler_init init(tbb_no_threads);
+
+  for (level = _NumberOfLevels-1; level >= 0; level--) {
+
+    irtkMultiThreadedMultiSliceRigidRegistrationInitialize initialize(this, level);
+    parallel_for(blocked_range<int>(0, _slices.size()), initialize);
+
+    // Each pass advances every slice which has not converged by one iteration
+    for (pass = 0; ; pass++) {
+      active.clear();
+      for (i = 0; i < int(_slices.size()); i++) {
+        if (_slices[i]._done == false) active.push_back(i);
+      }
+      if (active.empty()) break;
+
+      if (_DebugFlag == true)
+        cout << this->NameOfClass() << ": level " << level+1 << ", pass " << pass+1
+             << ", " << active.size() << " active slices" << endl;
+
+      irtkMultiThreadedMultiSliceRigidRegistrationStep step(this, active, level);
+      parallel_for(blocked_range<int>(0, active.size(), 1), step);
+    }
+
+    for (i = 0; i < int(_slices.size()); i++) {
+      this->Finalize(_slices[i]);
+    }
+  }
+
+  init.terminate();
+}
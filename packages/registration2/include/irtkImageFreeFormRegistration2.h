@@ -26,6 +26,10 @@
 class irtkImageFreeFormRegistration2 : public irtkImageRegistration2
 {
 
+  friend class irtkMultiThreadedImageFreeFormRegistration2Displacement;
+  friend class irtkMultiThreadedImageFreeFormRegistration2UpdateSource;
+  friend class irtkMultiThreadedImageFreeFormRegistration2EvaluateGradient3D;
+
 protected:
 
   /// Pointer to the local transformation which is currently optimized
@@ -40,6 +44,12 @@ protected:
   /// Pointer to static displacements for every voxel
   double *_displacementLUT;
 
+  /// Separable B-spline weights of the target grid, if it is aligned with the lattice
+  irtkBSplineGridLUT _gridLUT;
+
+  /// Pointer to displacements of the current FFD for every voxel, NULL if not evaluated with _gridLUT
+  double *_affdDisplacementLUT;
+
   /// Pointer to adjugate Jacobian matrix
   irtkMatrix *_adjugate;
 
@@ -88,7 +98,8 @@ protected:
   /// Update state of the registration based on current transformation estimate
   virtual void Update(bool);
 
-  /// Update state of the registration based on current transformation estimate (source image)
+  /// Update state of the registration based on current transformation estimate (source image),
+  /// slabs of target rows are transformed in parallel
   virtual void UpdateSource();
 
   /// Update state of the registration based on current transformation estimate (source image and source image gradient)
@@ -116,7 +127,8 @@ protected:
   /// Evaluate the gradient of the similarity measure for the current transformation for 2D images
   virtual void EvaluateGradient2D(double *);
 
-  /// Evaluate the gradient of the similarity measure for the current transformation for 3D images
+  /// Evaluate the gradient of the similarity measure for the current transformation for 3D images,
+  /// voxel-driven with separable B-spline weights and parallel over slabs of the target
   virtual void EvaluateGradient3D(double *);
 
   /// Evaluate the gradient of the similarity measure for the current transformation.
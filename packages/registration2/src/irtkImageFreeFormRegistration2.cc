@@ -20,6 +20,293 @@ Changes   : $Author$
 
 #define MAX_NO_LINE_ITERATIONS 12
 
+/// Linear interpolation of the n corners of a voxel cell with precomputed weights
+static inline double irtkInterpolateCell(const irtkRealPixel *ptr, const int *offset, const double *w, int n)
+{
+    double value = 0;
+    for (int l = 0; l < n; l++) value += w[l] * ptr[offset[l]];
+    return value;
+}
+
+class irtkMultiThreadedImageFreeFormRegistration2Displacement
+{
+
+    irtkImageFreeFormRegistration2 *_filter;
+
+public:
+
+    irtkMultiThreadedImageFreeFormRegistration2Displacement(irtkImageFreeFormRegistration2 *filter) {
+        _filter = filter;
+    }
+
+    void operator()(const blocked_range<int> &r) const {
+        double *ptr = _filter->_affdDisplacementLUT;
+        _filter->_affd->LocalDisplacement(_filter->_gridLUT, ptr, ptr + 1, ptr + 2, 3, r.begin(), r.end());
+    }
+
+};
+
+class irtkMultiThreadedImageFreeFormRegistration2UpdateSource
+{
+
+    irtkImageFreeFormRegistration2 *_filter;
+
+    /// Whether the source gradient is transformed as well
+    bool _gradient;
+
+    /// Whether target and source are 2D
+    bool _2D;
+
+    /// Offsets of the corners of a source voxel cell
+    int _offset[8];
+
+public:
+
+    irtkMultiThreadedImageFreeFormRegistration2UpdateSource(irtkImageFreeFormRegistration2 *filter, bool gradient) {
+        _filter   = filter;
+        _gradient = gradient;
+        _2D       = (_filter->_target->GetZ() == 1) && (_filter->_source->GetZ() == 1);
+
+        int x  = _filter->_source->GetX();
+        int xy = _filter->_source->GetX() * _filter->_source->GetY();
+        _offset[0] = 0;
+        _offset[1] = 1;
+        _offset[2] = x;
+        _offset[3] = x + 1;
+        _offset[4] = xy;
+        _offset[5] = xy + 1;
+        _offset[6] = xy + x;
+        _offset[7] = xy + x + 1;
+    }
+
+    void operator()(const blocked_range<int> &r) const {
+        double x, y, z, t1, t2, u1, u2, v1, v2, w[8];
+        int a, b, c, i, l;
+
+        irtkRealImage *source = _filter->_source;
+        irtkRealImage &transformedSource = _filter->_transformedSource;
+        irtkRealImage &sourceGradient = _filter->_sourceGradient;
+        irtkRealImage &transformedSourceGradient = _filter->_transformedSourceGradient;
+        irtkInterpolateImageFunction *interpolator = _filter->_interpolator;
+        irtkInterpolateImageFunction *interpolatorGradient = _filter->_interpolatorGradient;
+        double padding = _filter->_SourcePadding;
+        bool linear = (_filter->_InterpolationMode == Interpolation_Linear);
+
+        int X = _filter->_target->GetX();
+        int Y = _filter->_target->GetY();
+        int corners = _2D ? 4 : 8;
+        int components = _2D ? 2 : 3;
+
+        // Each row of the target is processed independently
+        for (int row = r.begin(); row != r.end(); row++) {
+            int j = row % Y;
+            int k = row / Y;
+
+            const double *ptr2latt = _filter->_latticeCoordLUT + 3 * row * X;
+            const double *ptr2disp = _filter->_displacementLUT + 3 * row * X;
+            const double *ptr2affd = NULL;
+            if (_filter->_affdDisplacementLUT != NULL) ptr2affd = _filter->_affdDisplacementLUT + 3 * row * X;
+            const irtkGreyPixel *ptr2mask = _filter->_distanceMask.GetPointerToVoxels(0, j, k);
+            irtkRealPixel *ptr2out = transformedSource.GetPointerToVoxels(0, j, k);
+            irtkRealPixel *ptr2grad[3] = {NULL, NULL, NULL};
+            if (_gradient) {
+                for (l = 0; l < components; l++) ptr2grad[l] = transformedSourceGradient.GetPointerToVoxels(0, j, k, l);
+            }
+
+            for (i = 0; i < X; i++, ptr2latt += 3, ptr2disp += 3) {
+                bool inside = false;
+                if (ptr2mask[i] == 0) {
+                    x = ptr2latt[0];
+                    y = ptr2latt[1];
+                    if (_2D) {
+                        z = 0;
+                        _filter->_affd->FFD2D(x, y);
+                    } else if (ptr2affd != NULL) {
+                        x = ptr2affd[3*i];
+                        y = ptr2affd[3*i+1];
+                        z = ptr2affd[3*i+2];
+                    } else {
+                        z = ptr2latt[2];
+                        _filter->_affd->FFD3D(x, y, z);
+                    }
+                    x += ptr2disp[0];
+                    y += ptr2disp[1];
+                    z += ptr2disp[2];
+                    source->WorldToImage(x, y, z);
+                    if (_2D) z = 0;
+
+                    // Check whether transformed point is inside volume
+                    inside = (x > 0) && (x < source->GetX()-1) &&
+                             (y > 0) && (y < source->GetY()-1) &&
+                             (_2D || ((z > 0) && (z < source->GetZ()-1)));
+                }
+
+                if (inside == false) {
+                    ptr2out[i] = padding;
+                    if (_gradient) {
+                        for (l = 0; l < components; l++) ptr2grad[l][i] = 0;
+                    }
+                } else if (linear) {
+                    // Calculated integer coordinates
+                    a = int(x);
+                    b = int(y);
+                    c = _2D ? 0 : int(z);
+
+                    // Calculated fractional coordinates
+                    t1 = x - a;
+                    u1 = y - b;
+                    v1 = _2D ? 0 : z - c;
+                    t2 = 1 - t1;
+                    u2 = 1 - u1;
+                    v2 = 1 - v1;
+
+                    // Weights of the cell corners, shared by image and gradient
+                    w[0] = t2 * u2 * v2;
+                    w[1] = t1 * u2 * v2;
+                    w[2] = t2 * u1 * v2;
+                    w[3] = t1 * u1 * v2;
+                    w[4] = t2 * u2 * v1;
+                    w[5] = t1 * u2 * v1;
+                    w[6] = t2 * u1 * v1;
+                    w[7] = t1 * u1 * v1;
+
+                    // Linear interpolation in source image
+                    ptr2out[i] = irtkInterpolateCell(source->GetPointerToVoxels(a, b, c), _offset, w, corners);
+
+                    // Linear interpolation in gradient image
+                    if (_gradient) {
+                        for (l = 0; l < components; l++) {
+                            ptr2grad[l][i] = irtkInterpolateCell(sourceGradient.GetPointerToVoxels(a, b, c, l), _offset, w, corners);
+                        }
+                    }
+                } else {
+                    // Interpolation in source image
+                    ptr2out[i] = interpolator->Evaluate(x, y, z);
+
+                    // Interpolation in gradient image
+                    if (_gradient) {
+                        for (l = 0; l < components; l++) ptr2grad[l][i] = interpolatorGradient->Evaluate(x, y, z, l);
+                    }
+                }
+            }
+        }
+    }
+
+};
+
+class irtkMultiThreadedImageFreeFormRegistration2EvaluateGradient3D
+{
+
+    irtkImageFreeFormRegistration2 *_filter;
+
+    /// Whether any DoF of a control point is active
+    const vector<char> &_active;
+
+    /// Number of DoFs
+    int _n;
+
+public:
+
+    /// Gradient accumulated by this body
+    double *_gradient;
+
+    irtkMultiThreadedImageFreeFormRegistration2EvaluateGradient3D(irtkImageFreeFormRegistration2 *filter, const vector<char> &active) : _active(active) {
+        _filter   = filter;
+        _n        = _filter->_affd->NumberOfDOFs();
+        _gradient = new double[_n];
+        for (int i = 0; i < _n; i++) _gradient[i] = 0;
+    }
+
+    irtkMultiThreadedImageFreeFormRegistration2EvaluateGradient3D(irtkMultiThreadedImageFreeFormRegistration2EvaluateGradient3D &x, split) : _active(x._active) {
+        _filter   = x._filter;
+        _n        = x._n;
+        _gradient = new double[_n];
+        for (int i = 0; i < _n; i++) _gradient[i] = 0;
+    }
+
+    ~irtkMultiThreadedImageFreeFormRegistration2EvaluateGradient3D() {
+        delete []_gradient;
+    }
+
+    void join(const irtkMultiThreadedImageFreeFormRegistration2EvaluateGradient3D &y) {
+        for (int i = 0; i < _n; i++) _gradient[i] += y._gradient[i];
+    }
+
+    void operator()(const blocked_range<int> &r) {
+        double wx[4], wy[4], wz[4], wyz, basis, g0, g1, g2;
+        int a, b, c, i, l, m, n, x, y, z, index;
+
+        int X  = _filter->_target->GetX();
+        int Y  = _filter->_target->GetY();
+        int cx = _filter->_affd->GetX();
+        int cy = _filter->_affd->GetY();
+        int cz = _filter->_affd->GetZ();
+        int offset = cx * cy * cz;
+        double padding = _filter->_SourcePadding;
+
+        // Each row of the target is processed independently
+        for (int row = r.begin(); row != r.end(); row++) {
+            int j = row % Y;
+            int k = row / Y;
+
+            const double *ptr2latt = _filter->_latticeCoordLUT + 3 * row * X;
+            const irtkGreyPixel *ptr2mask = _filter->_distanceMask.GetPointerToVoxels(0, j, k);
+            const irtkRealPixel *ptr2source = _filter->_transformedSource.GetPointerToVoxels(0, j, k);
+            const irtkRealPixel *ptr2grad0 = _filter->_similarityGradient.GetPointerToVoxels(0, j, k, 0);
+            const irtkRealPixel *ptr2grad1 = _filter->_similarityGradient.GetPointerToVoxels(0, j, k, 1);
+            const irtkRealPixel *ptr2grad2 = _filter->_similarityGradient.GetPointerToVoxels(0, j, k, 2);
+
+            for (i = 0; i < X; i++, ptr2latt += 3) {
+
+                // Check whether reference point is valid
+                if ((ptr2mask[i] != 0) || (ptr2source[i] <= padding)) continue;
+
+                // Separable B-spline weights of the 4x4x4 control points around the voxel
+                l = (int)floor(ptr2latt[0]);
+                m = (int)floor(ptr2latt[1]);
+                n = (int)floor(ptr2latt[2]);
+                for (a = 0; a < 4; a++) {
+                    wx[a] = irtkBSplineFreeFormTransformation3D::B(a, ptr2latt[0] - l);
+                    wy[a] = irtkBSplineFreeFormTransformation3D::B(a, ptr2latt[1] - m);
+                    wz[a] = irtkBSplineFreeFormTransformation3D::B(a, ptr2latt[2] - n);
+                }
+
+                g0 = ptr2grad0[i];
+                g1 = ptr2grad1[i];
+                g2 = ptr2grad2[i];
+
+                // Convert voxel-based gradient into gradient with respect to parameters (chain rule)
+                //
+                // NOTE: This currently assumes that the control points displacements are aligned with the world coordinate displacements
+                //
+                for (c = 0; c < 4; c++) {
+                    z = n - 1 + c;
+                    if ((z < 0) || (z >= cz)) continue;
+                    for (b = 0; b < 4; b++) {
+                        y = m - 1 + b;
+                        if ((y < 0) || (y >= cy)) continue;
+                        wyz = wy[b] * wz[c];
+                        for (a = 0; a < 4; a++) {
+                            x = l - 1 + a;
+                            if ((x < 0) || (x >= cx)) continue;
+
+                            // Same ordering as irtkFreeFormTransformation3D::LatticeToIndex
+                            index = (x * cy + y) * cz + z;
+                            if (_active[index] == false) continue;
+
+                            basis = wx[a] * wyz;
+                            _gradient[index]            += basis * g0;
+                            _gradient[index + offset]   += basis * g1;
+                            _gradient[index + 2*offset] += basis * g2;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+};
+
 irtkImageFreeFormRegistration2::irtkImageFreeFormRegistration2()
 {
     // Print debugging information
@@ -40,6 +327,7 @@ irtkImageFreeFormRegistration2::irtkImageFreeFormRegistration2()
     _MFFDMode    = true;
     _adjugate    = NULL;
     _determinant = NULL;
+    _affdDisplacementLUT = NULL;
 }
 
 void irtkImageFreeFormRegistration2::GuessParameter()
@@ -257,6 +545,14 @@ void irtkImageFreeFormRegistration2::Initialize(int level)
             }
         }
     }
+
+    // Evaluate the current FFD over the whole target in separable passes if
+    // the target grid is aligned with the lattice
+    _affdDisplacementLUT = NULL;
+    if (((_target->GetZ() > 1) || (_source->GetZ() > 1)) &&
+        (_gridLUT.Initialize(*_affd, _target->GetImageAttributes()) == true)) {
+        _affdDisplacementLUT = new double[_target->GetNumberOfVoxels() * 3];
+    }
 }
 
 void irtkImageFreeFormRegistration2::Finalize()
@@ -306,303 +602,53 @@ void irtkImageFreeFormRegistration2::Finalize(int level)
     _determinant = new double[_affd->NumberOfDOFs()/3];
     delete []_displacementLUT;
     delete []_latticeCoordLUT;
+    delete []_affdDisplacementLUT;
+    _affdDisplacementLUT = NULL;
 }
 
 void irtkImageFreeFormRegistration2::UpdateSource()
 {
-    double *ptr1;
-    double x, y, z, t1, t2, u1, u2, v1, v2;
-    int a, b, c, i, j, k, offset1, offset2, offset3, offset4, offset5, offset6, offset7, offset8;
-
     IRTK_START_TIMING();
 
     // Generate transformed tmp image
     _transformedSource = *_target;
 
-    // Calculate offsets for fast pixel access
-    offset1 = 0;
-    offset2 = 1;
-    offset3 = this->_source->GetX();
-    offset4 = this->_source->GetX()+1;
-    offset5 = this->_source->GetX()*this->_source->GetY();
-    offset6 = this->_source->GetX()*this->_source->GetY()+1;
-    offset7 = this->_source->GetX()*this->_source->GetY()+this->_source->GetX();
-    offset8 = this->_source->GetX()*this->_source->GetY()+this->_source->GetX()+1;
-
-    double *ptr2disp = _displacementLUT;
-    double *ptr2latt = _latticeCoordLUT;
-    if ((_target->GetZ() == 1) && (_source->GetZ() == 1)) {
-        for (j = 0; j < _target->GetY(); j++) {
-            for (i = 0; i < _target->GetX(); i++) {
-            	if (_distanceMask(i, j, 0) == 0) {
-                    x = ptr2latt[0];
-                    y = ptr2latt[1];
-                    z = 0;
-                    _affd->FFD2D(x, y);
-                    x += ptr2disp[0];
-                    y += ptr2disp[1];
-                    z += ptr2disp[2];
-                    _source->WorldToImage(x, y, z);
+    task_scheduler_init init(tbb_no_threads);
 
-                    // Check whether transformed point is inside volume
-                    if ((x > 0) && (x < _source->GetX()-1) &&
-                        (y > 0) && (y < _source->GetY()-1)) {
-
-                            if (_InterpolationMode == Interpolation_Linear) {
-                                // Calculated integer coordinates
-                                a  = int(x);
-                                b  = int(y);
-
-                                // Calculated fractional coordinates
-                                t1 = x - a;
-                                u1 = y - b;
-                                t2 = 1 - t1;
-                                u2 = 1 - u1;
-
-                                // Linear interpolation in source image
-                                ptr1 = (double *)_source->GetScalarPointer(a, b, 0);
-                                _transformedSource(i, j, 0) = t1 * (u2 * ptr1[offset2] + u1 * ptr1[offset4]) + t2 * (u2 * ptr1[offset1] + u1 * ptr1[offset3]);
-                            } else {
-                                // Interpolation in source image
-                                _transformedSource(i, j, 0) = _interpolator->Evaluate(x, y, 0);
-                            }
-                    } else {
-                        _transformedSource(i, j, 0) = _SourcePadding;
-                    }
-                } else {
-                    _transformedSource(i, j, 0) = _SourcePadding;
-                }
-                ptr2disp += 3;
-                ptr2latt += 3;
-            }
-        }
-    } else {
-        for (k = 0; k < _target->GetZ(); k++) {
-            for (j = 0; j < _target->GetY(); j++) {
-                for (i = 0; i < _target->GetX(); i++) {
-                	if (_distanceMask(i, j, k) == 0) {
-                        x = ptr2latt[0];
-                        y = ptr2latt[1];
-                        z = ptr2latt[2];
-                        _affd->FFD3D(x, y, z);
-                        x += ptr2disp[0];
-                        y += ptr2disp[1];
-                        z += ptr2disp[2];
-                        _source->WorldToImage(x, y, z);
-
-                        // Check whether transformed point is inside volume
-                        if ((x > 0) && (x < _source->GetX()-1) &&
-                            (y > 0) && (y < _source->GetY()-1) &&
-                            (z > 0) && (z < _source->GetZ()-1)) {
-                                if (_InterpolationMode == Interpolation_Linear) {
-
-                                    // Calculated integer coordinates
-                                    a  = int(x);
-                                    b  = int(y);
-                                    c  = int(z);
-
-                                    // Calculated fractional coordinates
-                                    t1 = x - a;
-                                    u1 = y - b;
-                                    v1 = z - c;
-                                    t2 = 1 - t1;
-                                    u2 = 1 - u1;
-                                    v2 = 1 - v1;
-
-                                    // Linear interpolation in source image
-                                    ptr1 = (double *)_source->GetScalarPointer(a, b, c);
-                                    _transformedSource(i, j, k) = (t1 * (u2 * (v2 * ptr1[offset2] + v1 * ptr1[offset6]) +
-                                        u1 * (v2 * ptr1[offset4] + v1 * ptr1[offset8])) +
-                                        t2 * (u2 * (v2 * ptr1[offset1] + v1 * ptr1[offset5]) +
-                                        u1 * (v2 * ptr1[offset3] + v1 * ptr1[offset7])));
-                                } else {
-                                    // Interpolation in source image
-                                    _transformedSource(i, j, k) = _interpolator->Evaluate(x, y, z);
-                                }
-                        } else {
-                            _transformedSource(i, j, k) = _SourcePadding;
-                        }
-                    } else {
-                        _transformedSource(i, j, k) = _SourcePadding;
-                    }
-                    ptr2disp += 3;
-                    ptr2latt += 3;
-                }
-            }
-        }
+    // Displacements of the current FFD in separable passes over slices of the target
+    if (_affdDisplacementLUT != NULL) {
+        irtkMultiThreadedImageFreeFormRegistration2Displacement displacement(this);
+        parallel_for(blocked_range<int>(0, _target->GetZ()), displacement);
     }
 
+    // Transform slabs of target rows in parallel
+    irtkMultiThreadedImageFreeFormRegistration2UpdateSource update(this, false);
+    parallel_for(blocked_range<int>(0, _target->GetY()*_target->GetZ()), update);
+    init.terminate();
+
     IRTK_END_TIMING("irtkImageFreeFormRegistration2::UpdateSource");
 }
 
 void irtkImageFreeFormRegistration2::UpdateSourceAndGradient()
 {
-	irtkRealPixel *ptr1, *ptr2;
-	double x, y, z, t1, t2, u1, u2, v1, v2;
-    int a, b, c, i, j, k, offset1, offset2, offset3, offset4, offset5, offset6, offset7, offset8;
-
     IRTK_START_TIMING();
 
     // Generate transformed tmp image
     _transformedSource = *_target;
 
-    // Calculate offsets for fast pixel access
-    offset1 = 0;
-    offset2 = 1;
-    offset3 = this->_source->GetX();
-    offset4 = this->_source->GetX()+1;
-    offset5 = this->_source->GetX()*this->_source->GetY();
-    offset6 = this->_source->GetX()*this->_source->GetY()+1;
-    offset7 = this->_source->GetX()*this->_source->GetY()+this->_source->GetX();
-    offset8 = this->_source->GetX()*this->_source->GetY()+this->_source->GetX()+1;
-
-    double *ptr2disp = _displacementLUT;
-    double *ptr2latt = _latticeCoordLUT;
-    if ((_target->GetZ() == 1) && (_source->GetZ() == 1)) {
-        for (j = 0; j < _target->GetY(); j++) {
-            for (i = 0; i < _target->GetX(); i++) {
-            	if (_distanceMask(i, j, 0) == 0) {
-                    x = ptr2latt[0];
-                    y = ptr2latt[1];
-                    z = 0;
-                    _affd->FFD2D(x, y);
-                    x += ptr2disp[0];
-                    y += ptr2disp[1];
-                    z += ptr2disp[2];
-                    _source->WorldToImage(x, y, z);
+    task_scheduler_init init(tbb_no_threads);
 
-                    // Check whether transformed point is inside volume
-                    if ((x > 0) && (x < _source->GetX()-1) &&
-                        (y > 0) && (y < _source->GetY()-1)) {
-
-                            if (_InterpolationMode == Interpolation_Linear) {
-                                // Calculated integer coordinates
-                                a  = int(x);
-                                b  = int(y);
-
-                                // Calculated fractional coordinates
-                                t1 = x - a;
-                                u1 = y - b;
-                                t2 = 1 - t1;
-                                u2 = 1 - u1;
-
-                                // Linear interpolation in source image
-                                ptr1 = (irtkRealPixel *)_source->GetScalarPointer(a, b, 0);
-                                _transformedSource(i, j, 0) = t1 * (u2 * ptr1[offset2] + u1 * ptr1[offset4]) + t2 * (u2 * ptr1[offset1] + u1 * ptr1[offset3]);
-
-                                // Linear interpolation in gradient image
-                                ptr2 = _sourceGradient.GetPointerToVoxels(a, b, 0, 0);
-                                _transformedSourceGradient(i, j, 0, 0) = t1 * (u2 * ptr2[offset2] + u1 * ptr2[offset4]) + t2 * (u2 * ptr2[offset1] + u1 * ptr2[offset3]);
-                                ptr2 = _sourceGradient.GetPointerToVoxels(a, b, 0, 1);
-                                _transformedSourceGradient(i, j, 0, 1) = t1 * (u2 * ptr2[offset2] + u1 * ptr2[offset4]) + t2 * (u2 * ptr2[offset1] + u1 * ptr2[offset3]);
-
-                            } else {
-                                // Interpolation in source image
-                                _transformedSource(i, j, 0) = _interpolator->Evaluate(x, y, 0);
-
-                                // Interpolation in gradient image
-                                _transformedSourceGradient(i, j, 0, 0) = _interpolatorGradient->Evaluate(x, y, 0, 0);
-                                _transformedSourceGradient(i, j, 0, 1) = _interpolatorGradient->Evaluate(x, y, 0, 1);
-                            }
-                    } else {
-                        _transformedSource(i, j, 0) = _SourcePadding;
-                        _transformedSourceGradient(i, j, 0, 0) = 0;
-                        _transformedSourceGradient(i, j, 0, 1) = 0;
-                    }
-                } else {
-                    _transformedSource(i, j, 0) = _SourcePadding;
-                    _transformedSourceGradient(i, j, 0, 0) = 0;
-                    _transformedSourceGradient(i, j, 0, 1) = 0;
-                }
-                ptr2disp += 3;
-                ptr2latt += 3;
-            }
-        }
-    } else {
-        for (k = 0; k < _target->GetZ(); k++) {
-            for (j = 0; j < _target->GetY(); j++) {
-                for (i = 0; i < _target->GetX(); i++) {
-                	if (_distanceMask(i, j, k) == 0) {
-                        x = ptr2latt[0];
-                        y = ptr2latt[1];
-                        z = ptr2latt[2];
-                        _affd->FFD3D(x, y, z);
-                        x += ptr2disp[0];
-                        y += ptr2disp[1];
-                        z += ptr2disp[2];
-                        _source->WorldToImage(x, y, z);
-
-                        // Check whether transformed point is inside volume
-                        if ((x > 0) && (x < _source->GetX()-1) &&
-                            (y > 0) && (y < _source->GetY()-1) &&
-                            (z > 0) && (z < _source->GetZ()-1)) {
-
-                                if (_InterpolationMode == Interpolation_Linear) {
-                                    // Calculated integer coordinates
-                                    a  = int(x);
-                                    b  = int(y);
-                                    c  = int(z);
-
-                                    // Calculated fractional coordinates
-                                    t1 = x - a;
-                                    u1 = y - b;
-                                    v1 = z - c;
-                                    t2 = 1 - t1;
-                                    u2 = 1 - u1;
-                                    v2 = 1 - v1;
-
-                                    // Linear interpolation in source image
-                                    ptr1 = (irtkRealPixel *)_source->GetScalarPointer(a, b, c);
-                                    _transformedSource(i, j, k) = (t1 * (u2 * (v2 * ptr1[offset2] + v1 * ptr1[offset6]) +
-                                        u1 * (v2 * ptr1[offset4] + v1 * ptr1[offset8])) +
-                                        t2 * (u2 * (v2 * ptr1[offset1] + v1 * ptr1[offset5]) +
-                                        u1 * (v2 * ptr1[offset3] + v1 * ptr1[offset7])));
-
-                                    // Linear interpolation in gradient image
-                                    ptr2 = _sourceGradient.GetPointerToVoxels(a, b, c, 0);
-                                    _transformedSourceGradient(i, j, k, 0) = (t1 * (u2 * (v2 * ptr2[offset2] + v1 * ptr2[offset6]) +
-                                        u1 * (v2 * ptr2[offset4] + v1 * ptr2[offset8])) +
-                                        t2 * (u2 * (v2 * ptr2[offset1] + v1 * ptr2[offset5]) +
-                                        u1 * (v2 * ptr2[offset3] + v1 * ptr2[offset7])));
-                                    ptr2 = _sourceGradient.GetPointerToVoxels(a, b, c, 1);
-                                    _transformedSourceGradient(i, j, k, 1) = (t1 * (u2 * (v2 * ptr2[offset2] + v1 * ptr2[offset6]) +
-                                        u1 * (v2 * ptr2[offset4] + v1 * ptr2[offset8])) +
-                                        t2 * (u2 * (v2 * ptr2[offset1] + v1 * ptr2[offset5]) +
-                                        u1 * (v2 * ptr2[offset3] + v1 * ptr2[offset7])));
-                                    ptr2 = _sourceGradient.GetPointerToVoxels(a, b, c, 2);
-                                    _transformedSourceGradient(i, j, k, 2) = (t1 * (u2 * (v2 * ptr2[offset2] + v1 * ptr2[offset6]) +
-                                        u1 * (v2 * ptr2[offset4] + v1 * ptr2[offset8])) +
-                                        t2 * (u2 * (v2 * ptr2[offset1] + v1 * ptr2[offset5]) +
-                                        u1 * (v2 * ptr2[offset3] + v1 * ptr2[offset7])));
-
-                                } else {
-                                    // Interpolation in source image
-                                    _transformedSource(i, j, k) = _interpolator->Evaluate(x, y, z);
-
-                                    // Interpolation in gradient image
-                                    _transformedSourceGradient(i, j, k, 0) = _interpolatorGradient->Evaluate(x, y, z, 0);
-                                    _transformedSourceGradient(i, j, k, 1) = _interpolatorGradient->Evaluate(x, y, z, 1);
-                                    _transformedSourceGradient(i, j, k, 2) = _interpolatorGradient->Evaluate(x, y, z, 2);
-                                }
-                        } else {
-                            _transformedSource(i, j, k) = _SourcePadding;
-                            _transformedSourceGradient(i, j, k, 0) = 0;
-                            _transformedSourceGradient(i, j, k, 1) = 0;
-                            _transformedSourceGradient(i, j, k, 2) = 0;
-                        }
-                    } else {
-                        _transformedSource(i, j, k) = _SourcePadding;
-                        _transformedSourceGradient(i, j, k, 0) = 0;
-                        _transformedSourceGradient(i, j, k, 1) = 0;
-                        _transformedSourceGradient(i, j, k, 2) = 0;
-                    }
-                    ptr2disp += 3;
-                    ptr2latt += 3;
-                }
-            }
-        }
+    // Displacements of the current FFD in separable passes over slices of the target
+    if (_affdDisplacementLUT != NULL) {
+        irtkMultiThreadedImageFreeFormRegistration2Displacement displacement(this);
+        parallel_for(blocked_range<int>(0, _target->GetZ()), displacement);
     }
 
+    // Transform slabs of target rows in parallel
+    irtkMultiThreadedImageFreeFormRegistration2UpdateSource update(this, true);
+    parallel_for(blocked_range<int>(0, _target->GetY()*_target->GetZ()), update);
+    init.terminate();
+
     IRTK_END_TIMING("irtkImageFreeFormRegistration2::UpdateSourceAndGradient");
 }
 
@@ -865,58 +911,30 @@ void irtkImageFreeFormRegistration2::EvaluateGradient2D(double *gradient)
 
 void irtkImageFreeFormRegistration2::EvaluateGradient3D(double *gradient)
 {
-    double basis, *ptr;
-    int i, j, k, i1, i2, j1, j2, k1, k2, x, y, z, index, index2, index3;
+    int i, index, offset;
 
-    // Initialize gradient to zero
-    for (i = 0; i < _affd->NumberOfDOFs(); i++) {
-        gradient[i] = 0;
+    // Check which control points have an active DoF
+    offset = _affd->GetX()*_affd->GetY()*_affd->GetZ();
+    vector<char> active(offset);
+    for (index = 0; index < offset; index++) {
+        active[index] = (_affd->irtkTransformation::GetStatus(index) == _Active) ||
+                        (_affd->irtkTransformation::GetStatus(index+offset) == _Active) ||
+                        (_affd->irtkTransformation::GetStatus(index+2*offset) == _Active);
     }
 
-    // Loop over control points
-    for (z = 0; z < _affd->GetZ(); z++) {
-        for (y = 0; y < _affd->GetY(); y++) {
-            for (x = 0; x < _affd->GetX(); x++) {
-
-                // Compute DoFs corresponding to the control point
-                index  = _affd->LatticeToIndex(x, y, z);
-                index2 = index+_affd->GetX()*_affd->GetY()*_affd->GetZ();
-                index3 = index+2*_affd->GetX()*_affd->GetY()*_affd->GetZ();
+    // Loop over all voxels in the target (reference) volume and spread their
+    // gradient onto the 4x4x4 control points of their B-spline support. Rows of
+    // the target are processed in parallel, each thread with its own gradient.
+    //
+    // NOTE: This currently assumes that the control point lattice is aligned with the target image
+    //
+    irtkMultiThreadedImageFreeFormRegistration2EvaluateGradient3D evaluate(this, active);
+    task_scheduler_init init(tbb_no_threads);
+    parallel_reduce(blocked_range<int>(0, _target->GetY()*_target->GetZ()), evaluate);
+    init.terminate();
 
-                // Check if any DoF corresponding to the control point is active
-                if ((_affd->irtkTransformation::GetStatus(index) == _Active) || (_affd->irtkTransformation::GetStatus(index2) == _Active) || (_affd->irtkTransformation::GetStatus(index3) == _Active)) {
-
-                    // If so, calculate bounding box of control point in image coordinates
-                    _affd->BoundingBoxImage(_target, index, i1, j1, k1, i2, j2, k2, 1);
-
-                    // Loop over all voxels in the target (reference) volume
-                    //
-                    // NOTE: This currently assumes that the control point lattice is aligned with the target image
-                    //
-                    for (k = k1; k <= k2; k++) {
-                        for (j = j1; j <= j2; j++) {
-                            ptr = &(_latticeCoordLUT[3 * (k * (_target->GetX()*_target->GetY()) + j * _target->GetX() + i1)]);
-                            for (i = i1; i <= i2; i++) {
-                                // Check whether reference point is valid
-                            	if ((_distanceMask(i, j, k) == 0) && (_transformedSource(i, j, k) > _SourcePadding)) {
-                                    // Compute B-spline tensor product at current position
-                                    basis = _affd->B(ptr[0] - x) * _affd->B(ptr[1] - y) * _affd->B(ptr[2] - z);
-
-                                    // Convert voxel-based gradient into gradient with respect to parameters (chain rule)
-                                    //
-                                    // NOTE: This currently assumes that the control points displacements are aligned with the world coordinate displacements
-                                    //
-                                    gradient[index]  += basis * _similarityGradient(i, j, k, 0);
-                                    gradient[index2] += basis * _similarityGradient(i, j, k, 1);
-                                    gradient[index3] += basis * _similarityGradient(i, j, k, 2);
-                                }
-                                ptr += 3;
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    for (i = 0; i < _affd->NumberOfDOFs(); i++) {
+        gradient[i] = evaluate._gradient[i];
     }
 }
 
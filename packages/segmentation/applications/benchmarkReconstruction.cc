@@ -0,0 +1,608 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+              Visual Information Processing (VIP), 2011 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+=========================================================================*/
+#include <vector>
+#include <string>
+#include <irtkImage.h>
+#include <irtkTransformation.h>
+#include <irtkReconstructionCardiac4D.h>
+
+using namespace std;
+
+//Application to benchmark the kernels of slice-to-volume reconstruction on
+//stacks simulated from a synthetic cine volume, so that no patient data is needed
+
+void usage()
+{
+  cerr << "Usage: benchmarkReconstruction <options>\n" << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "\t-size [n]                  Size of the synthetic cine volume in voxels. [Default: 64]"<<endl;
+  cerr << "\t-resolution [res]          Isotropic resolution of the cine volume and the reconstruction. [Default: 1.25mm]"<<endl;
+  cerr << "\t-phases [n]                Number of cardiac phases of the cine volume. [Default: 15]"<<endl;
+  cerr << "\t-stacks [n]                Number of stacks, alternating axial, sagittal and coronal. [Default: 3]"<<endl;
+  cerr << "\t-frames [n]                Number of frames per slice location. [Default: 25]"<<endl;
+  cerr << "\t-slices [n]                Number of slices per stack. [Default: cover the volume]"<<endl;
+  cerr << "\t-thickness [th]            Slice thickness and spacing. [Default: 4 x resolution]"<<endl;
+  cerr << "\t-inplane [res]             In-plane resolution of the stacks. [Default: 2 x resolution]"<<endl;
+  cerr << "\t-repeat [n]                Number of timed calls of each kernel. [Default: 3]"<<endl;
+  cerr << "\t-threads [n]               Number of threads. [Default: automatic]"<<endl;
+  cerr << "\t-speedup                   Use faster, but lower quality reconstruction."<<endl;
+  cerr << "\t-no_svr                    Do not benchmark slice-to-volume registration."<<endl;
+  cerr << "\t-static                    Also benchmark irtkReconstruction on the first frame."<<endl;
+  cerr << "\t-check_svr [tol]            Check that batched and per-slice slice-to-volume registration agree"<<endl;
+  cerr << "\t                            within tol mm and degrees, exit with an error otherwise. [Default: off]"<<endl;
+  cerr << "\t-report [file]             Write results as JSON, or CSV for .csv files."<<endl;
+  cerr << "\t-debug                     Debug mode."<<endl;
+  cerr << "\t" << endl;
+  cerr << "\t" << endl;
+  exit(1);
+}
+
+//Synthetic cine volume: static body with a pulsating blood pool and myocardium
+irtkRealImage CreatePhantom(int size, double resolution, int phases, double rr)
+{
+  const double PI = 3.14159265358979323846;
+
+  irtkImageAttributes attr;
+  attr._x = attr._y = attr._z = size;
+  attr._t = phases;
+  attr._dx = attr._dy = attr._dz = resolution;
+  attr._dt = rr / phases;
+  irtkRealImage phantom(attr);
+
+  double c = (size - 1) / 2.0;
+  for (int t = 0; t < phases; t++) {
+    double blood = 0.15 * size * (1 + 0.2 * cos(2 * PI * t / phases));
+    double myocardium = blood + 0.07 * size;
+    for (int k = 0; k < size; k++)
+      for (int j = 0; j < size; j++)
+        for (int i = 0; i < size; i++) {
+          double r = sqrt((i - c) * (i - c) + (j - c) * (j - c) + (k - c) * (k - c));
+          if (r < blood)
+            phantom(i, j, k, t) = 600;
+          else if (r < myocardium)
+            phantom(i, j, k, t) = 300;
+          else if (r < 0.4 * size)
+            phantom(i, j, k, t) = 100;
+          else
+            phantom(i, j, k, t) = 0;
+        }
+  }
+  return phantom;
+}
+
+//Empty stack through the centre of the volume; orientation 0 is axial,
+//1 sagittal and 2 coronal
+irtkRealImage CreateStack(int orientation, double fov, double inplane, double thickness, int slices, int frames, double rr)
+{
+  irtkImageAttributes attr;
+  attr._x = attr._y = int(fov / inplane + 0.5);
+  attr._z = (slices > 0) ? slices : int(fov / thickness + 0.5);
+  attr._t = frames;
+  attr._dx = attr._dy = inplane;
+  attr._dz = thickness;
+  attr._dt = rr / frames;
+
+  double xaxis[3] = {1, 0, 0}, yaxis[3] = {0, 1, 0}, zaxis[3] = {0, 0, 1};
+  if (orientation == 1) {
+    xaxis[0] = 0; xaxis[1] = 1; xaxis[2] = 0;
+    yaxis[0] = 0; yaxis[1] = 0; yaxis[2] = 1;
+    zaxis[0] = 1; zaxis[1] = 0; zaxis[2] = 0;
+  }
+  if (orientation == 2) {
+    xaxis[0] = 1; xaxis[1] = 0; xaxis[2] = 0;
+    yaxis[0] = 0; yaxis[1] = 0; yaxis[2] = 1;
+    zaxis[0] = 0; zaxis[1] = -1; zaxis[2] = 0;
+  }
+  for (int i = 0; i < 3; i++) {
+    attr._xaxis[i] = xaxis[i];
+    attr._yaxis[i] = yaxis[i];
+    attr._zaxis[i] = zaxis[i];
+  }
+
+  irtkRealImage stack(attr);
+  return stack;
+}
+
+//Timing of repeated calls of one kernel
+class irtkKernelTimer
+{
+  double _wall, _cpu;
+
+public:
+
+  void Start()
+  {
+    _wall = irtkReconstructionProfile::WallTime();
+    _cpu = irtkReconstructionProfile::CPUTime();
+  }
+
+  void Stop(irtkReconstructionProfile &report, const char *kernel, int calls, double slices, double coeffs, int cores)
+  {
+    double wall = irtkReconstructionProfile::WallTime() - _wall;
+    double cpu = irtkReconstructionProfile::CPUTime() - _cpu;
+    for (int i = 0; i < calls; i++)
+      report.Add(kernel, wall / calls, cpu / calls, slices, coeffs);
+
+    cout << setw(32) << left << kernel << right
+         << setw(12) << 1000 * wall / calls
+         << setw(14) << ((wall > 0) ? calls * slices / wall : 0)
+         << setw(14) << ((wall > 0) ? calls * slices / wall / cores : 0)
+         << setw(16) << ((wall > 0) ? calls * coeffs / wall / cores / 1e6 : 0)
+         << endl;
+  }
+
+};
+
+//Registers the slices from the same perturbed positions once in batches and
+//once one by one, and returns whether all rigid parameters agree within tol
+bool CheckSVR(irtkReconstruction &reconstruction, irtkReconstructionCardiac4D *cardiac, const char *name, double tol)
+{
+  vector<irtkRigidTransformation> original, start, batch, single;
+  unsigned int i;
+
+  reconstruction.GetTransformations(original);
+  start = original;
+  srand(0);
+  for (i = 0; i < start.size(); i++) {
+    start[i].PutTranslationX(start[i].GetTranslationX() + (rand() % 201 - 100) / 100.0);
+    start[i].PutTranslationY(start[i].GetTranslationY() + (rand() % 201 - 100) / 100.0);
+    start[i].PutTranslationZ(start[i].GetTranslationZ() + (rand() % 201 - 100) / 100.0);
+    start[i].PutRotationX(start[i].GetRotationX() + (rand() % 201 - 100) / 100.0);
+    start[i].PutRotationY(start[i].GetRotationY() + (rand() % 201 - 100) / 100.0);
+    start[i].PutRotationZ(start[i].GetRotationZ() + (rand() % 201 - 100) / 100.0);
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    reconstruction.SetTransformations(start);
+    if (pass == 0) reconstruction.BatchSliceToVolumeRegistrationOn();
+    else reconstruction.BatchSliceToVolumeRegistrationOff();
+    if (cardiac != NULL) cardiac->SliceToVolumeRegistrationCardiac4D();
+    else reconstruction.SliceToVolumeRegistration();
+    reconstruction.GetTransformations((pass == 0) ? batch : single);
+  }
+  reconstruction.BatchSliceToVolumeRegistrationOn();
+  reconstruction.SetTransformations(original);
+
+  double dt = 0, dr = 0;
+  for (i = 0; i < batch.size(); i++) {
+    dt = max(dt, fabs(batch[i].GetTranslationX() - single[i].GetTranslationX()));
+    dt = max(dt, fabs(batch[i].GetTranslationY() - single[i].GetTranslationY()));
+    dt = max(dt, fabs(batch[i].GetTranslationZ() - single[i].GetTranslationZ()));
+    dr = max(dr, fabs(batch[i].GetRotationX() - single[i].GetRotationX()));
+    dr = max(dr, fabs(batch[i].GetRotationY() - single[i].GetRotationY()));
+    dr = max(dr, fabs(batch[i].GetRotationZ() - single[i].GetRotationZ()));
+  }
+  bool ok = (dt <= tol) && (dr <= tol);
+  cout << name << ": batched vs per-slice SVR differ by up to " << dt << " mm and "
+       << dr << " degrees" << (ok ? "" : " - FAILED") << endl;
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  //utility variables
+  int i, ok;
+  const double PI = 3.14159265358979323846;
+
+  // Default values.
+  int size = 64;
+  double resolution = 1.25;
+  int phases = 15;
+  int nStacks = 3;
+  int frames = 25;
+  int slices = 0;
+  double thickness = 0;
+  double inplane = 0;
+  int repeat = 3;
+  int threads = 0;
+  double rr = 1;
+  bool speedup = false;
+  bool svr = true;
+  bool benchmark_static = false;
+  double check_svr = -1;
+  bool svr_ok = true;
+  char *report_file = NULL;
+  bool debug = false;
+
+  // Parse options.
+  while (argc > 1){
+    ok = false;
+
+    if ((ok == false) && (strcmp(argv[1], "-size") == 0)){
+      argc--;
+      argv++;
+      size=atoi(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-resolution") == 0)){
+      argc--;
+      argv++;
+      resolution=atof(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-phases") == 0)){
+      argc--;
+      argv++;
+      phases=atoi(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-stacks") == 0)){
+      argc--;
+      argv++;
+      nStacks=atoi(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-frames") == 0)){
+      argc--;
+      argv++;
+      frames=atoi(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-slices") == 0)){
+      argc--;
+      argv++;
+      slices=atoi(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-thickness") == 0)){
+      argc--;
+      argv++;
+      thickness=atof(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-inplane") == 0)){
+      argc--;
+      argv++;
+      inplane=atof(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-repeat") == 0)){
+      argc--;
+      argv++;
+      repeat=atoi(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-threads") == 0)){
+      argc--;
+      argv++;
+      threads=atoi(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-speedup") == 0)){
+      argc--;
+      argv++;
+      speedup=true;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-no_svr") == 0)){
+      argc--;
+      argv++;
+      svr=false;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-static") == 0)){
+      argc--;
+      argv++;
+      benchmark_static=true;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-check_svr") == 0)){
+      argc--;
+      argv++;
+      check_svr=atof(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-report") == 0)){
+      argc--;
+      argv++;
+      report_file=argv[1];
+      argc--;
+      argv++;
+      ok = true;
+    }
+
+    if ((ok == false) && (strcmp(argv[1], "-debug") == 0)){
+      argc--;
+      argv++;
+      debug=true;
+      ok = true;
+    }
+
+    if (ok == false){
+      cerr << "Can not parse argument " << argv[1] << endl;
+      usage();
+    }
+  }
+
+  if ((size < 8) || (phases < 1) || (nStacks < 1) || (frames < 1) || (repeat < 1)) {
+    cerr << "Invalid benchmark size." << endl;
+    exit(1);
+  }
+  if (thickness <= 0)
+    thickness = 4 * resolution;
+  if (inplane <= 0)
+    inplane = 2 * resolution;
+
+  //Number of threads
+  if (threads > 0)
+    tbb_no_threads = threads;
+#ifdef HAS_TBB
+  int cores = (threads > 0) ? threads : task_scheduler_init::default_num_threads();
+#else
+  int cores = 1;
+#endif
+
+  //Synthetic cine volume and static mask
+  irtkRealImage phantom = CreatePhantom(size, resolution, phases, rr);
+  irtkImageAttributes attr = phantom.GetImageAttributes();
+  attr._t = 1;
+  irtkRealImage mask(attr);
+  for (int k = 0; k < size; k++)
+    for (int j = 0; j < size; j++)
+      for (int i = 0; i < size; i++)
+        mask(i, j, k) = (phantom(i, j, k, 0) > 0) ? 1 : 0;
+
+  vector<double> cardiac_phases;
+  for (i = 0; i < phases; i++)
+    cardiac_phases.push_back(2 * PI * i / phases);
+
+  //Empty stacks, the simulation moves each stack slightly so that
+  //slice-to-volume registration has some work to do
+  vector<irtkRealImage> stacks;
+  vector<double> thicknesses;
+  vector<irtkRigidTransformation> stack_transformations, identity;
+  vector<bool> stack_excluded;
+  for (i = 0; i < nStacks; i++) {
+    stacks.push_back(CreateStack(i % 3, size * resolution, inplane, thickness, slices, frames, rr));
+    thicknesses.push_back(thickness);
+    irtkRigidTransformation transformation;
+    transformation.PutRotationX(i + 1);
+    transformation.PutTranslationY(0.5 * (i + 1));
+    stack_transformations.push_back(transformation);
+    identity.push_back(irtkRigidTransformation());
+    stack_excluded.push_back(false);
+  }
+
+  //Cardiac phase of each image frame, in the order of
+  //CreateSlicesAndTransformationsCardiac4D
+  vector<double> slice_phases;
+  for (i = 0; i < nStacks; i++)
+    for (int z = 0; z < stacks[i].GetZ(); z++)
+      for (int t = 0; t < frames; t++)
+        slice_phases.push_back(2 * PI * t / frames);
+
+  cout << "Cine volume: " << size << "^3 voxels of " << resolution << "mm, " << phases << " phases" << endl;
+  cout << "Stacks: " << nStacks << " x " << stacks[0].GetX() << " x " << stacks[0].GetY() << " x "
+       << stacks[0].GetZ() << " x " << frames << " frames, " << slice_phases.size() << " image frames" << endl;
+  cout << "Threads: " << cores << endl;
+
+  //Simulate stacks as simulateStacksCardiac does
+  {
+    irtkReconstructionCardiac4D simulation;
+    simulation.DebugOff();
+    simulation.SetTemporalWeightSinc();
+    simulation.SetReconstructedCardiac4D(phantom);
+    simulation.SetReconstructedCardiacPhase(cardiac_phases);
+    simulation.SetReconstructedTemporalResolution(rr / phases);
+    simulation.InitStackFactor(stacks);
+    simulation.CreateSlicesAndTransformationsCardiac4D(stacks, stack_transformations, thicknesses);
+    simulation.SetSliceRRInterval(rr);
+    simulation.SetSliceCardiacPhase(slice_phases);
+    simulation.CalculateSliceTemporalWeights();
+    simulation.InitializeEM();
+    simulation.InitializeEMValues();
+    simulation.SimulateStacksCardiac4D(stack_excluded);
+    simulation.GetSimulatedStacks(stacks);
+  }
+
+  irtkReconstructionProfile report;
+  report.On();
+  irtkKernelTimer timer;
+  int r;
+
+  cout << endl << setprecision(4);
+  cout << setw(32) << left << "kernel" << right << setw(12) << "ms/call" << setw(14) << "slices/s"
+       << setw(14) << "slices/s/core" << setw(16) << "Mcoeffs/s/core" << endl;
+
+  //Cardiac 4D reconstruction kernels
+  {
+    irtkReconstructionCardiac4D reconstruction;
+    if (debug) reconstruction.DebugOn();
+    else reconstruction.DebugOff();
+    if (speedup) reconstruction.SpeedupOn();
+    else reconstruction.SpeedupOff();
+    reconstruction.SetTemporalWeightSinc();
+    reconstruction.SetReconstructedCardiacPhase(cardiac_phases);
+    reconstruction.SetReconstructedTemporalResolution(rr / phases);
+    reconstruction.SetReconstructedRRInterval(rr);
+    reconstruction.CreateTemplateCardiac4DFromStaticMask(mask, resolution);
+    irtkRealImage m = mask;
+    reconstruction.SetMask(&m, 0);
+    reconstruction.InitStackFactor(stacks);
+    reconstruction.CreateSlicesAndTransformationsCardiac4D(stacks, identity, thicknesses);
+    reconstruction.MaskSlices();
+    reconstruction.SetSliceRRInterval(rr);
+    reconstruction.SetSliceCardiacPhase(slice_phases);
+    reconstruction.CalculateSliceToVolumeTargetCardiacPhase();
+    reconstruction.CalculateSliceTemporalWeights();
+    reconstruction.InitializeEM();
+    reconstruction.InitializeEMValues();
+    reconstruction.SetSmoothingParameters(150, 0.02);
+
+    double n = slice_phases.size();
+
+    timer.Start();
+    for (r = 0; r < repeat; r++) {
+      reconstruction.ResetCoeffs();
+      reconstruction.CoeffInitCardiac4D();
+    }
+    timer.Stop(report, "Cardiac4D/CoeffInit", repeat, n, reconstruction.GetNumberOfCoefficients(), cores);
+    double coeffs = reconstruction.GetNumberOfCoefficients();
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.GaussianReconstructionCardiac4D();
+    timer.Stop(report, "Cardiac4D/GaussianReconstruction", repeat, n, coeffs, cores);
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.SimulateSlicesCardiac4D();
+    timer.Stop(report, "Cardiac4D/SimulateSlices", repeat, n, coeffs, cores);
+
+    reconstruction.InitializeRobustStatistics();
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.EStep();
+    timer.Stop(report, "Cardiac4D/EStep", repeat, n, 0, cores);
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.MStep(1);
+    timer.Stop(report, "Cardiac4D/MStep", repeat, n, 0, cores);
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.SimulateSlicesRobustStatisticsCardiac4D(1, true);
+    timer.Stop(report, "Cardiac4D/SimulateRobustStatistics", repeat, n, coeffs, cores);
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.SuperresolutionCardiac4D(1);
+    timer.Stop(report, "Cardiac4D/Superresolution", repeat, n, coeffs, cores);
+
+    if (svr) {
+      timer.Start();
+      for (r = 0; r < repeat; r++)
+        reconstruction.SliceToVolumeRegistrationCardiac4D();
+      timer.Stop(report, "Cardiac4D/SVR", repeat, n, 0, cores);
+    }
+
+    if (check_svr >= 0)
+      svr_ok = CheckSVR(reconstruction, &reconstruction, "Cardiac4D", check_svr) && svr_ok;
+  }
+
+  //Static reconstruction kernels on the first frame of each stack
+  if (benchmark_static) {
+    vector<irtkRealImage> stacks3D;
+    for (i = 0; i < nStacks; i++)
+      stacks3D.push_back(stacks[i].GetRegion(0, 0, 0, 0, stacks[i].GetX(), stacks[i].GetY(), stacks[i].GetZ(), 1));
+
+    irtkReconstruction reconstruction;
+    if (debug) reconstruction.DebugOn();
+    else reconstruction.DebugOff();
+    if (speedup) reconstruction.SpeedupOn();
+    else reconstruction.SpeedupOff();
+    reconstruction.CreateTemplate(stacks3D[0], resolution);
+    irtkRealImage m = mask;
+    reconstruction.SetMask(&m, 0);
+    reconstruction.CreateSlicesAndTransformations(stacks3D, identity, thicknesses);
+    reconstruction.MaskSlices();
+    reconstruction.InitializeEM();
+    reconstruction.InitializeEMValues();
+    reconstruction.SetSmoothingParameters(150, 0.02);
+
+    double n = 0;
+    for (i = 0; i < nStacks; i++)
+      n += stacks3D[i].GetZ();
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.CoeffInit();
+    double coeffs = reconstruction.GetNumberOfCoefficients();
+    timer.Stop(report, "Static/CoeffInit", repeat, n, coeffs, cores);
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.GaussianReconstruction();
+    timer.Stop(report, "Static/GaussianReconstruction", repeat, n, coeffs, cores);
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.SimulateSlices();
+    timer.Stop(report, "Static/SimulateSlices", repeat, n, coeffs, cores);
+
+    reconstruction.InitializeRobustStatistics();
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.EStep();
+    timer.Stop(report, "Static/EStep", repeat, n, 0, cores);
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.MStep(1);
+    timer.Stop(report, "Static/MStep", repeat, n, 0, cores);
+
+    timer.Start();
+    for (r = 0; r < repeat; r++)
+      reconstruction.Superresolution(1);
+    timer.Stop(report, "Static/Superresolution", repeat, n, coeffs, cores);
+
+    if (svr) {
+      timer.Start();
+      for (r = 0; r < repeat; r++)
+        reconstruction.SliceToVolumeRegistration();
+      timer.Stop(report, "Static/SVR", repeat, n, 0, cores);
+    }
+
+    if (check_svr >= 0)
+      svr_ok = CheckSVR(reconstruction, NULL, "Static", check_svr) && svr_ok;
+  }
+
+  //Write results
+  if (report_file != NULL)
+    report.Write(report_file);
+
+  if (!svr_ok)
+    exit(1);
+
+  //The end of main()
+}
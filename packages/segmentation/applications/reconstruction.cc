@@ -72,6 +72,8 @@ void usage()
                                        tab-sparated columns."<<endl;
   cerr << "\t-debug                    Debug mode - save intermediate results."<<endl;
   cerr << "\t-no_log                   Do not redirect cout and cerr to log files."<<endl;
+  cerr << "\t-profile [file]           Write timing and counters of the reconstruction stages as JSON, or CSV for .csv files."<<endl;
+  cerr << "\t-per_slice_svr            Register slices one by one instead of in batches."<<endl;
   cerr << "\t" << endl;
   cerr << "\t" << endl;
   exit(1);
@@ -110,6 +112,9 @@ int main(int argc, char **argv)
   irtkRealImage *mask=NULL;
   int iterations = 0;
   bool debug = false;
+  //file for timing and counters of the reconstruction stages
+  char *profile_file = NULL;
+  bool per_slice_svr = false;
   double sigma=20;
   double resolution = 0.75;
   double lambda = 0.02;
@@ -455,6 +460,24 @@ int main(int argc, char **argv)
       argv++;
     }
 
+    //Timing and counters of the reconstruction stages
+    if ((ok == false) && (strcmp(argv[1], "-profile") == 0)){
+      argc--;
+      argv++;
+      profile_file=argv[1];
+      ok = true;
+      argc--;
+      argv++;
+    }
+
+    //Slice-to-volume registration of one slice at a time
+    if ((ok == false) && (strcmp(argv[1], "-per_slice_svr") == 0)){
+      argc--;
+      argv++;
+      per_slice_svr=true;
+      ok = true;
+    }
+
     //No log files
     if ((ok == false) && (strcmp(argv[1], "-no_log") == 0)){
       argc--;
@@ -585,6 +608,14 @@ int main(int argc, char **argv)
   //Set debug mode
   if (debug) reconstruction.DebugOn();
   else reconstruction.DebugOff();
+
+  //Record timing and counters of the reconstruction stages
+  if (profile_file != NULL)
+    reconstruction.ProfileOn();
+
+  //Register slices in batches unless requested otherwise
+  if (per_slice_svr)
+    reconstruction.BatchSliceToVolumeRegistrationOff();
   
   //Set force excluded slices
   reconstruction.SetForceExcludedSlices(force_excluded);
@@ -1012,5 +1043,9 @@ int main(int argc, char **argv)
 	  stacks[i].Write(buffer);
 	}
   }
+
+  //Write timing and counters of the reconstruction stages
+  if (profile_file != NULL)
+    reconstruction.WriteProfile(profile_file);
   //The end of main()
 }  
\ No newline at end of file
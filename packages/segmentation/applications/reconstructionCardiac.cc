@@ -44,6 +44,7 @@ void usage()
   cerr << "\t-rrintervals [L] [rr_1]..[rr_L]  R-R interval for slice-locations 1-L in input stacks. [Default: 1 s]."<<endl;
   cerr << "\t-cardphase [K] [num_1]..[num_K]  Cardiac phase (0-2PI) for each image-frames 1-K. [Default: 0]."<<endl;
   cerr << "\t-temporalpsfgauss          Use Gaussian temporal point spread function. [Default: temporal PSF = sinc()*Tukey_window()]" << endl;
+  cerr << "\t-temporal_weight_cutoff [w] Ignore temporal weights with magnitude up to w. [Default: 0]" << endl;
   cerr << "\t-resolution [res]          Isotropic resolution of the volume. [Default: 0.75mm]"<<endl;
   cerr << "\t-numcardphase              Number of cardiac phases to reconstruct. [Default: 15]."<<endl;
   cerr << "\t-rrinterval [rr]           R-R interval of reconstructed cine volume. [Default: 1 s]."<<endl;
@@ -55,7 +56,9 @@ void usage()
   cerr << "\t-delta [delta]             Parameter to define what is an edge. [Default: 150]"<<endl;
   cerr << "\t-lambda [lambda]           Smoothing parameter. [Default: 0.02]"<<endl;
   cerr << "\t-lastIter [lambda]         Smoothing parameter for last iteration. [Default: 0.01]"<<endl;
+  cerr << "\t-lambda_t [lambda_t]       Temporal smoothing across cardiac phases relative to lambda. [Default: 0]"<<endl;
   cerr << "\t-multires [levels]         Multiresolution smooting with given number of levels. [Default: 3]"<<endl;
+  cerr << "\t-resolution_levels [n]     Reconstruct early iterations on up to n-1 times halved resolution. [Default: 1]"<<endl;
   cerr << "\t-smooth_mask [sigma]       Smooth the mask to reduce artefacts of manual segmentation. [Default: 4mm]"<<endl;
   cerr << "\t-force_exclude [n] [ind1]..[indN]  Force exclusion of image-frames with these indices."<<endl;
   cerr << "\t-force_exclude_sliceloc [n] [ind1]..[indN]  Force exclusion of slice-locations with these indices."<<endl;
@@ -65,6 +68,12 @@ void usage()
   cerr << "\t-slice_weight [K] [p_1]..[p_K]   Use specified slice weights (image frame posterior probabilities)." << endl;
   cerr << "\t-no_robust_statistics      Switch off robust statistics."<<endl;
   cerr << "\t-exclude_slices_only       Do not exclude individual voxels."<<endl;
+  cerr << "\t-gather_superresolution    Use voxel-major coefficients for super-resolution, avoiding per-thread 4D buffers."<<endl;
+  cerr << "\t-interleaved_4d            Store phases of a voxel adjacently in slice simulation and gather super-resolution."<<endl;
+  cerr << "\t-deterministic             Reproducible Gaussian reconstruction and super-resolution independent of thread scheduling, implies -gather_superresolution."<<endl;
+  cerr << "\t-checkpoint [file]         Write a checkpoint to file after each iteration."<<endl;
+  cerr << "\t-resume                    Resume from the checkpoint file given by -checkpoint, if it exists."<<endl;
+  cerr << "\t-coeff_tolerance [mm]      Reuse coefficients of slices displaced by less than this since they were computed. [Default: 0mm]"<<endl;
   cerr << "\t-ref_vol                   Reference volume for adjustment of spatial position of reconstructed volume."<<endl;
   cerr << "\t-rreg_recon_to_ref         Register reconstructed volume to reference volume [Default: recon to ref]"<<endl;
   cerr << "\t-ref_transformations [folder]  Reference slice-to-volume transformation folder."<<endl;
@@ -72,6 +81,8 @@ void usage()
   cerr << "\t-info [filename]           Filename for slice information in tab-sparated columns."<<endl;
   cerr << "\t-debug                     Debug mode - save intermediate results."<<endl;
   cerr << "\t-no_log                    Do not redirect cout and cerr to log files."<<endl;
+  cerr << "\t-profile [file]            Write timing and counters of the reconstruction stages as JSON, or CSV for .csv files."<<endl;
+  cerr << "\t-per_slice_svr             Register slices one by one instead of in batches."<<endl;
   // cerr << "\t-global_bias_correction   Correct the bias in reconstructed image against previous estimation."<<endl;
   // cerr << "\t-low_intensity_cutoff     Lower intensity threshold for inclusion of voxels in global bias correction."<<endl;
   // cerr << "\t-remove_black_background  Create mask from black background."<<endl;
@@ -95,6 +106,16 @@ void usage()
   exit(1);
 }
 
+//Coarse-to-fine schedule: resolution is halved for each level above
+//the finest, the last iteration is always at full resolution
+double LevelResolution(double resolution, int iter, int iterations, int resolution_levels)
+{
+  int level = resolution_levels - 1 - iter * resolution_levels / iterations;
+  if ((level < 0) || (iter >= iterations - 1))
+    level = 0;
+  return resolution * pow(2.0, level);
+}
+
 int main(int argc, char **argv)
 {
   //utility variables
@@ -147,17 +168,23 @@ int main(int argc, char **argv)
   irtkRealImage *mask=NULL;
   int iterations = 4;
   bool debug = false;
+  //file for timing and counters of the reconstruction stages
+  char *profile_file = NULL;
+  bool per_slice_svr = false;
   double sigma=20;
   double motion_sigma = 0;
   double resolution = 0.75;
+  int resolution_levels = 1;
   int numCardPhase = 15;
   double rrDefault = 1;
   double rrInterval = rrDefault;
   bool is_temporalpsf_gauss = false;
+  double temporal_weight_cutoff = 0;
   double lambda = 0.02;
   double delta = 150;
   int levels = 3;
   double lastIterLambda = 0.01;
+  double temporalLambda = 0;
   int rec_iterations;
   int rec_iterations_first = 10;
   int rec_iterations_last = -1;
@@ -183,6 +210,17 @@ int main(int argc, char **argv)
   //flag to swich the robust statistics on and off
   bool robust_statistics = true;
   bool robust_slices_only = false;
+  //flag to use voxel-major coefficients for super-resolution
+  bool gather_superresolution = false;
+  //flag to use frame-interleaved 4D volumes
+  bool interleaved_4d = false;
+  //flag for reproducible accumulation
+  bool deterministic = false;
+  //checkpoint written after each iteration and whether to resume from it
+  char *checkpoint_file = NULL;
+  bool resume = false;
+  //displacement below which slice-to-volume coefficients are reused
+  double coeff_tolerance = 0;
   //flag to replace super-resolution reconstruction by multilevel B-spline interpolation
   bool bspline = false;
   vector<int> multiband_vector;
@@ -440,6 +478,16 @@ int main(int argc, char **argv)
     is_temporalpsf_gauss=true;
     ok = true;
   }
+  
+  // Cutoff for Sparse Temporal Weights
+  if ((ok == false) && (strcmp(argv[1], "-temporal_weight_cutoff") == 0)){
+    argc--;
+    argv++;
+    temporal_weight_cutoff=atof(argv[1]);
+    argc--;
+    argv++;
+    ok = true;
+  }
 
 
     //Read binary mask for final volume
@@ -522,6 +570,16 @@ int main(int argc, char **argv)
       argv++;
     }
     
+    //Temporal smoothing parameter relative to lambda
+    if ((ok == false) && (strcmp(argv[1], "-lambda_t") == 0)){
+      argc--;
+      argv++;
+      temporalLambda=atof(argv[1]);
+      ok = true;
+      argc--;
+      argv++;
+    }
+    
     //Parameter to define what is an edge
     if ((ok == false) && (strcmp(argv[1], "-delta") == 0)){
       argc--;
@@ -552,6 +610,16 @@ int main(int argc, char **argv)
       ok = true;
     }
 
+    //Number of levels of the coarse-to-fine reconstruction schedule
+    if ((ok == false) && (strcmp(argv[1], "-resolution_levels") == 0)){
+      argc--;
+      argv++;
+      resolution_levels=atoi(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+
     //Smooth mask to remove effects of manual segmentation
     if ((ok == false) && (strcmp(argv[1], "-smooth_mask") == 0)){
       argc--;
@@ -613,6 +681,58 @@ int main(int argc, char **argv)
       ok = true;
     }
     
+    //Use voxel-major coefficients for super-resolution
+    if ((ok == false) && (strcmp(argv[1], "-gather_superresolution") == 0)){
+      argc--;
+      argv++;
+      gather_superresolution=true;
+      ok = true;
+    }
+    
+    //Use frame-interleaved 4D volumes
+    if ((ok == false) && (strcmp(argv[1], "-interleaved_4d") == 0)){
+      argc--;
+      argv++;
+      interleaved_4d=true;
+      ok = true;
+    }
+    
+    //Reproducible accumulation
+    if ((ok == false) && (strcmp(argv[1], "-deterministic") == 0)){
+      argc--;
+      argv++;
+      deterministic=true;
+      ok = true;
+    }
+    
+    //Write checkpoints
+    if ((ok == false) && (strcmp(argv[1], "-checkpoint") == 0)){
+      argc--;
+      argv++;
+      checkpoint_file=argv[1];
+      argc--;
+      argv++;
+      ok = true;
+    }
+    
+    //Resume from checkpoint
+    if ((ok == false) && (strcmp(argv[1], "-resume") == 0)){
+      argc--;
+      argv++;
+      resume=true;
+      ok = true;
+    }
+    
+    //Displacement tolerance for reusing coefficients
+    if ((ok == false) && (strcmp(argv[1], "-coeff_tolerance") == 0)){
+      argc--;
+      argv++;
+      coeff_tolerance=atof(argv[1]);
+      argc--;
+      argv++;
+      ok = true;
+    }
+    
     //Use multilevel B-spline interpolation instead of super-resolution
     // if ((ok == false) && (strcmp(argv[1], "-bspline") == 0)){
     //   argc--;
@@ -656,6 +776,24 @@ int main(int argc, char **argv)
       argv++;
     }
 
+    //Timing and counters of the reconstruction stages
+    if ((ok == false) && (strcmp(argv[1], "-profile") == 0)){
+      argc--;
+      argv++;
+      profile_file=argv[1];
+      ok = true;
+      argc--;
+      argv++;
+    }
+
+    //Slice-to-volume registration of one slice at a time
+    if ((ok == false) && (strcmp(argv[1], "-per_slice_svr") == 0)){
+      argc--;
+      argv++;
+      per_slice_svr=true;
+      ok = true;
+    }
+
     //No log files
     if ((ok == false) && (strcmp(argv[1], "-no_log") == 0)){
       argc--;
@@ -879,6 +1017,7 @@ int main(int argc, char **argv)
     reconstruction.SetTemporalWeightGaussian();
   else
     reconstruction.SetTemporalWeightSinc();
+  reconstruction.SetTemporalWeightCutoff(temporal_weight_cutoff);
 
   //Output volume
   irtkRealImage reconstructed;
@@ -905,6 +1044,32 @@ int main(int argc, char **argv)
   //Set debug mode
   if (debug) reconstruction.DebugOn();
   else reconstruction.DebugOff();
+
+  //Record timing and counters of the reconstruction stages
+  if (profile_file != NULL)
+    reconstruction.ProfileOn();
+
+  //Register slices in batches unless requested otherwise
+  if (per_slice_svr)
+    reconstruction.BatchSliceToVolumeRegistrationOff();
+  
+  //Use voxel-major coefficients for super-resolution
+  if (gather_superresolution)
+    reconstruction.VolumeCoeffsOn();
+  
+  //Use frame-interleaved 4D volumes
+  if (interleaved_4d)
+    reconstruction.InterleavedOn();
+  
+  //Reproducible accumulation
+  if (deterministic)
+    reconstruction.DeterministicOn();
+  
+  //Reuse coefficients of slices which have not moved
+  reconstruction.SetCoeffUpdateTolerance(coeff_tolerance);
+  
+  //Temporal regularization across cardiac phases
+  reconstruction.SetTemporalSmoothingParameter(temporalLambda);
   
   //Set force excluded slices
   reconstruction.SetForceExcludedSlices(force_excluded);
@@ -1123,11 +1288,60 @@ int main(int argc, char **argv)
   // Calculate Temporal Weight for Each Slice
   reconstruction.CalculateSliceTemporalWeights();  
     
+  //Mask at full resolution and resolution of the current template
+  irtkRealImage fullMask = reconstruction.GetMask();
+  double current_resolution = resolution;
+
+  //Resume from checkpoint
+  int first_iter = 0;
+  if (resume)
+  {
+    if (checkpoint_file == NULL)
+    {
+      cerr<<"-resume requires -checkpoint [file]."<<endl;
+      exit(1);
+    }
+    
+    //the checkpoint holds the volume at the resolution of its iteration
+    int checkpoint_iter = reconstruction.ReadCheckpointIteration(checkpoint_file);
+    if (checkpoint_iter >= 0)
+    {
+      double checkpoint_resolution = LevelResolution(resolution, checkpoint_iter, iterations, resolution_levels);
+      if (checkpoint_resolution != current_resolution)
+      {
+        reconstruction.CreateTemplateCardiac4DFromStaticMask( maskCropped, checkpoint_resolution );
+        reconstruction.SetMask( &fullMask, 0 );
+        current_resolution = checkpoint_resolution;
+      }
+    }
+    first_iter = reconstruction.ReadCheckpoint(checkpoint_file) + 1;
+    
+    //smoothing parameters of skipped iterations
+    for (int iter=0;iter<first_iter;iter++)
+    {
+      double l=lambda;
+      for (i=0;i<levels;i++)
+      {
+        if (iter==iterations*(levels-i-1)/levels)
+          reconstruction.SetSmoothingParameters(delta, l);
+        l*=2;
+      }
+    }
+    
+    //simulated slices are needed for the final output if no iteration is left
+    if (first_iter>=iterations)
+    {
+      reconstruction.SpeedupOff();
+      reconstruction.CoeffInitCardiac4D();
+      reconstruction.SimulateSlicesCardiac4D();
+    }
+  }
+
   //interleaved registration-reconstruction iterations
   if(debug)
       cout<<"Number of iterations is :"<<iterations<<endl;
 
-  for (int iter=0;iter<iterations;iter++)
+  for (int iter=first_iter;iter<iterations;iter++)
   {
     //Print iteration number on the screen
     if ( ! no_log ) {
@@ -1168,6 +1382,18 @@ int main(int argc, char **argv)
       cout.rdbuf (file2.rdbuf());
     }
 	  cout<<endl<<endl<<"Iteration "<<iter<<": "<<endl<<endl;
+
+    //Coarse-to-fine schedule. The registration above used the volume of
+    //the previous level and the coefficients are rebuilt for the new
+    //template by CoeffInitCardiac4D.
+    double level_resolution = LevelResolution(resolution, iter, iterations, resolution_levels);
+    if (level_resolution != current_resolution)
+    {
+      cout<<"Reconstructing with isotropic voxel size "<<level_resolution<<"mm"<<endl;
+      reconstruction.CreateTemplateCardiac4DFromStaticMask( maskCropped, level_resolution );
+      reconstruction.SetMask( &fullMask, 0 );
+      current_resolution = level_resolution;
+    }
 	
 	  //Set smoothing parameters
 	  //amount of smoothing (given by lambda) is decreased with improving alignment
@@ -1195,7 +1421,9 @@ int main(int argc, char **argv)
     if(robust_slices_only)
 		  reconstruction.ExcludeWholeSlicesOnly();
   	
-	  //Initialise values of weights, scales and bias fields
+	  //Initialise values of weights, scales and bias fields. This is also
+	  //done in the first iteration after -resume, the EM state restored
+	  //from the checkpoint only serves the outputs when no iteration is left
 	  reconstruction.InitializeEMValues();
     
     //Set slice weights, if specified
@@ -1311,8 +1539,9 @@ int main(int argc, char **argv)
       e.push_back(reconstruction.CalculateEntropy());
       
       // Simulate slices (needs to be done
-      // after the update of the reconstructed volume)
-      reconstruction.SimulateSlicesCardiac4D();
+      // after the update of the reconstructed volume),
+      // followed by M-step and E-step
+      reconstruction.SimulateSlicesRobustStatisticsCardiac4D(i+1,robust_statistics&&((i+1)<rec_iterations));
 
       if ((i+1)<rec_iterations)
       { 
@@ -1326,16 +1555,8 @@ int main(int argc, char **argv)
                     reconstruction.SaveBiasFields(stacks,iter,i+1);
               }
               reconstruction.SaveSimulatedSlices(stacks,iter,i+1);
-              reconstruction.CalculateError();
               reconstruction.SaveError(stacks,iter,i+1);
           }
-          
-          if(robust_statistics)
-            reconstruction.MStep(i+1);
-          
-          //E-step
-          if(robust_statistics)
-            reconstruction.EStep();
 
           //Save intermediate weights
           if(debug)
@@ -1422,10 +1643,10 @@ int main(int argc, char **argv)
 
     // Display Displacements and TRE
     if (debug) {
-      cout<<"Mean Displacement (iter "<<iter<<") = "<<mean_displacement[iter]<<" mm."<<endl;
-      cout<<"Mean Weighted Displacement (iter "<<iter<<") = "<<mean_weighted_displacement[iter]<<" mm."<<endl;
+      cout<<"Mean Displacement (iter "<<iter<<") = "<<mean_displacement.back()<<" mm."<<endl;
+      cout<<"Mean Weighted Displacement (iter "<<iter<<") = "<<mean_weighted_displacement.back()<<" mm."<<endl;
       if(have_ref_transformations)
-        cout<<"Mean TRE (iter "<<iter<<") = "<<mean_tre[iter]<<" mm."<<endl;
+        cout<<"Mean TRE (iter "<<iter<<") = "<<mean_tre.back()<<" mm."<<endl;
     }
     
     // Save Info for Iteration
@@ -1436,6 +1657,10 @@ int main(int argc, char **argv)
       reconstruction.SlicesInfoCardiac4D( buffer, stack_files );
     }
 
+    //Save state to resume from after this iteration
+    if (checkpoint_file != NULL)
+      reconstruction.WriteCheckpoint(checkpoint_file, iter);
+
   }// end of interleaved registration-reconstruction iterations
   
   //Display Entropy Values
@@ -1518,5 +1743,9 @@ int main(int argc, char **argv)
       reconstruction.SaveSimulatedSlices(stacks);
       cout<<"ReconstructionCardiac complete."<<endl;
   }  
+
+  //Write timing and counters of the reconstruction stages
+  if (profile_file != NULL)
+    reconstruction.WriteProfile(profile_file);
   //The end of main()
 }  
\ No newline at end of file
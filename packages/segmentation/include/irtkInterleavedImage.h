@@ -0,0 +1,158 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+  Visual Information Processing (VIP), 2011 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+  =========================================================================*/
+
+#ifndef _irtkInterleavedImage_H
+
+#define _irtkInterleavedImage_H
+
+#include <irtkImage.h>
+
+#include <vector>
+
+using namespace std;
+
+/*
+
+  4D image with frame-interleaved ("t-fastest") voxel storage.
+
+  Voxel (x,y,z,t) is stored at t + T * (x + X * (y + Y * z)), so all frames
+  of a voxel are adjacent in memory, whereas irtkGenericImage stores each
+  frame as a separate volume. Accessors follow irtkGenericImage and the
+  image can be converted to and from an irtkRealImage with the same
+  attributes.
+
+*/
+
+class irtkInterleavedImage
+{
+
+protected:
+
+  /// Image attributes
+  irtkImageAttributes _attr;
+
+  /// Voxel values
+  vector<irtkRealPixel> _data;
+
+public:
+
+  /// Constructor
+  irtkInterleavedImage();
+
+  /// Constructor for empty image with given attributes
+  irtkInterleavedImage(const irtkImageAttributes &);
+
+  /// Constructor converting from image with frames stored one after another
+  irtkInterleavedImage(const irtkRealImage &);
+
+  /// Initialize image with given attributes, all voxels are set to zero
+  void Initialize(const irtkImageAttributes &);
+
+  /// Convert from image with frames stored one after another
+  void Import(const irtkRealImage &);
+
+  /// Convert to image with frames stored one after another
+  void Export(irtkRealImage &) const;
+
+  /// Image attributes
+  inline const irtkImageAttributes &GetImageAttributes() const;
+
+  /// Image dimensions
+  inline int GetX() const;
+  inline int GetY() const;
+  inline int GetZ() const;
+  inline int GetT() const;
+
+  /// Number of voxels including all frames
+  inline int GetNumberOfVoxels() const;
+
+  /// Function for pixel access via pointers
+  inline irtkRealPixel *GetPointerToVoxels(int = 0, int = 0, int = 0, int = 0);
+  inline const irtkRealPixel *GetPointerToVoxels(int = 0, int = 0, int = 0, int = 0) const;
+
+  /// Function to convert pixel to index
+  inline int VoxelToIndex(int, int, int, int = 0) const;
+
+  /// Function for pixel get access
+  inline irtkRealPixel Get(int, int, int, int = 0) const;
+
+  /// Function for pixel put access
+  inline void Put(int, int, int, int, irtkRealPixel);
+
+  /// Function for pixel access from via operators
+  inline irtkRealPixel& operator()(int, int, int, int = 0);
+
+  /// Set all pixels to a constant value
+  irtkInterleavedImage& operator= (irtkRealPixel);
+};
+
+inline const irtkImageAttributes &irtkInterleavedImage::GetImageAttributes() const
+{
+  return _attr;
+}
+
+inline int irtkInterleavedImage::GetX() const
+{
+  return _attr._x;
+}
+
+inline int irtkInterleavedImage::GetY() const
+{
+  return _attr._y;
+}
+
+inline int irtkInterleavedImage::GetZ() const
+{
+  return _attr._z;
+}
+
+inline int irtkInterleavedImage::GetT() const
+{
+  return _attr._t;
+}
+
+inline int irtkInterleavedImage::GetNumberOfVoxels() const
+{
+  return _data.size();
+}
+
+inline int irtkInterleavedImage::VoxelToIndex(int x, int y, int z, int t) const
+{
+  return t + _attr._t * (x + _attr._x * (y + _attr._y * z));
+}
+
+inline irtkRealPixel *irtkInterleavedImage::GetPointerToVoxels(int x, int y, int z, int t)
+{
+  return &_data[VoxelToIndex(x, y, z, t)];
+}
+
+inline const irtkRealPixel *irtkInterleavedImage::GetPointerToVoxels(int x, int y, int z, int t) const
+{
+  return &_data[VoxelToIndex(x, y, z, t)];
+}
+
+inline irtkRealPixel irtkInterleavedImage::Get(int x, int y, int z, int t) const
+{
+  return _data[VoxelToIndex(x, y, z, t)];
+}
+
+inline void irtkInterleavedImage::Put(int x, int y, int z, int t, irtkRealPixel val)
+{
+  _data[VoxelToIndex(x, y, z, t)] = val;
+}
+
+inline irtkRealPixel& irtkInterleavedImage::operator()(int x, int y, int z, int t)
+{
+  return _data[VoxelToIndex(x, y, z, t)];
+}
+
+#endif
@@ -18,6 +18,7 @@
 #include <irtkTransformation.h>
 #include <irtkGaussianBlurring.h>
 #include <irtkBSplineReconstruction.h>
+#include <irtkReconstructionProfile.h>
 
 
 #include <vector>
@@ -171,6 +172,12 @@ class irtkReconstruction : public irtkObject
     //utility
     ///Debug mode
     bool _debug;
+
+    //run-time timing and counters of the reconstruction stages
+    irtkReconstructionProfile _profile;
+
+    //register slices in batches with irtkMultiSliceRigidRegistration (default:true)
+    bool _batch_svr;
     
     //do not exclude voxels, only whole slices
     bool _robust_slices_only;
@@ -307,7 +314,7 @@ class irtkReconstruction : public irtkObject
     void MaskStacks(vector<irtkRealImage>& stacks,vector<irtkRigidTransformation>& stack_transformations);
  
     ///Mask all slices
-    void MaskSlices();
+    virtual void MaskSlices();
  
     ///Set reconstructed image
     void SetTemplate(irtkRealImage tempImage);
@@ -329,30 +336,41 @@ class irtkReconstruction : public irtkObject
 
   
     ///Initialise variables and parameters for EM
-    void InitializeEM();
+    virtual void InitializeEM();
   
     ///Initialise values of variables and parameters for EM
-    void InitializeEMValues();
+    virtual void InitializeEMValues();
   
     ///Initalize robust statistics
     void InitializeRobustStatistics();
   
     ///Perform E-step 
-    void EStep();
+    virtual void EStep();
+
+    ///Update slice-wise robust statistics and slice weights from the slice potentials of the E-step
+    void EStepParameters(vector<double> &slice_potential);
   
     ///Calculate slice-dependent scale
-    void Scale();
+    virtual void Scale();
     void ExcludeSlicesScale();
     
     ///Calculate slice-dependent bias fields
-    void Bias();
+    virtual void Bias();
     void NormaliseBias(int iter);
   
     ///Superresolution
     void Superresolution(int iter);
   
     ///Calculation of voxel-vise robust statistics
-    void MStep(int iter);
+    virtual void MStep(int iter);
+
+    ///Update voxel-wise robust statistics parameters from per-slice sums of the M-step
+    void MStepParameters(int iter,
+                         const vector<double> &slice_sigma,
+                         const vector<double> &slice_mix,
+                         const vector<double> &slice_num,
+                         const vector<double> &slice_min,
+                         const vector<double> &slice_max);
   
     ///Edge-preserving regularization
     void Regularization(int iter);
@@ -443,6 +461,19 @@ class irtkReconstruction : public irtkObject
     ///Do not save intermediate results
     inline void DebugOff();
 
+    ///Record timing and counters of the reconstruction stages
+    inline void ProfileOn();
+
+    ///Register slices to the volume in batches (default) or one by one
+    inline void BatchSliceToVolumeRegistrationOn();
+    inline void BatchSliceToVolumeRegistrationOff();
+
+    ///Write the recorded stages as JSON, or CSV if filename ends with .csv
+    void WriteProfile(const char *filename);
+
+    ///Number of slice-volume coefficients visited by a sweep over all slices
+    virtual double GetNumberOfCoefficients();
+
     inline void UseAdaptiveRegularisation();
     
     inline void ExcludeWholeSlicesOnly();
@@ -456,7 +487,7 @@ class irtkReconstruction : public irtkObject
   
     //To recover original scaling
     ///Restore slice intensities to their original values
-    void RestoreSliceIntensities();
+    virtual void RestoreSliceIntensities();
     ///Scale volume to match the slice intensities
     void ScaleVolume();
   
@@ -582,6 +613,21 @@ inline void irtkReconstruction::PutMask(irtkRealImage mask)
 }
 
 
+inline void irtkReconstruction::ProfileOn()
+{
+    _profile.On();
+}
+
+inline void irtkReconstruction::BatchSliceToVolumeRegistrationOn()
+{
+    _batch_svr = true;
+}
+
+inline void irtkReconstruction::BatchSliceToVolumeRegistrationOff()
+{
+    _batch_svr = false;
+}
+
 inline void irtkReconstruction::DebugOn()
 {
     _debug=true;
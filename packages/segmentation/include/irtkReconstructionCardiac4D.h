@@ -15,11 +15,54 @@
 #define _irtkReconstructionCardiac4D_H
 
 #include <irtkReconstruction.h>
+#include <irtkSliceCoeffs.h>
+#include <irtkInterleavedImage.h>
+#include <irtkSlicePool.h>
 
 #include <vector>
+#include <map>
 
 using namespace std;
 
+/*
+
+  Key of a discretized PSF: slice voxel size, PSF type, quality factor and
+  resolution of the reconstructed volume
+
+*/
+
+struct PSFKEY
+{
+    double dx;
+    double dy;
+    double dz;
+    RECON_TYPE recon_type;
+    double quality_factor;
+    double resolution;
+
+    bool operator<(const PSFKEY &key) const
+    {
+        if (dx != key.dx) return dx < key.dx;
+        if (dy != key.dy) return dy < key.dy;
+        if (dz != key.dz) return dz < key.dz;
+        if (recon_type != key.recon_type) return recon_type < key.recon_type;
+        if (quality_factor != key.quality_factor) return quality_factor < key.quality_factor;
+        return resolution < key.resolution;
+    }
+};
+
+/*
+
+  Non-zero temporal weight of a slice for a reconstructed cardiac phase
+
+*/
+
+struct TEMPORALWEIGHT
+{
+    int phase;
+    double weight;
+};
+
 /*
 
   Reconstruction of 4D cardiac cine volume from 2D slices
@@ -36,9 +79,57 @@ protected:
   vector<int> _stack_loc_index;  // index of 2D slice location in M2D stack
   vector<int> _stack_dyn_index;  // index of dynamic in M2D stack
   
-  // Images
-  vector<irtkRealImage> _error;
-  vector<irtkRealImage> _corrected_slices;
+  // Images derived from the slices for output only, single precision is
+  // sufficient and halves their memory
+  vector<irtkGenericImage<float> > _error;
+  vector<irtkGenericImage<float> > _corrected_slices;
+
+  // Slices, bias fields, voxel weights and simulated slices packed into
+  // contiguous single precision pools for the EM kernels, which accumulate
+  // in double. The image vectors of irtkReconstruction remain the reference:
+  // kernels writing a pool also write the vectors, any other write to the
+  // vectors calls InvalidateSlicePools, and kernels reading the pools call
+  // UpdateSlicePools first
+  irtkSlicePool<float> _slice_pool;
+  irtkSlicePool<float> _bias_pool;
+  irtkSlicePool<float> _weight_pool;
+  irtkSlicePool<float> _simulated_slice_pool;
+  irtkSlicePool<float> _simulated_weight_pool;
+  bool _slice_pools_valid;
+
+  // Reload the slice pools from the image vectors if they are not valid
+  void UpdateSlicePools();
+
+  // Mark the slice pools as out of date after the image vectors were written
+  void InvalidateSlicePools();
+
+  // Slice-to-volume PSF coefficients in compressed sparse row format,
+  // used by the 4D kernels instead of irtkReconstruction::_volcoeffs
+  vector<irtkSliceCoeffs> _slice_coeffs;
+
+  // Voxel-major transpose of _slice_coeffs for gather-based superresolution
+  irtkVolumeCoeffs _volume_coeffs;
+  bool _use_volume_coeffs;
+
+  // State used to build _slice_coeffs, the slice transformations are kept in
+  // irtkReconstruction::_previous_transformations
+  irtkImageAttributes _coeff_attributes;
+  irtkRealImage _coeff_mask;
+  double _coeff_quality_factor;
+  RECON_TYPE _coeff_recon_type;
+  vector<bool> _coeff_excluded;
+
+  // Slices whose coefficients are recomputed by ParallelCoeffInitCardiac4D
+  vector<bool> _coeff_update;
+
+  // Maximum displacement (mm) of a slice before its coefficients are recomputed
+  double _coeff_tolerance;
+
+  // Discretized PSFs shared by all slices with the same voxel size
+  map<PSFKEY, irtkRealImage> _psf_cache;
+
+  // Weight of the cyclic temporal regularization relative to the spatial one
+  double _temporal_lambda;
 
    // PI
    const double PI = 3.14159265358979323846;
@@ -46,6 +137,13 @@ protected:
    // Reconstructed 4D Cardiac Cine Image
    irtkRealImage _reconstructed4D;  // TODO: replace _reconstructed4D with _reconstructed and fix conflicts between irtkReconstruction and irtkReconstructionCardiac4D use of _reconstruction and_reconstruction4D
     
+   // Frame-interleaved copy of _reconstructed4D used by the 4D kernels
+   irtkInterleavedImage _reconstructed4D_interleaved;
+   bool _use_interleaved;
+   
+   // Gather over voxel-major coefficients so that results do not depend on threading
+   bool _deterministic;
+    
    // Reconstructed Cardiac Phases
    vector<double> _reconstructed_cardiac_phases;
  
@@ -71,6 +169,12 @@ protected:
    // access as: _slice_temporal_weight[iReconstructedCardiacPhase][iSlice]
    vector< vector<double> > _slice_temporal_weight; 
    
+   // Sparse Slice Temporal Weight
+   // phases with |weight| > _temporal_weight_cutoff, used by the 4D kernels
+   // access as: _slice_temporal_weight_list[iSlice][k]
+   vector< vector<TEMPORALWEIGHT> > _slice_temporal_weight_list;
+   double _temporal_weight_cutoff;
+   
    // Slice SVR Target Cardiac Phase
    vector<int> _slice_svr_card_index;
    
@@ -97,6 +201,17 @@ protected:
    // Initialise Slice Temporal Weights
    void InitSliceTemporalWeights();
    
+   // Maximum displacement of slice corners between coefficient and current transformation
+   double CalculateCoeffDisplacement( int inputIndex );
+
+   // Get discretized PSF for slice voxel size, computed on first use;
+   // not thread-safe for voxel sizes which are not yet cached
+   irtkRealImage& GetPSF( double dx, double dy, double dz );
+
+   // Slice-to-volume coefficients of a slice for its current transformation,
+   // returns whether the slice overlaps the mask. The PSF must be cached
+   bool SliceCoeffsCardiac4D( int inputIndex, irtkSliceCoeffs& slicecoeffs );
+
    // Calculate Angular Difference
    double CalculateAngularDifference( double cardphase0, double cardphase );
 
@@ -198,6 +313,36 @@ protected:
    inline void SetTemporalWeightGaussian();
    inline void SetTemporalWeightSinc();
    
+   // Temporal weights with magnitude up to cutoff are treated as zero
+   inline void SetTemporalWeightCutoff( double cutoff );
+   
+   // Build voxel-major coefficients in CoeffInitCardiac4D and use them for a
+   // gather-based superresolution without per-thread 4D buffers
+   inline void VolumeCoeffsOn();
+   inline void VolumeCoeffsOff();
+   
+   // Use frame-interleaved copies of 4D volumes in slice simulation and
+   // gather-based superresolution so that all phases of a voxel are adjacent
+   inline void InterleavedOn();
+   inline void InterleavedOff();
+   
+   // Make Gaussian reconstruction and superresolution independent of thread
+   // scheduling. CoeffInitCardiac4D then builds the voxel-major coefficients,
+   // so that each output voxel is summed by one thread in a fixed order
+   inline void DeterministicOn();
+   inline void DeterministicOff();
+   
+   // Reuse coefficients of slices which moved less than tolerance (mm)
+   // since their coefficients were computed, negative values disable reuse
+   inline void SetCoeffUpdateTolerance( double tolerance );
+
+   // Recompute the coefficients of all slices in the next CoeffInitCardiac4D
+   inline void ResetCoeffs();
+
+   // Smooth across neighbouring cardiac phases, cyclically, with the given
+   // weight relative to lambda; zero switches temporal regularization off
+   inline void SetTemporalSmoothingParameter( double lambda );
+
    // Calculate Transformation Matrix Between Slices and Voxels
    void CoeffInitCardiac4D();
 
@@ -212,6 +357,29 @@ protected:
    
    // Simulate Slices
    void SimulateSlicesCardiac4D();
+
+   // Overrides of irtkReconstruction which write the image vectors, they
+   // invalidate the slice pools
+   virtual void MaskSlices();
+   virtual void InitializeEM();
+   virtual void InitializeEMValues();
+   virtual void Bias();
+   virtual void RestoreSliceIntensities();
+
+   // E-step, M-step and scales on the slice pools
+   virtual void EStep();
+   virtual void MStep(int iter);
+   virtual void Scale();
+
+   // Number of coefficients visited by a sweep over all slices and phases
+   virtual double GetNumberOfCoefficients();
+
+   /** Simulate slices, then M-step and E-step of the robust statistics.
+    *  The M-step sums are gathered in the same traversal of the slice
+    *  coefficients as the simulation, the error is only written for
+    *  debugging and _simulated_inside is not updated.
+    */
+   void SimulateSlicesRobustStatisticsCardiac4D(int iter, bool robust_statistics);
    
    // Simulate stacks
    void SimulateStacksCardiac4D(vector<bool> stack_excluded);
@@ -271,6 +439,19 @@ protected:
    ///Save transformations
    void SaveTransformations();
 
+   /// Write state after outer iteration iter to a binary checkpoint. Bias
+   /// fields, weights and scales are stored for the outputs of a finished
+   /// run, a resumed iteration starts the EM from InitializeEMValues as
+   /// every iteration of an uninterrupted run does
+   void WriteCheckpoint( const char* filename, int iter );
+
+   /// Iteration stored in a checkpoint without restoring it, -1 if there is none
+   int ReadCheckpointIteration( const char* filename );
+
+   /// Restore state from checkpoint, returns its iteration or -1 if there is none.
+   /// The template must have the resolution it had when the checkpoint was written
+   int ReadCheckpoint( const char* filename );
+
    // Save Bias Fields
    void SaveBiasFields();
    void SaveBiasFields(vector<irtkRealImage>& stacks);
@@ -281,6 +462,9 @@ protected:
    void SaveSimulatedSlices(vector<irtkRealImage>& stacks);
    void SaveSimulatedSlices(vector<irtkRealImage>& stacks, int iter, int rec_iter);
    void SaveSimulatedSlices(vector<irtkRealImage>& stacks, int stack_no);
+
+   // Copy simulated slices into stacks of the same geometry
+   void GetSimulatedStacks(vector<irtkRealImage>& stacks);
    
    // Save Simulated Weights
    void SaveSimulatedWeights();
@@ -311,15 +495,23 @@ protected:
 
    // Access to Parallel Processing Classes
    friend class ParallelCoeffInitCardiac4D;
+   friend class ParallelGaussianReconstructionCardiac4D;
+   friend class ParallelGaussianReconstructionPixelsCardiac4D;
+   friend class ParallelScaleVolumeCardiac4D;
    friend class ParallelSliceToVolumeRegistrationCardiac4D;
    friend class ParallelSimulateSlicesCardiac4D;
+   friend class ParallelSimulateSlicesRobustStatisticsCardiac4D;
    friend class ParallelSimulateStacksCardiac4D;
    friend class ParallelNormaliseBiasCardiac4D;
    friend class ParallelSuperresolutionCardiac4D;   
-   friend class ParallelAdaptiveRegularization1Cardiac4D;
-   friend class ParallelAdaptiveRegularization2Cardiac4D;
+   friend class ParallelSuperresolutionErrorCardiac4D;
+   friend class ParallelSuperresolutionGatherCardiac4D;
+   friend class ParallelAdaptiveRegularizationCardiac4D;
    friend class ParallelCalculateError;
    friend class ParallelCalculateCorrectedSlices;
+   friend class ParallelEStepCardiac4D;
+   friend class ParallelMStepCardiac4D;
+   friend class ParallelScaleCardiac4D;
    
 };  // end of irtReconstructionCardiac4D class definition
 
@@ -339,6 +531,73 @@ inline void irtkReconstructionCardiac4D::SetTemporalWeightSinc()
     cout << "Temporal PSF = sinc() * Tukey_window()" << endl;
 }
 
+inline void irtkReconstructionCardiac4D::SetTemporalWeightCutoff(double cutoff)
+{
+    _temporal_weight_cutoff = cutoff;
+}
+
+// -----------------------------------------------------------------------------
+// Voxel-Major Coefficients
+// -----------------------------------------------------------------------------
+inline void irtkReconstructionCardiac4D::VolumeCoeffsOn()
+{
+    _use_volume_coeffs = true;
+}
+
+inline void irtkReconstructionCardiac4D::VolumeCoeffsOff()
+{
+    _use_volume_coeffs = false;
+    _volume_coeffs.Clear();
+}
+
+// -----------------------------------------------------------------------------
+// Frame-Interleaved 4D Volumes
+// -----------------------------------------------------------------------------
+inline void irtkReconstructionCardiac4D::InterleavedOn()
+{
+    _use_interleaved = true;
+}
+
+inline void irtkReconstructionCardiac4D::InterleavedOff()
+{
+    _use_interleaved = false;
+    _reconstructed4D_interleaved = irtkInterleavedImage();
+}
+
+// -----------------------------------------------------------------------------
+// Deterministic Accumulation
+// -----------------------------------------------------------------------------
+inline void irtkReconstructionCardiac4D::DeterministicOn()
+{
+    _deterministic = true;
+}
+
+inline void irtkReconstructionCardiac4D::DeterministicOff()
+{
+    _deterministic = false;
+}
+
+// -----------------------------------------------------------------------------
+// Incremental Coefficient Update
+// -----------------------------------------------------------------------------
+inline void irtkReconstructionCardiac4D::SetCoeffUpdateTolerance(double tolerance)
+{
+    _coeff_tolerance = tolerance;
+}
+
+inline void irtkReconstructionCardiac4D::ResetCoeffs()
+{
+    _previous_transformations.clear();
+}
+
+// -----------------------------------------------------------------------------
+// Temporal Regularization
+// -----------------------------------------------------------------------------
+inline void irtkReconstructionCardiac4D::SetTemporalSmoothingParameter(double lambda)
+{
+    _temporal_lambda = lambda;
+}
+
 // -----------------------------------------------------------------------------
 // Get/Set Reconstructed 4D Volume
 // -----------------------------------------------------------------------------
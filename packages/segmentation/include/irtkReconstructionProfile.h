@@ -0,0 +1,154 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+  Visual Information Processing (VIP), 2011 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+  =========================================================================*/
+
+#ifndef _irtkReconstructionProfile_H
+
+#define _irtkReconstructionProfile_H
+
+#include <irtkImage.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+
+  Run-time instrumentation of the stages of slice-to-volume reconstruction.
+
+  For each named stage the profile accumulates the number of calls, wall
+  clock and process CPU time, slices processed and slice-volume
+  coefficients visited, and records the peak resident set size of the
+  process seen at the end of the stage. Unlike IRTK_START_TIMING it is
+  switched on at run time and the report is written as JSON or CSV.
+  Stages may be nested, the time of a nested stage is then also included
+  in the enclosing one.
+
+*/
+
+struct irtkReconstructionStageStats
+{
+    int calls;
+    double wall;
+    double cpu;
+    double slices;
+    double coeffs;
+    long peak_rss;
+};
+
+class irtkReconstructionProfile
+{
+
+protected:
+
+  /// Whether stages are recorded
+  bool _on;
+
+  /// Names of the stages in order of their first call
+  vector<string> _stages;
+
+  /// Accumulated statistics per stage
+  map<string, irtkReconstructionStageStats> _stats;
+
+public:
+
+  /// Constructor
+  irtkReconstructionProfile();
+
+  /// Switch recording on and off
+  inline void On();
+  inline void Off();
+  inline bool IsOn() const;
+
+  /// Remove all recorded stages
+  void Clear();
+
+  /// Add one call of a stage
+  void Add(const string &stage, double wall, double cpu, double slices, double coeffs);
+
+  /// Write report as JSON or CSV
+  void WriteJSON(ostream &) const;
+  void WriteCSV(ostream &) const;
+
+  /// Write report to file, CSV if the name ends with .csv and JSON otherwise
+  void Write(const char *filename) const;
+
+  /// Wall clock and process CPU time in seconds
+  static double WallTime();
+  static double CPUTime();
+
+  /// Peak resident set size of the process in kB, 0 if unknown
+  static long PeakRSS();
+
+};
+
+/*
+
+  Records one call of a stage from construction to destruction, e.g.
+
+    irtkReconstructionStage stage(_profile, "EStep", _slices.size());
+
+  Nothing is measured if the profile is switched off.
+
+*/
+
+class irtkReconstructionStage
+{
+
+protected:
+
+  irtkReconstructionProfile *_profile;
+  const char *_name;
+  double _wall, _cpu;
+  double _slices, _coeffs;
+
+public:
+
+  /// Start stage
+  irtkReconstructionStage(irtkReconstructionProfile &, const char *name, double slices = 0);
+
+  /// End stage
+  ~irtkReconstructionStage();
+
+  /// Count processed slices and visited coefficients
+  inline void AddSlices(double);
+  inline void AddCoefficients(double);
+
+};
+
+inline void irtkReconstructionProfile::On()
+{
+    _on = true;
+}
+
+inline void irtkReconstructionProfile::Off()
+{
+    _on = false;
+}
+
+inline bool irtkReconstructionProfile::IsOn() const
+{
+    return _on;
+}
+
+inline void irtkReconstructionStage::AddSlices(double slices)
+{
+    _slices += slices;
+}
+
+inline void irtkReconstructionStage::AddCoefficients(double coeffs)
+{
+    _coeffs += coeffs;
+}
+
+#endif
@@ -0,0 +1,279 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+  Visual Information Processing (VIP), 2011 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+  =========================================================================*/
+
+#ifndef _irtkSliceCoeffs_H
+
+#define _irtkSliceCoeffs_H
+
+#include <vector>
+
+using namespace std;
+
+/*
+
+  Compressed sparse row (CSR) storage of the slice-to-volume PSF coefficients
+  of a single 2D slice.
+
+  Row r = i * GetY() + j holds the coefficients of slice pixel (i,j) in the
+  range [Begin(i,j), End(i,j)). Each coefficient is a linear voxel index into
+  a 3D volume, index = x + X * (y + Y * z), and a single precision weight.
+  Compared to SLICECOEFFS this avoids one heap vector per slice pixel and the
+  padded POINT3D, and the coefficients of a slice are traversed linearly.
+
+*/
+
+class irtkSliceCoeffs
+{
+
+protected:
+
+  /// Slice dimensions
+  int _x;
+  int _y;
+
+  /// Row offsets, size _x * _y + 1
+  vector<int> _offsets;
+
+  /// Linear volume voxel index of each coefficient
+  vector<int> _index;
+
+  /// PSF weight of each coefficient
+  vector<float> _value;
+
+public:
+
+  /// Constructor
+  irtkSliceCoeffs();
+
+  /// Start a new matrix for a slice of size x by y
+  void Initialize(int x, int y);
+
+  /// Release all memory
+  void Clear();
+
+  /// Append a coefficient to the current row
+  inline void Add(int index, double value);
+
+  /// Close the current row and start the next one
+  inline void NextRow();
+
+  /// Close all remaining rows and release unused capacity
+  void Finalize();
+
+  /// Slice dimensions
+  inline int GetX() const;
+  inline int GetY() const;
+
+  /// First and one past last coefficient of slice pixel (i,j)
+  inline int Begin(int i, int j) const;
+  inline int End(int i, int j) const;
+
+  /// Number of coefficients of slice pixel (i,j)
+  inline int GetNumberOfCoeffs(int i, int j) const;
+
+  /// Total number of coefficients
+  inline int GetNumberOfCoeffs() const;
+
+  /// Linear volume voxel index and weight of coefficient k
+  inline int Index(int k) const;
+  inline float Value(int k) const;
+
+  /// Memory used by the matrix in bytes
+  inline size_t GetMemorySize() const;
+};
+
+inline void irtkSliceCoeffs::Add(int index, double value)
+{
+  _index.push_back(index);
+  _value.push_back(static_cast<float>(value));
+}
+
+inline void irtkSliceCoeffs::NextRow()
+{
+  _offsets.push_back(_index.size());
+}
+
+inline int irtkSliceCoeffs::GetX() const
+{
+  return _x;
+}
+
+inline int irtkSliceCoeffs::GetY() const
+{
+  return _y;
+}
+
+inline int irtkSliceCoeffs::Begin(int i, int j) const
+{
+  return _offsets[i * _y + j];
+}
+
+inline int irtkSliceCoeffs::End(int i, int j) const
+{
+  return _offsets[i * _y + j + 1];
+}
+
+inline int irtkSliceCoeffs::GetNumberOfCoeffs(int i, int j) const
+{
+  return End(i, j) - Begin(i, j);
+}
+
+inline int irtkSliceCoeffs::GetNumberOfCoeffs() const
+{
+  return _index.size();
+}
+
+inline int irtkSliceCoeffs::Index(int k) const
+{
+  return _index[k];
+}
+
+inline float irtkSliceCoeffs::Value(int k) const
+{
+  return _value[k];
+}
+
+inline size_t irtkSliceCoeffs::GetMemorySize() const
+{
+  return _offsets.capacity() * sizeof(int) + _index.capacity() * sizeof(int)
+         + _value.capacity() * sizeof(float);
+}
+
+
+/*
+
+  Voxel-major transpose of the slice-to-volume PSF coefficients of all
+  slices.
+
+  Row v holds the coefficients of 3D volume voxel v in [Begin(v), End(v)).
+  Each coefficient refers to a slice pixel by its global pixel index, which
+  enumerates the pixels of all slices one after another in the voxel order
+  of irtkGenericImage, i.e. pixel (i,j) of slice s has global index
+  GetPixelOffset(s) + i + X * j, the same as in an irtkSlicePool. This allows
+  accumulating slice contributions into the volume as a gather over output
+  voxels without write conflicts between threads.
+
+*/
+
+class irtkVolumeCoeffs
+{
+
+protected:
+
+  /// Number of volume voxels
+  int _n;
+
+  /// Row offsets, size _n + 1
+  vector<int> _offsets;
+
+  /// Global slice pixel index of each coefficient
+  vector<int> _pixel;
+
+  /// PSF weight of each coefficient
+  vector<float> _value;
+
+  /// First global pixel index of each slice, size number of slices + 1
+  vector<int> _pixel_offsets;
+
+  /// Slice index of each global pixel
+  vector<int> _pixel_slice;
+
+public:
+
+  /// Constructor
+  irtkVolumeCoeffs();
+
+  /// Transpose the slice coefficients for a volume of n voxels
+  void Initialize(const vector<irtkSliceCoeffs> &coeffs, int n);
+
+  /// Release all memory
+  void Clear();
+
+  /// Whether the transpose has been computed
+  inline bool IsEmpty() const;
+
+  /// Number of volume voxels
+  inline int GetNumberOfVoxels() const;
+
+  /// Total number of slice pixels
+  inline int GetNumberOfPixels() const;
+
+  /// First and one past last coefficient of volume voxel v
+  inline int Begin(int v) const;
+  inline int End(int v) const;
+
+  /// Global slice pixel index and weight of coefficient k
+  inline int Pixel(int k) const;
+  inline float Value(int k) const;
+
+  /// Slice of a global slice pixel index
+  inline int GetSlice(int pixel) const;
+
+  /// Global pixel index of the first pixel of a slice
+  inline int GetPixelOffset(int slice) const;
+
+  /// Memory used by the matrix in bytes
+  inline size_t GetMemorySize() const;
+};
+
+inline bool irtkVolumeCoeffs::IsEmpty() const
+{
+  return _offsets.empty();
+}
+
+inline int irtkVolumeCoeffs::GetNumberOfVoxels() const
+{
+  return _n;
+}
+
+inline int irtkVolumeCoeffs::GetNumberOfPixels() const
+{
+  return _pixel_slice.size();
+}
+
+inline int irtkVolumeCoeffs::Begin(int v) const
+{
+  return _offsets[v];
+}
+
+inline int irtkVolumeCoeffs::End(int v) const
+{
+  return _offsets[v + 1];
+}
+
+inline int irtkVolumeCoeffs::Pixel(int k) const
+{
+  return _pixel[k];
+}
+
+inline float irtkVolumeCoeffs::Value(int k) const
+{
+  return _value[k];
+}
+
+inline int irtkVolumeCoeffs::GetSlice(int pixel) const
+{
+  return _pixel_slice[pixel];
+}
+
+inline int irtkVolumeCoeffs::GetPixelOffset(int slice) const
+{
+  return _pixel_offsets[slice];
+}
+
+inline size_t irtkVolumeCoeffs::GetMemorySize() const
+{
+  return (_offsets.capacity() + _pixel.capacity() + _pixel_offsets.capacity()
+          + _pixel_slice.capacity()) * sizeof(int) + _value.capacity() * sizeof(float);
+}
+
+#endif
@@ -0,0 +1,284 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+  Visual Information Processing (VIP), 2011 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+  =========================================================================*/
+
+#ifndef _irtkSlicePool_H
+
+#define _irtkSlicePool_H
+
+#include <irtkImage.h>
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#ifdef WIN32
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+/// Alignment of the storage of an irtkSlicePool in bytes, one cache line
+#define IRTK_SLICE_POOL_ALIGNMENT 64
+
+/*
+
+  Allocator returning storage aligned to IRTK_SLICE_POOL_ALIGNMENT bytes, so
+  that the pool starts on a cache line and vector loads of the first slice
+  are aligned.
+
+*/
+
+template <class T> class irtkAlignedAllocator
+{
+
+public:
+
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <class U> struct rebind { typedef irtkAlignedAllocator<U> other; };
+
+  irtkAlignedAllocator() { }
+  template <class U> irtkAlignedAllocator(const irtkAlignedAllocator<U> &) { }
+
+  pointer address(reference x) const { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+  size_type max_size() const { return size_t(-1) / sizeof(T); }
+
+  void construct(pointer p, const T &val) { new (p) T(val); }
+  void destroy(pointer p) { p->~T(); }
+
+  pointer allocate(size_type n, const void * = 0) {
+    void *p = NULL;
+    if (n == 0) return NULL;
+#ifdef WIN32
+    p = _aligned_malloc(n * sizeof(T), IRTK_SLICE_POOL_ALIGNMENT);
+#else
+    if (posix_memalign(&p, IRTK_SLICE_POOL_ALIGNMENT, n * sizeof(T)) != 0) p = NULL;
+#endif
+    if (p == NULL) throw bad_alloc();
+    return static_cast<pointer>(p);
+  }
+
+  void deallocate(pointer p, size_type) {
+#ifdef WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+  }
+};
+
+template <class T, class U>
+inline bool operator==(const irtkAlignedAllocator<T> &, const irtkAlignedAllocator<U> &) { return true; }
+
+template <class T, class U>
+inline bool operator!=(const irtkAlignedAllocator<T> &, const irtkAlignedAllocator<U> &) { return false; }
+
+/*
+
+  Non-owning view of one 2D slice stored in an irtkSlicePool.
+
+  Accessors follow irtkGenericImage, so per-slice code can be written in
+  the same way as for an irtkRealImage. Voxel (x,y) of the slice is stored
+  at GetPointerToVoxels()[x + GetX() * y] as in irtkGenericImage.
+
+*/
+
+template <class VoxelType> class irtkSliceView
+{
+
+protected:
+
+  /// Slice attributes
+  const irtkImageAttributes *_attr;
+
+  /// First voxel of the slice
+  VoxelType *_data;
+
+public:
+
+  /// Constructor
+  irtkSliceView(const irtkImageAttributes *attr, VoxelType *data) : _attr(attr), _data(data) { }
+
+  /// Image attributes
+  const irtkImageAttributes &GetImageAttributes() const { return *_attr; }
+
+  /// Image dimensions
+  int GetX() const { return _attr->_x; }
+  int GetY() const { return _attr->_y; }
+  int GetZ() const { return 1; }
+  int GetT() const { return 1; }
+
+  /// Number of voxels of the slice
+  int GetNumberOfVoxels() const { return _attr->_x * _attr->_y; }
+
+  /// Function for pixel access via pointers
+  VoxelType *GetPointerToVoxels(int x = 0, int y = 0, int = 0, int = 0) const { return _data + x + _attr->_x * y; }
+
+  /// Function to convert pixel to index
+  int VoxelToIndex(int x, int y, int = 0, int = 0) const { return x + _attr->_x * y; }
+
+  /// Function for pixel get access
+  VoxelType Get(int x, int y, int = 0, int = 0) const { return _data[x + _attr->_x * y]; }
+
+  /// Function for pixel put access
+  void Put(int x, int y, int, VoxelType val) { _data[x + _attr->_x * y] = val; }
+
+  /// Function for pixel access from via operators
+  VoxelType& operator()(int x, int y, int = 0, int = 0) { return _data[x + _attr->_x * y]; }
+};
+
+
+/*
+
+  Structure-of-arrays storage of one quantity for all 2D slices.
+
+  The voxels of all slices are packed one slice after another into a single
+  buffer. Slice s occupies [GetOffset(s), GetOffset(s + 1)) and keeps its
+  image attributes, so that whole-dataset passes can stream through one
+  array while per-slice code uses an irtkSliceView. The buffer starts on an
+  IRTK_SLICE_POOL_ALIGNMENT boundary. The pool can be filled from and copied
+  back to a vector of images, as a whole or slice by slice.
+
+*/
+
+template <class VoxelType> class irtkSlicePool
+{
+
+protected:
+
+  /// Slice attributes
+  vector<irtkImageAttributes> _attr;
+
+  /// First voxel of each slice, size number of slices + 1
+  vector<int> _offsets;
+
+  /// Voxel values of all slices
+  vector<VoxelType, irtkAlignedAllocator<VoxelType> > _data;
+
+public:
+
+  /// Constructor
+  irtkSlicePool() { _offsets.push_back(0); }
+
+  /// Allocate a pool with the geometry of the given slices, all voxels are set to zero
+  template <class TVoxel2> void Initialize(const vector<irtkGenericImage<TVoxel2> > &slices);
+
+  /// Copy slices into the pool
+  template <class TVoxel2> void Import(const vector<irtkGenericImage<TVoxel2> > &slices);
+
+  /// Copy the pool into slices, which are reallocated if their geometry differs
+  template <class TVoxel2> void Export(vector<irtkGenericImage<TVoxel2> > &slices) const;
+
+  /// Copy one slice with the geometry of slice s into the pool
+  template <class TVoxel2> void Import(int s, const irtkGenericImage<TVoxel2> &slice);
+
+  /// Copy slice s of the pool into an image, which is reallocated if its geometry differs
+  template <class TVoxel2> void Export(int s, irtkGenericImage<TVoxel2> &slice) const;
+
+  /// Number of slices
+  int GetNumberOfSlices() const { return _attr.size(); }
+
+  /// Number of voxels of all slices
+  int GetNumberOfVoxels() const { return _data.size(); }
+
+  /// Number of voxels of slice s
+  int GetNumberOfVoxels(int s) const { return _offsets[s + 1] - _offsets[s]; }
+
+  /// Index of the first voxel of a slice in the pool
+  int GetOffset(int s) const { return _offsets[s]; }
+
+  /// Image attributes of a slice
+  const irtkImageAttributes &GetImageAttributes(int s) const { return _attr[s]; }
+
+  /// Pointer to the first voxel of a slice
+  VoxelType *GetPointerToVoxels(int s = 0) { return _data.data() + _offsets[s]; }
+  const VoxelType *GetPointerToVoxels(int s = 0) const { return _data.data() + _offsets[s]; }
+
+  /// Voxel (x,y) of slice s
+  VoxelType& operator()(int s, int x, int y) { return _data[_offsets[s] + x + _attr[s]._x * y]; }
+
+  /// View of a slice
+  irtkSliceView<VoxelType> GetSlice(int s) { return irtkSliceView<VoxelType>(&_attr[s], _data.data() + _offsets[s]); }
+
+  /// Set all voxels to a constant value
+  irtkSlicePool& operator=(VoxelType val) { _data.assign(_data.size(), val); return *this; }
+};
+
+template <class VoxelType> template <class TVoxel2>
+void irtkSlicePool<VoxelType>::Initialize(const vector<irtkGenericImage<TVoxel2> > &slices)
+{
+  unsigned int s;
+
+  _attr.resize(slices.size());
+  _offsets.resize(slices.size() + 1);
+  _offsets[0] = 0;
+  for (s = 0; s < slices.size(); s++) {
+    _attr[s] = slices[s].GetImageAttributes();
+    _offsets[s + 1] = _offsets[s] + slices[s].GetNumberOfVoxels();
+  }
+  _data.assign(_offsets.back(), 0);
+}
+
+template <class VoxelType> template <class TVoxel2>
+void irtkSlicePool<VoxelType>::Import(const vector<irtkGenericImage<TVoxel2> > &slices)
+{
+  unsigned int s;
+
+  Initialize(slices);
+  for (s = 0; s < slices.size(); s++) Import(s, slices[s]);
+}
+
+template <class VoxelType> template <class TVoxel2>
+void irtkSlicePool<VoxelType>::Export(vector<irtkGenericImage<TVoxel2> > &slices) const
+{
+  unsigned int s;
+
+  slices.resize(_attr.size());
+  for (s = 0; s < _attr.size(); s++) Export(s, slices[s]);
+}
+
+template <class VoxelType> template <class TVoxel2>
+void irtkSlicePool<VoxelType>::Import(int s, const irtkGenericImage<TVoxel2> &slice)
+{
+  int i;
+
+  if (slice.GetNumberOfVoxels() != _offsets[s + 1] - _offsets[s]) {
+    cerr << "irtkSlicePool::Import: Slice " << s << " does not match the pool" << endl;
+    exit(1);
+  }
+  const TVoxel2 *ptr = slice.GetPointerToVoxels();
+  VoxelType *data = _data.data() + _offsets[s];
+  for (i = 0; i < _offsets[s + 1] - _offsets[s]; i++)
+    data[i] = static_cast<VoxelType>(ptr[i]);
+}
+
+template <class VoxelType> template <class TVoxel2>
+void irtkSlicePool<VoxelType>::Export(int s, irtkGenericImage<TVoxel2> &slice) const
+{
+  int i;
+
+  if (!(slice.GetImageAttributes() == _attr[s]))
+    slice.Initialize(_attr[s]);
+  TVoxel2 *ptr = slice.GetPointerToVoxels();
+  const VoxelType *data = _data.data() + _offsets[s];
+  for (i = 0; i < _offsets[s + 1] - _offsets[s]; i++)
+    ptr[i] = static_cast<TVoxel2>(data[i]);
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+  Visual Information Processing (VIP), 2011 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+  =========================================================================*/
+
+#include <irtkInterleavedImage.h>
+
+irtkInterleavedImage::irtkInterleavedImage()
+{
+  _attr._x = 0;
+  _attr._y = 0;
+  _attr._z = 0;
+  _attr._t = 0;
+}
+
+irtkInterleavedImage::irtkInterleavedImage(const irtkImageAttributes &attr)
+{
+  Initialize(attr);
+}
+
+irtkInterleavedImage::irtkInterleavedImage(const irtkRealImage &image)
+{
+  Import(image);
+}
+
+void irtkInterleavedImage::Initialize(const irtkImageAttributes &attr)
+{
+  _attr = attr;
+  _data.assign(_attr._x * _attr._y * _attr._z * _attr._t, 0);
+}
+
+void irtkInterleavedImage::Import(const irtkRealImage &image)
+{
+  int v, t;
+
+  if (!(_attr == image.GetImageAttributes()))
+    Initialize(image.GetImageAttributes());
+
+  //transpose frames of the volume into runs of frames per voxel
+  int nvox = _attr._x * _attr._y * _attr._z;
+  const irtkRealPixel *ptr = image.GetPointerToVoxels();
+  for (t = 0; t < _attr._t; t++)
+    for (v = 0; v < nvox; v++)
+      _data[v * _attr._t + t] = ptr[v + t * nvox];
+}
+
+void irtkInterleavedImage::Export(irtkRealImage &image) const
+{
+  int v, t;
+
+  if (!(image.GetImageAttributes() == _attr))
+    image.Initialize(_attr);
+
+  int nvox = _attr._x * _attr._y * _attr._z;
+  irtkRealPixel *ptr = image.GetPointerToVoxels();
+  for (t = 0; t < _attr._t; t++)
+    for (v = 0; v < nvox; v++)
+      ptr[v + t * nvox] = _data[v * _attr._t + t];
+}
+
+irtkInterleavedImage& irtkInterleavedImage::operator=(irtkRealPixel val)
+{
+  _data.assign(_data.size(), val);
+  return *this;
+}
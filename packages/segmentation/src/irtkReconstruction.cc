@@ -150,6 +150,7 @@ irtkReconstruction::irtkReconstruction()
 {
     _step = 0.0001;
     _debug = false;
+    _batch_svr = true;
     _quality_factor = 2;
     _sigma_bias = 12;
     _sigma_s = 0.025;
@@ -1430,6 +1431,10 @@ public:
 
 void irtkReconstruction::SimulateSlices()
 {
+    irtkReconstructionStage stage(_profile, "Simulate", _slices.size());
+    if (_profile.IsOn())
+        stage.AddCoefficients(GetNumberOfCoefficients());
+
     if (_debug)
         cout<<"Simulating slices."<<endl;
 
@@ -1955,9 +1960,23 @@ void irtkReconstruction::MaskSlices()
 class ParallelSliceToVolumeRegistration {
 public:
     irtkReconstruction *reconstructor;
-
-    ParallelSliceToVolumeRegistration(irtkReconstruction *_reconstructor) : 
-    reconstructor(_reconstructor) { }
+    vector<irtkGreyImage> &targets;
+    vector<irtkMatrix> &offsets;
+    vector<int> &valid;
+    irtkGreyImage *source;
+
+    //without source the slices are only prepared for a batch registration,
+    //otherwise each slice is registered to the source on its own
+    ParallelSliceToVolumeRegistration(irtkReconstruction *_reconstructor,
+                                      vector<irtkGreyImage> &_targets,
+                                      vector<irtkMatrix> &_offsets,
+                                      vector<int> &_valid,
+                                      irtkGreyImage *_source = NULL) : 
+    reconstructor(_reconstructor),
+    targets(_targets),
+    offsets(_offsets),
+    valid(_valid),
+    source(_source) { }
 
     void operator() (const blocked_range<size_t> &r) const {
 
@@ -1965,10 +1984,10 @@ public:
         
         for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
 
-            irtkImageRigidRegistrationWithPadding registration;
             irtkGreyPixel smin, smax;
-            irtkGreyImage target;
-            irtkRealImage slice, w, b, t;
+            irtkGreyImage slice_target;
+            irtkGreyImage &target = (source == NULL) ? targets[inputIndex] : slice_target;
+            irtkRealImage t;
             irtkResamplingWithPadding<irtkRealPixel> resampling(attr._dx,attr._dx,attr._dx,-1);         
             irtkReconstruction dummy_reconstruction;
         
@@ -1990,17 +2009,23 @@ public:
                 m=m*mo;
                 reconstructor->_transformations[inputIndex].PutMatrix(m);
 
-                irtkGreyImage source = reconstructor->_reconstructed;
-                registration.SetInput(&target, &source);
-                registration.SetOutput(&reconstructor->_transformations[inputIndex]);
-                registration.GuessParameterSliceToVolume();
-                registration.SetTargetPadding(-1);
-                registration.Run();
-                //undo the offset
-                mo.Invert();
-                m = reconstructor->_transformations[inputIndex].GetMatrix();
-                m=m*mo;
-                reconstructor->_transformations[inputIndex].PutMatrix(m);
+                if (source != NULL) {
+                    irtkImageRigidRegistrationWithPadding registration;
+                    irtkGreyImage slice_source = *source;
+                    registration.SetInput(&target, &slice_source);
+                    registration.SetOutput(&reconstructor->_transformations[inputIndex]);
+                    registration.GuessParameterSliceToVolume();
+                    registration.SetTargetPadding(-1);
+                    registration.Run();
+                    //undo the offset
+                    mo.Invert();
+                    m = reconstructor->_transformations[inputIndex].GetMatrix();
+                    m=m*mo;
+                    reconstructor->_transformations[inputIndex].PutMatrix(m);
+                } else {
+                    offsets[inputIndex] = mo;
+                    valid[inputIndex] = 1;
+                }
             }      
         }
     }
@@ -2017,10 +2042,47 @@ public:
 
 void irtkReconstruction::SliceToVolumeRegistration()
 {
+    irtkReconstructionStage stage(_profile, "SVR", _slices.size());
+
     if (_debug)
         cout << "SliceToVolumeRegistration" << endl;
-    ParallelSliceToVolumeRegistration registration(this);
-    registration();
+
+    vector<irtkGreyImage> targets(_slices.size());
+    vector<irtkMatrix> offsets(_slices.size());
+    vector<int> valid(_slices.size(), 0);
+    irtkGreyImage source = _reconstructed;
+
+    //batches are only used for similarity measures irtkMultiSliceRigidRegistration supports
+    irtkMultiSliceRigidRegistration registration;
+    if (!_batch_svr || !irtkMultiSliceRigidRegistration::IsSupported(registration.GetSimilarityMeasure())) {
+        //register slices one by one
+        ParallelSliceToVolumeRegistration register_slices(this, targets, offsets, valid, &source);
+        register_slices();
+        return;
+    }
+
+    //resample slices and move their origin to zero
+    ParallelSliceToVolumeRegistration prepare(this, targets, offsets, valid);
+    prepare();
+
+    //register all slices to the volume in one batch
+    registration.SetSource(&source);
+    for (unsigned int inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+        if (valid[inputIndex] == 1)
+            registration.AddSlice(&targets[inputIndex], &_transformations[inputIndex]);
+    }
+    registration.Run();
+
+    //undo the offset
+    for (unsigned int inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+        if (valid[inputIndex] == 1) {
+            irtkMatrix mo = offsets[inputIndex];
+            mo.Invert();
+            irtkMatrix m = _transformations[inputIndex].GetMatrix();
+            m=m*mo;
+            _transformations[inputIndex].PutMatrix(m);
+        }
+    }
 }
 
 void irtkReconstruction::CoeffInitBSpline()
@@ -2444,6 +2506,8 @@ public:
 
 void irtkReconstruction::CoeffInit()
 {
+    irtkReconstructionStage stage(_profile, "CoeffInit", _slices.size());
+
     if (_debug)
         cout << "CoeffInit" << endl;
     
@@ -2461,6 +2525,9 @@ void irtkReconstruction::CoeffInit()
     coeffinit();
     cout << " ... done." << endl;
 
+    if (_profile.IsOn())
+        stage.AddCoefficients(GetNumberOfCoefficients());
+
     //prepare image for volume weights, will be needed for Gaussian Reconstruction
     _volume_weights.Initialize( _reconstructed.GetImageAttributes() );
     _volume_weights = 0;
@@ -2503,6 +2570,10 @@ void irtkReconstruction::CoeffInit()
 
 void irtkReconstruction::GaussianReconstruction()
 {
+    irtkReconstructionStage stage(_profile, "GaussianReconstruction", _slices.size());
+    if (_profile.IsOn())
+        stage.AddCoefficients(GetNumberOfCoefficients());
+
     cout << "Gaussian reconstruction ... ";
     unsigned int inputIndex;
     int i, j, k, n;
@@ -3312,62 +3383,51 @@ class ParallelEStep {
 public:
     
     void operator()( const blocked_range<size_t>& r ) const {
+        // parameters of the voxel-wise robust statistics
+        const double mix = reconstructor->_mix;
+        const double gnorm = reconstructor->_step / sqrt(6.28 * reconstructor->_sigma);
+        const double gexp = -1.0 / (2 * reconstructor->_sigma);
+        const double outlier = reconstructor->M(reconstructor->_m) * (1 - mix);
+
         for ( size_t inputIndex = r.begin(); inputIndex < r.end(); ++inputIndex) {
-            // read the current slice
-            irtkRealImage slice = reconstructor->_slices[inputIndex];
-                
-            //read current weight image
-            reconstructor->_weights[inputIndex] = 0;
-                
-            //alias the current bias image
-            irtkRealImage& b = reconstructor->_bias[inputIndex];
+            // contiguous voxel buffers of the slice
+            const irtkRealPixel *ps = reconstructor->_slices[inputIndex].GetPointerToVoxels();
+            const irtkRealPixel *pb = reconstructor->_bias[inputIndex].GetPointerToVoxels();
+            const irtkRealPixel *psim = reconstructor->_simulated_slices[inputIndex].GetPointerToVoxels();
+            const irtkRealPixel *psw = reconstructor->_simulated_weights[inputIndex].GetPointerToVoxels();
+            irtkRealPixel *pw = reconstructor->_weights[inputIndex].GetPointerToVoxels();
+            const int n = reconstructor->_slices[inputIndex].GetNumberOfVoxels();
                 
             //identify scale factor
-            double scale = reconstructor->_scale[inputIndex];
-
-            double num = 0;
-            //Calculate error, voxel weights, and slice potential
-            for (int i = 0; i < slice.GetX(); i++)
-                for (int j = 0; j < slice.GetY(); j++)
-                    if (slice(i, j, 0) != -1) {
-                        //bias correct and scale the slice
-                        slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
-
-                        //number of volumetric voxels to which
-                        // current slice voxel contributes
-                        int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-
-                        // if n == 0, slice voxel has no overlap with volumetric ROI,
-                        // do not process it
-
-                        if ( (n>0) &&
-                             (reconstructor->_simulated_weights[inputIndex](i,j,0) > 0) ) {
-                            slice(i,j,0) -= reconstructor->_simulated_slices[inputIndex](i,j,0);
-
-                            //calculate norm and voxel-wise weights
-                      
-                            //Gaussian distribution for inliers (likelihood)
-                            double g = reconstructor->G(slice(i, j, 0), reconstructor->_sigma);
-                            //Uniform distribution for outliers (likelihood)
-                            double m = reconstructor->M(reconstructor->_m);
-                                        
-                            //voxel_wise posterior
-                            double weight = g * reconstructor->_mix / (g *reconstructor->_mix + m * (1 - reconstructor->_mix));
-                            reconstructor->_weights[inputIndex].PutAsDouble(i, j, 0, weight);
-
-                            //calculate slice potentials
-                            if(reconstructor->_simulated_weights[inputIndex](i,j,0)>0.99) {
-                                slice_potential[inputIndex] += (1 - weight) * (1 - weight);
-                                num++;
-                            }
-                        }
-                        else
-                            reconstructor->_weights[inputIndex].PutAsDouble(i, j, 0, 0);
-                    }
+            const double scale = reconstructor->_scale[inputIndex];
+
+            double potential = 0, num = 0;
+            //Calculate error, voxel weights, and slice potential without
+            //branches, so that the loop can be vectorized. Padded voxels
+            //and voxels without coefficients, i.e. with zero simulated
+            //weight, get zero weight.
+            for (int i = 0; i < n; i++) {
+                //bias correct and scale the slice, subtract simulated slice
+                double e = ps[i] * exp(-pb[i]) * scale - psim[i];
+
+                //Gaussian distribution for inliers (likelihood)
+                double g = gnorm * exp(e * e * gexp);
+
+                //voxel_wise posterior
+                double weight = g * mix / (g * mix + outlier);
+                bool valid = (ps[i] != -1) && (psw[i] > 0);
+                weight = valid ? weight : 0;
+                pw[i] = weight;
+
+                //calculate slice potentials
+                double inside = (valid && (psw[i] > 0.99)) ? 1 : 0;
+                potential += inside * (1 - weight) * (1 - weight);
+                num += inside;
+            }
 
             //evaluate slice potential
             if (num > 0)
-                slice_potential[inputIndex] = sqrt(slice_potential[inputIndex] / num);
+                slice_potential[inputIndex] = sqrt(potential / num);
             else
                 slice_potential[inputIndex] = -1; // slice has no unpadded voxels
         }
@@ -3390,18 +3450,25 @@ public:
 
 void irtkReconstruction::EStep()
 {
+    irtkReconstructionStage stage(_profile, "EStep", _slices.size());
+
     //EStep performs calculation of voxel-wise and slice-wise posteriors (weights)
     if (_debug)
         cout << "EStep: " << endl;
 
-    unsigned int inputIndex;
-    irtkRealImage slice, w, b, sim;
-    int num = 0;
     vector<double> slice_potential(_slices.size(), 0);
 
     ParallelEStep parallelEStep( this, slice_potential );
     parallelEStep();
 
+    EStepParameters(slice_potential);
+}
+
+void irtkReconstruction::EStepParameters(vector<double> &slice_potential)
+{
+    unsigned int inputIndex;
+    int num = 0;
+
     //To force-exclude slices predefined by a user, set their potentials to -1
     for (unsigned int i = 0; i < _force_excluded.size(); i++)
         slice_potential[_force_excluded[i]] = -1;
@@ -3824,6 +3891,8 @@ public:
 
 void irtkReconstruction::Bias()
 {
+    irtkReconstructionStage stage(_profile, "Bias", _slices.size());
+
     if (_debug)
         cout << "Correcting bias ...";
 
@@ -3939,6 +4008,10 @@ public:
 
 void irtkReconstruction::Superresolution(int iter)
 {
+    irtkReconstructionStage stage(_profile, "Superresolution", _slices.size());
+    if (_profile.IsOn())
+        stage.AddCoefficients(GetNumberOfCoefficients());
+
     if (_debug)
         cout << "Superresolution " << iter << endl;
     
@@ -3998,107 +4071,115 @@ void irtkReconstruction::Superresolution(int iter)
 
 class ParallelMStep{
     irtkReconstruction* reconstructor;
+    vector<double> &slice_sigma;
+    vector<double> &slice_mix;
+    vector<double> &slice_num;
+    vector<double> &slice_min;
+    vector<double> &slice_max;
 public:
-    double sigma;
-    double mix;
-    double num;
-    double min;
-    double max;
     
-    void operator()( const blocked_range<size_t>& r ) {
+    void operator()( const blocked_range<size_t>& r ) const {
         for ( size_t inputIndex = r.begin(); inputIndex < r.end(); ++inputIndex) {
-            // read the current slice
-            irtkRealImage slice = reconstructor->_slices[inputIndex];
-                
-            //alias the current weight image
-            irtkRealImage& w = reconstructor->_weights[inputIndex];
-        
-            //alias the current bias image
-            irtkRealImage& b = reconstructor->_bias[inputIndex];
+            // contiguous voxel buffers of the slice
+            const irtkRealPixel *ps = reconstructor->_slices[inputIndex].GetPointerToVoxels();
+            const irtkRealPixel *pb = reconstructor->_bias[inputIndex].GetPointerToVoxels();
+            const irtkRealPixel *psim = reconstructor->_simulated_slices[inputIndex].GetPointerToVoxels();
+            const irtkRealPixel *psw = reconstructor->_simulated_weights[inputIndex].GetPointerToVoxels();
+            const irtkRealPixel *pw = reconstructor->_weights[inputIndex].GetPointerToVoxels();
+            const int n = reconstructor->_slices[inputIndex].GetNumberOfVoxels();
         
             //identify scale factor
-            double scale = reconstructor->_scale[inputIndex];
-
-            //calculate error
-            for (int i = 0; i < slice.GetX(); i++)
-                for (int j = 0; j < slice.GetY(); j++)
-                    if (slice(i, j, 0) != -1) {
-                        //bias correct and scale the slice
-                        slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
+            const double scale = reconstructor->_scale[inputIndex];
+
+            double sigma = 0, mix = 0, num = 0;
+            double min = voxel_limits<irtkRealPixel>::max();
+            double max = voxel_limits<irtkRealPixel>::min();
+
+            //calculate error, only where the simulated slice is fully
+            //covered, otherwise the error has no meaning - it is equal to
+            //slice intensity
+            for (int i = 0; i < n; i++) {
+                double e = ps[i] * exp(-pb[i]) * scale - psim[i];
+                bool valid = (ps[i] != -1) && (psw[i] > 0.99);
+
+                //sigma and mix
+                sigma += valid ? e * e * pw[i] : 0;
+                mix += valid ? pw[i] : 0;
+                num += valid ? 1 : 0;
+
+                //_m
+                double emin = valid ? e : min;
+                double emax = valid ? e : max;
+                min = (emin < min) ? emin : min;
+                max = (emax > max) ? emax : max;
+            }
 
-                        //otherwise the error has no meaning - it is equal to slice intensity
-                        if ( reconstructor->_simulated_weights[inputIndex](i,j,0) > 0.99 ) {
-                            slice(i,j,0) -= reconstructor->_simulated_slices[inputIndex](i,j,0);
-                            
-                            //sigma and mix
-                            double e = slice(i, j, 0);
-                            sigma += e * e * w(i, j, 0);
-                            mix += w(i, j, 0);
-
-                            //_m
-                            if (e < min)
-                                min = e;
-                            if (e > max)
-                                max = e;
-
-                            num++;
-                        }
-                    }
+            slice_sigma[inputIndex] = sigma;
+            slice_mix[inputIndex] = mix;
+            slice_num[inputIndex] = num;
+            slice_min[inputIndex] = min;
+            slice_max[inputIndex] = max;
         } //end of loop for a slice inputIndex
     }
  
-    ParallelMStep( ParallelMStep& x, split ) :
-        reconstructor(x.reconstructor)
-    {
-        sigma = 0;
-        mix = 0;
-        num = 0;
-        min = 0;
-        max = 0;
-    }
- 
-    void join( const ParallelMStep& y ) {
-        if (y.min < min)
-            min = y.min;
-        if (y.max > max)
-            max = y.max;
-        
-        sigma += y.sigma;
-        mix += y.mix;
-        num += y.num;
-    }
-             
-    ParallelMStep( irtkReconstruction *reconstructor ) :
-    reconstructor(reconstructor)
-    {
-        sigma = 0;
-        mix = 0;
-        num = 0;
-        min = voxel_limits<irtkRealPixel>::max();
-        max = voxel_limits<irtkRealPixel>::min();
-    }
+    ParallelMStep( irtkReconstruction *reconstructor,
+                   vector<double> &slice_sigma,
+                   vector<double> &slice_mix,
+                   vector<double> &slice_num,
+                   vector<double> &slice_min,
+                   vector<double> &slice_max ) :
+    reconstructor(reconstructor),
+    slice_sigma(slice_sigma),
+    slice_mix(slice_mix),
+    slice_num(slice_num),
+    slice_min(slice_min),
+    slice_max(slice_max)
+    { }
 
     // execute
-    void operator() () {
+    void operator() () const {
         task_scheduler_init init(tbb_no_threads);
-        parallel_reduce( blocked_range<size_t>(0,reconstructor->_slices.size()),
-                         *this );
+        parallel_for( blocked_range<size_t>(0,reconstructor->_slices.size()),
+                      *this );
         init.terminate();
     }    
 };
 
 void irtkReconstruction::MStep(int iter)
 {
+    irtkReconstructionStage stage(_profile, "MStep", _slices.size());
+
     if (_debug)
         cout << "MStep" << endl;
     
-    ParallelMStep parallelMStep(this);
+    vector<double> slice_sigma(_slices.size()), slice_mix(_slices.size()), slice_num(_slices.size());
+    vector<double> slice_min(_slices.size()), slice_max(_slices.size());
+    ParallelMStep parallelMStep(this, slice_sigma, slice_mix, slice_num, slice_min, slice_max);
     parallelMStep();
-    double sigma = parallelMStep.sigma;
-    double mix = parallelMStep.mix;
-    double num = parallelMStep.num;
-    double min = parallelMStep.min;
-    double max = parallelMStep.max;
+
+    MStepParameters(iter, slice_sigma, slice_mix, slice_num, slice_min, slice_max);
+}
+
+void irtkReconstruction::MStepParameters(int iter,
+                                         const vector<double> &slice_sigma,
+                                         const vector<double> &slice_mix,
+                                         const vector<double> &slice_num,
+                                         const vector<double> &slice_min,
+                                         const vector<double> &slice_max)
+{
+    //reduce the per-slice sums in slice order, independent of threading
+    double sigma = 0, mix = 0, num = 0;
+    double min = voxel_limits<irtkRealPixel>::max();
+    double max = voxel_limits<irtkRealPixel>::min();
+    for (unsigned int inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+        sigma += slice_sigma[inputIndex];
+        mix += slice_mix[inputIndex];
+        num += slice_num[inputIndex];
+        if (slice_min[inputIndex] < min)
+            min = slice_min[inputIndex];
+        if (slice_max[inputIndex] > max)
+            max = slice_max[inputIndex];
+    }
 
     //Calculate sigma and mix
     if (mix > 0) {
@@ -4253,6 +4334,8 @@ public:
 
 void irtkReconstruction::AdaptiveRegularization(int iter, irtkRealImage& original)
 {
+    irtkReconstructionStage stage(_profile, "Regularization");
+
     if (_debug)
           cout << "AdaptiveRegularization."<< endl;
         //cout << "AdaptiveRegularization: _delta = "<<_delta<<" _lambda = "<<_lambda <<" _alpha = "<<_alpha<< endl;
@@ -4397,6 +4480,21 @@ void irtkReconstruction::Evaluate(int iter)
     cout << endl << "Total: " << sum << endl;
 }
 
+double irtkReconstruction::GetNumberOfCoefficients()
+{
+    double n = 0;
+    for (unsigned int inputIndex = 0; inputIndex < _volcoeffs.size(); inputIndex++)
+        for (unsigned int i = 0; i < _volcoeffs[inputIndex].size(); i++)
+            for (unsigned int j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
+                n += _volcoeffs[inputIndex][i][j].size();
+    return n;
+}
+
+void irtkReconstruction::WriteProfile(const char *filename)
+{
+    _profile.Write(filename);
+}
+
 void irtkReconstruction::EvaluateWithTiming(int iter)
 {
     cout << "Iteration " << iter << ": " << endl;
@@ -4513,6 +4611,8 @@ public:
 
 void irtkReconstruction::NormaliseBias(int iter)
 {
+    irtkReconstructionStage stage(_profile, "NormaliseBias", _slices.size());
+
     if(_debug)
         cout << "Normalise Bias ... ";
 
@@ -17,6 +17,7 @@
 #include <irtkImageRigidRegistrationWithPadding.h>
 #include <irtkTransformation.h>
 #include <math.h>
+#include <stdio.h>
 
 
 // -----------------------------------------------------------------------------
@@ -25,6 +26,15 @@
 irtkReconstructionCardiac4D::irtkReconstructionCardiac4D():irtkReconstruction()
 {
     _recon_type = _3D;
+    _use_volume_coeffs = false;
+    _coeff_quality_factor = 0;
+    _coeff_recon_type = _3D;
+    _coeff_tolerance = 0;
+    _temporal_weight_cutoff = 0;
+    _use_interleaved = false;
+    _deterministic = false;
+    _temporal_lambda = 0;
+    _slice_pools_valid = false;
 }
 
 // -----------------------------------------------------------------------------
@@ -390,6 +400,9 @@ void irtkReconstructionCardiac4D::CreateSlicesAndTransformationsCardiac4D( vecto
 
     if (_debug)
         cout << "CreateSlicesAndTransformations" << endl;
+
+    //new slices invalidate previously computed coefficients
+    ResetCoeffs();
     
     //for each stack
     for (unsigned int i = 0; i < stacks.size(); i++) {
@@ -448,6 +461,7 @@ void irtkReconstructionCardiac4D::CreateSlicesAndTransformationsCardiac4D( vecto
         for (unsigned int inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
             if (_force_excluded_locs[i]==_loc_index[inputIndex])
                 _slice_excluded[inputIndex] = 1;
+    InvalidateSlicePools();
 }
 
 // -----------------------------------------------------------------------------
@@ -468,6 +482,8 @@ void irtkReconstructionCardiac4D::ResetSlicesAndTransformationsCardiac4D()
     _transformations.clear();
     _slice_excluded.clear();
     _probability_maps.clear();
+    ResetCoeffs();
+    InvalidateSlicePools();
 
 }
 
@@ -523,6 +539,26 @@ void irtkReconstructionCardiac4D::CalculateSliceTemporalWeights()
             _slice_temporal_weight[outputIndex][inputIndex] = CalculateTemporalWeight( _reconstructed_cardiac_phases[outputIndex], _slice_cardphase[inputIndex], _slice_dt[inputIndex], _slice_rr[inputIndex], _wintukeypct ); 
         }      
     }
+
+    //keep only the non-negligible weights of each slice for the 4D kernels
+    _slice_temporal_weight_list.clear();
+    _slice_temporal_weight_list.resize(_slices.size());
+    int nweights = 0;
+    for (unsigned int inputIndex = 0; inputIndex < _slices.size(); inputIndex++) 
+    {
+        for (unsigned int outputIndex = 0; outputIndex < _reconstructed_cardiac_phases.size(); outputIndex++) 
+        {
+            if (fabs(_slice_temporal_weight[outputIndex][inputIndex]) > _temporal_weight_cutoff) {
+                TEMPORALWEIGHT tw;
+                tw.phase = outputIndex;
+                tw.weight = _slice_temporal_weight[outputIndex][inputIndex];
+                _slice_temporal_weight_list[inputIndex].push_back(tw);
+                nweights++;
+            }
+        }
+    }
+    if (_debug)
+        cout << "Non-zero temporal weights: " << nweights << " of " << _slices.size() * _reconstructed_cardiac_phases.size() << endl;
 }
 
 
@@ -590,6 +626,330 @@ double irtkReconstructionCardiac4D::wintukey( double angdiff, double alpha )
 }
 
 
+// -----------------------------------------------------------------------------
+// Discretized PSF
+// -----------------------------------------------------------------------------
+irtkRealImage& irtkReconstructionCardiac4D::GetPSF( double dx, double dy, double dz )
+{
+    //volume is always isotropic
+    double res, vy, vz;
+    _reconstructed4D.GetPixelSize(&res, &vy, &vz);
+
+    PSFKEY key;
+    key.dx = dx;
+    key.dy = dy;
+    key.dz = dz;
+    key.recon_type = _recon_type;
+    key.quality_factor = _quality_factor;
+    key.resolution = res;
+
+    map<PSFKEY, irtkRealImage>::iterator it = _psf_cache.find(key);
+    if (it != _psf_cache.end())
+        return it->second;
+
+    if (_debug)
+        cout << "Computing PSF for voxel size " << dx << " " << dy << " " << dz << endl;
+
+    //PSF will be calculated in slice space in higher resolution
+
+    //sigma of 3D Gaussian (sinc with FWHM=dx or dy in-plane, Gaussian with FWHM = dz through-plane)
+    double sigmax, sigmay, sigmaz;
+    if (_recon_type == _3D) {
+        sigmax = 1.2 * dx / 2.3548;
+        sigmay = 1.2 * dy / 2.3548;
+        sigmaz = dz / 2.3548;
+    }
+
+    if (_recon_type == _1D) {
+        sigmax = 0.5 * dx / 2.3548;
+        sigmay = 0.5 * dy / 2.3548;
+        sigmaz = dz / 2.3548;
+    }
+
+    if (_recon_type == _interpolate) {
+        sigmax = 0.5 * dx / 2.3548;
+        sigmay = 0.5 * dx / 2.3548;
+        sigmaz = 0.5 * dx / 2.3548;
+    }
+
+    //isotropic voxel size of PSF - derived from resolution of reconstructed volume
+    double size = res / _quality_factor;
+
+    //number of voxels in each direction
+    //the ROI is 2*voxel dimension, dimension is always odd
+    int xDim = round(2 * dx / size);
+    int yDim = round(2 * dy / size);
+    int zDim = round(2 * dz / size);
+    xDim = xDim/2*2+1;
+    yDim = yDim/2*2+1;
+    zDim = zDim/2*2+1;
+
+    //image corresponding to PSF
+    irtkImageAttributes attr;
+    attr._x = xDim;
+    attr._y = yDim;
+    attr._z = zDim;
+    attr._dx = size;
+    attr._dy = size;
+    attr._dz = size;
+    irtkRealImage PSF(attr);
+
+    //the Gaussian is separable, so evaluate it along each axis
+    //distances are relative to the centre of the PSF
+    int i, j, k;
+    double x;
+    vector<double> gx(xDim), gy(yDim), gz(zDim);
+    for (i = 0; i < xDim; i++) {
+        x = (i - 0.5 * (xDim - 1)) * size;
+        gx[i] = exp(-x * x / (2 * sigmax * sigmax));
+    }
+    for (j = 0; j < yDim; j++) {
+        x = (j - 0.5 * (yDim - 1)) * size;
+        gy[j] = exp(-x * x / (2 * sigmay * sigmay));
+    }
+    for (k = 0; k < zDim; k++) {
+        x = (k - 0.5 * (zDim - 1)) * size;
+        gz[k] = exp(-x * x / (2 * sigmaz * sigmaz));
+    }
+
+    //continuous PSF does not need to be normalized as discrete will be
+    double sum = 0;
+    for (i = 0; i < xDim; i++)
+        for (j = 0; j < yDim; j++)
+            for (k = 0; k < zDim; k++) {
+                PSF(i, j, k) = gx[i] * gy[j] * gz[k];
+                sum += PSF(i, j, k);
+            }
+    PSF /= sum;
+
+    return _psf_cache[key] = PSF;
+}
+
+
+// -----------------------------------------------------------------------------
+// Slice-to-Volume Coefficients of a Slice
+// -----------------------------------------------------------------------------
+bool irtkReconstructionCardiac4D::SliceCoeffsCardiac4D( int inputIndex, irtkSliceCoeffs& slicecoeffs )
+{
+    //get resolution of the volume
+    double vx, vy, vz;
+    _reconstructed4D.GetPixelSize(&vx, &vy, &vz);
+    //volume is always isotropic
+    double res = vx;
+    //read the slice
+    irtkRealImage& slice = _slices[inputIndex];
+
+    //prepare structures for storage
+    slicecoeffs.Initialize(slice.GetX(), slice.GetY());
+
+    //to check whether the slice has an overlap with mask ROI
+    bool slice_inside = false;
+
+    //get slice voxel size to define PSF
+    double dx, dy, dz;
+    slice.GetPixelSize(&dx, &dy, &dz);
+
+    //discretized PSF, shared by all slices with the same voxel size
+    irtkRealImage& PSF = GetPSF(dx, dy, dz);
+    int xDim = PSF.GetX();
+    int yDim = PSF.GetY();
+    int zDim = PSF.GetZ();
+    double size = res / _quality_factor;
+
+    //centre of PSF
+    double cx, cy, cz;
+    cx = 0.5 * (xDim - 1);
+    cy = 0.5 * (yDim - 1);
+    cz = 0.5 * (zDim - 1);
+    PSF.ImageToWorld(cx, cy, cz);
+
+    int i, j;
+
+    if (_debug)
+        if (inputIndex == 0)
+            PSF.Write("PSF.nii.gz");
+
+    irtkImageAttributes attr;
+
+    //prepare storage for PSF transformed and resampled to the space of reconstructed volume
+    //maximum dim of rotated kernel - the next higher odd integer plus two to accound for rounding error of tx,ty,tz.
+    //Note conversion from PSF image coordinates to tPSF image coordinates *size/res
+    int dim = (floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2))
+        * 2 + 1 + 2;
+    //prepare image attributes. Voxel dimension will be taken from the reconstructed volume
+    attr._x = dim;
+    attr._y = dim;
+    attr._z = dim;
+    attr._dx = res;
+    attr._dy = res;
+    attr._dz = res;
+    //create matrix from transformed PSF
+    irtkRealImage tPSF(attr);
+    //calculate centre of tPSF in image coordinates
+    int centre = (dim - 1) / 2;
+
+    //for each voxel in current slice calculate matrix coefficients
+    int ii, jj, kk;
+    int tx, ty, tz;
+    int nx, ny, nz;
+    int l, m, n;
+    double weight;
+    int vol_x = _reconstructed4D.GetX();
+    int vol_y = _reconstructed4D.GetY();
+    for (i = 0; i < slice.GetX(); i++)
+        for (j = 0; j < slice.GetY(); j++) {
+            if (slice(i, j, 0) != -1) {
+                //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
+                double x = i;
+                double y = j;
+                double z = 0;
+                slice.ImageToWorld(x, y, z);
+                _transformations[inputIndex].Transform(x, y, z);
+                _reconstructed4D.WorldToImage(x, y, z);
+                tx = round(x);
+                ty = round(y);
+                tz = round(z);
+
+                //Clear the transformed PSF
+                for (ii = 0; ii < dim; ii++)
+                    for (jj = 0; jj < dim; jj++)
+                        for (kk = 0; kk < dim; kk++)
+                            tPSF(ii, jj, kk) = 0;
+
+                //for each POINT3D of the PSF
+                for (ii = 0; ii < xDim; ii++)
+                    for (jj = 0; jj < yDim; jj++)
+                        for (kk = 0; kk < zDim; kk++) {
+                            //Calculate the position of the POINT3D of
+                            //PSF centered over current slice voxel
+                            //This is a bit complicated because slices
+                            //can be oriented in any direction
+
+                            //PSF image coordinates
+                            x = ii;
+                            y = jj;
+                            z = kk;
+                            //change to PSF world coordinates - now real sizes in mm
+                            PSF.ImageToWorld(x, y, z);
+                            //centre around the centrepoint of the PSF
+                            x -= cx;
+                            y -= cy;
+                            z -= cz;
+
+                            //Need to convert (x,y,z) to slice image
+                            //coordinates because slices can have
+                            //transformations included in them (they are
+                            //nifti)  and those are not reflected in
+                            //PSF. In slice image coordinates we are
+                            //sure that z is through-plane
+
+                            //adjust according to voxel size
+                            x /= dx;
+                            y /= dy;
+                            z /= dz;
+                            //center over current voxel
+                            x += i;
+                            y += j;
+
+                            //convert from slice image coordinates to world coordinates
+                            slice.ImageToWorld(x, y, z);
+
+                            //Transform to space of reconstructed volume
+                            _transformations[inputIndex].Transform(x, y, z);
+                            //Change to image coordinates
+                            _reconstructed4D.WorldToImage(x, y, z);
+
+                            //determine coefficients of volume voxels for position x,y,z
+                            //using linear interpolation
+
+                            //Find the 8 closest volume voxels
+
+                            //lowest corner of the cube
+                            nx = (int) floor(x);
+                            ny = (int) floor(y);
+                            nz = (int) floor(z);
+
+                            //not all neighbours might be in ROI, thus we need to normalize
+                            //(l,m,n) are image coordinates of 8 neighbours in volume space
+                            //for each we check whether it is in volume
+                            double sum = 0;
+                            //to find wether the current slice voxel has overlap with ROI
+                            bool inside = false;
+                            for (l = nx; l <= nx + 1; l++)
+                                if ((l >= 0) && (l < _reconstructed4D.GetX()))
+                                    for (m = ny; m <= ny + 1; m++)
+                                        if ((m >= 0) && (m < _reconstructed4D.GetY()))
+                                            for (n = nz; n <= nz + 1; n++)
+                                                if ((n >= 0) && (n < _reconstructed4D.GetZ())) {
+                                                    weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+                                                    sum += weight;
+                                                    if (_mask(l, m, n) == 1) {
+                                                        inside = true;
+                                                        slice_inside = true;
+                                                    }
+                                                }
+                            //if there were no voxels do nothing
+                            if ((sum <= 0) || (!inside))
+                                continue;
+                            //now calculate the transformed PSF
+                            for (l = nx; l <= nx + 1; l++)
+                                if ((l >= 0) && (l < _reconstructed4D.GetX()))
+                                    for (m = ny; m <= ny + 1; m++)
+                                        if ((m >= 0) && (m < _reconstructed4D.GetY()))
+                                            for (n = nz; n <= nz + 1; n++)
+                                                if ((n >= 0) && (n < _reconstructed4D.GetZ())) {
+                                                    weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+
+                                                    //image coordinates in tPSF
+                                                    //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
+                                                    int aa, bb, cc;
+                                                    aa = l - tx + centre;
+                                                    bb = m - ty + centre;
+                                                    cc = n - tz + centre;
+
+                                                    //resulting value
+                                                    double value = PSF(ii, jj, kk) * weight / sum;
+
+                                                    //Check that we are in tPSF
+                                                    if ((aa < 0) || (aa >= dim) || (bb < 0) || (bb >= dim) || (cc < 0)
+                                                        || (cc >= dim)) {
+                                                        cerr << "Error while trying to populate tPSF. " << aa << " " << bb
+                                                             << " " << cc << endl;
+                                                        cerr << l << " " << m << " " << n << endl;
+                                                        cerr << tx << " " << ty << " " << tz << endl;
+                                                        cerr << centre << endl;
+                                                        tPSF.Write("tPSF.nii.gz");
+                                                        exit(1);
+                                                    }
+                                                    else
+                                                        //update transformed PSF
+                                                        tPSF(aa, bb, cc) += value;
+                                                }
+
+                        } //end of the loop for PSF points
+
+                //store tPSF values, z outermost so that linear voxel
+                //indices of a row are increasing
+                for (kk = 0; kk < dim; kk++)
+                    for (jj = 0; jj < dim; jj++)
+                        for (ii = 0; ii < dim; ii++)
+                            if (tPSF(ii, jj, kk) > 0) {
+                                l = ii + tx - centre;
+                                m = jj + ty - centre;
+                                n = kk + tz - centre;
+                                slicecoeffs.Add(l + vol_x * (m + vol_y * n), tPSF(ii, jj, kk));
+                            }
+
+            }
+            //close the row of slice voxel (i,j)
+            slicecoeffs.NextRow();
+        } //end of loop for slice voxels
+
+    slicecoeffs.Finalize();
+    return slice_inside;
+}
+
+
 // -----------------------------------------------------------------------------
 // ParallelCoeffInitCardiac4D
 // -----------------------------------------------------------------------------
@@ -604,317 +964,25 @@ public:
         
         for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
 
-            bool slice_inside;
+            //keep the coefficients of slices which have not moved
+            if (!reconstructor->_coeff_update[inputIndex])
+                continue;
 
-            //current slice
-            //irtkRealImage slice;
+            irtkSliceCoeffs& slicecoeffs = reconstructor->_slice_coeffs[inputIndex];
 
-            //get resolution of the volume
-            double vx, vy, vz;
-            reconstructor->_reconstructed4D.GetPixelSize(&vx, &vy, &vz);
-            //volume is always isotropic
-            double res = vx;
-            //read the slice
-            irtkRealImage& slice = reconstructor->_slices[inputIndex];
-
-            //prepare structures for storage
-            POINT3D p;
-            VOXELCOEFFS empty;
-            SLICECOEFFS slicecoeffs(slice.GetX(), vector < VOXELCOEFFS > (slice.GetY(), empty));
+            if (reconstructor->_slice_excluded[inputIndex] == 0) {
+                //start of a loop for a slice inputIndex
+                cout << inputIndex << " ";
+                cout.flush();
 
-            //to check whether the slice has an overlap with mask ROI
-            slice_inside = false;
-                        
-                if (reconstructor->_slice_excluded[inputIndex] == 0) {
-        
-                    //start of a loop for a slice inputIndex
-                    cout << inputIndex << " ";
-                    cout.flush();
-
-                    //PSF will be calculated in slice space in higher resolution
-
-                    //get slice voxel size to define PSF
-                    double dx, dy, dz;
-                    slice.GetPixelSize(&dx, &dy, &dz);
-
-                    //sigma of 3D Gaussian (sinc with FWHM=dx or dy in-plane, Gaussian with FWHM = dz through-plane)
-	    
-			double sigmax, sigmay, sigmaz;
-			if(reconstructor->_recon_type == _3D)
-			{
-				  sigmax = 1.2 * dx / 2.3548;
-				  sigmay = 1.2 * dy / 2.3548;
-				  sigmaz = dz / 2.3548;
-			}
-	
-			if(reconstructor->_recon_type == _1D)
-			{
-				  sigmax = 0.5 * dx / 2.3548;
-				  sigmay = 0.5 * dy / 2.3548;
-				  sigmaz = dz / 2.3548;
-			}
-	
-			if(reconstructor->_recon_type == _interpolate)
-			{
-				  sigmax = 0.5 * dx / 2.3548;
-				  sigmay = 0.5 * dx / 2.3548;
-				  sigmaz = 0.5 * dx / 2.3548;
-			}
-            /*
-              cout<<"Original sigma"<<sigmax<<" "<<sigmay<<" "<<sigmaz<<endl;
-        
-              //readjust for resolution of the volume
-              //double sigmax,sigmay,sigmaz;
-              double sigmamin = res/(3*2.3548);
-        
-              if((dx-res)>sigmamin)
-              sigmax = 1.2 * sqrt(dx*dx-res*res) / 2.3548;
-              else sigmax = sigmamin;
-
-              if ((dy-res)>sigmamin)
-              sigmay = 1.2 * sqrt(dy*dy-res*res) / 2.3548;
-              else
-              sigmay=sigmamin;
-              if ((dz-1.2*res)>sigmamin)
-              sigmaz = sqrt(dz*dz-1.2*1.2*res*res) / 2.3548;
-              else sigmaz=sigmamin;
-        
-              cout<<"Adjusted sigma:"<<sigmax<<" "<<sigmay<<" "<<sigmaz<<endl;
-            */
-        
-            //calculate discretized PSF
-
-            //isotropic voxel size of PSF - derived from resolution of reconstructed volume
-            double size = res / reconstructor->_quality_factor;
-
-            //number of voxels in each direction
-            //the ROI is 2*voxel dimension
-
-            int xDim = round(2 * dx / size);
-            int yDim = round(2 * dy / size);
-            int zDim = round(2 * dz / size);
-			///test to make dimension alwways odd
-			xDim = xDim/2*2+1;
-			yDim = yDim/2*2+1;
-			zDim = zDim/2*2+1;
-			///end test
-
-            //image corresponding to PSF
-            irtkImageAttributes attr;
-            attr._x = xDim;
-            attr._y = yDim;
-            attr._z = zDim;
-            attr._dx = size;
-            attr._dy = size;
-            attr._dz = size;
-            irtkRealImage PSF(attr);
-
-            //centre of PSF
-            double cx, cy, cz;
-            cx = 0.5 * (xDim - 1);
-            cy = 0.5 * (yDim - 1);
-            cz = 0.5 * (zDim - 1);
-            PSF.ImageToWorld(cx, cy, cz);
-
-            double x, y, z;
-            double sum = 0;
-            int i, j, k;
-            for (i = 0; i < xDim; i++)
-                for (j = 0; j < yDim; j++)
-                    for (k = 0; k < zDim; k++) {
-                        x = i;
-                        y = j;
-                        z = k;
-                        PSF.ImageToWorld(x, y, z);
-                        x -= cx;
-                        y -= cy;
-                        z -= cz;
-                        //continuous PSF does not need to be normalized as discrete will be
-                        PSF(i, j, k) = exp(
-                                           -x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay)
-                                           - z * z / (2 * sigmaz * sigmaz));
-                        sum += PSF(i, j, k);
-                    }
-            PSF /= sum;
-
-            if (reconstructor->_debug)
-                if (inputIndex == 0)
-                    PSF.Write("PSF.nii.gz");
-
-            //prepare storage for PSF transformed and resampled to the space of reconstructed volume
-            //maximum dim of rotated kernel - the next higher odd integer plus two to accound for rounding error of tx,ty,tz.
-            //Note conversion from PSF image coordinates to tPSF image coordinates *size/res
-            int dim = (floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2))
-                * 2 + 1 + 2;
-            //prepare image attributes. Voxel dimension will be taken from the reconstructed volume
-            attr._x = dim;
-            attr._y = dim;
-            attr._z = dim;
-            attr._dx = res;
-            attr._dy = res;
-            attr._dz = res;
-            //create matrix from transformed PSF
-            irtkRealImage tPSF(attr);
-            //calculate centre of tPSF in image coordinates
-            int centre = (dim - 1) / 2;
-
-            //for each voxel in current slice calculate matrix coefficients
-            int ii, jj, kk;
-            int tx, ty, tz;
-            int nx, ny, nz;
-            int l, m, n;
-            double weight;
-            for (i = 0; i < slice.GetX(); i++)
-                for (j = 0; j < slice.GetY(); j++)
-                    if (slice(i, j, 0) != -1) {
-                        //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
-                        x = i;
-                        y = j;
-                        z = 0;
-                        slice.ImageToWorld(x, y, z);
-                        reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                        reconstructor->_reconstructed4D.WorldToImage(x, y, z);
-                        tx = round(x);
-                        ty = round(y);
-                        tz = round(z);
-
-                        //Clear the transformed PSF
-                        for (ii = 0; ii < dim; ii++)
-                            for (jj = 0; jj < dim; jj++)
-                                for (kk = 0; kk < dim; kk++)
-                                    tPSF(ii, jj, kk) = 0;
-
-                        //for each POINT3D of the PSF
-                        for (ii = 0; ii < xDim; ii++)
-                            for (jj = 0; jj < yDim; jj++)
-                                for (kk = 0; kk < zDim; kk++) {
-                                    //Calculate the position of the POINT3D of
-                                    //PSF centered over current slice voxel                            
-                                    //This is a bit complicated because slices
-                                    //can be oriented in any direction 
-
-                                    //PSF image coordinates
-                                    x = ii;
-                                    y = jj;
-                                    z = kk;
-                                    //change to PSF world coordinates - now real sizes in mm
-                                    PSF.ImageToWorld(x, y, z);
-                                    //centre around the centrepoint of the PSF
-                                    x -= cx;
-                                    y -= cy;
-                                    z -= cz;
-
-                                    //Need to convert (x,y,z) to slice image
-                                    //coordinates because slices can have
-                                    //transformations included in them (they are
-                                    //nifti)  and those are not reflected in
-                                    //PSF. In slice image coordinates we are
-                                    //sure that z is through-plane 
-
-                                    //adjust according to voxel size
-                                    x /= dx;
-                                    y /= dy;
-                                    z /= dz;
-                                    //center over current voxel
-                                    x += i;
-                                    y += j;
-
-                                    //convert from slice image coordinates to world coordinates
-                                    slice.ImageToWorld(x, y, z);
-
-                                    //x+=(vx-cx); y+=(vy-cy); z+=(vz-cz);
-                                    //Transform to space of reconstructed volume
-                                    reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                    //Change to image coordinates
-                                    reconstructor->_reconstructed4D.WorldToImage(x, y, z);
-
-                                    //determine coefficients of volume voxels for position x,y,z
-                                    //using linear interpolation
-
-                                    //Find the 8 closest volume voxels
-
-                                    //lowest corner of the cube
-                                    nx = (int) floor(x);
-                                    ny = (int) floor(y);
-                                    nz = (int) floor(z);
-
-                                    //not all neighbours might be in ROI, thus we need to normalize
-                                    //(l,m,n) are image coordinates of 8 neighbours in volume space
-                                    //for each we check whether it is in volume
-                                    sum = 0;
-                                    //to find wether the current slice voxel has overlap with ROI
-                                    bool inside = false;
-                                    for (l = nx; l <= nx + 1; l++)
-                                        if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
-                                            for (m = ny; m <= ny + 1; m++)
-                                                if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
-                                                    for (n = nz; n <= nz + 1; n++)
-                                                        if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
-                                                            weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-                                                            sum += weight;
-                                                            if (reconstructor->_mask(l, m, n) == 1) {
-                                                                inside = true;
-                                                                slice_inside = true;
-                                                            }
-                                                        }
-                                    //if there were no voxels do nothing
-                                    if ((sum <= 0) || (!inside))
-                                        continue;
-                                    //now calculate the transformed PSF
-                                    for (l = nx; l <= nx + 1; l++)
-                                        if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
-                                            for (m = ny; m <= ny + 1; m++)
-                                                if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
-                                                    for (n = nz; n <= nz + 1; n++)
-                                                        if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
-                                                            weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-
-                                                            //image coordinates in tPSF
-                                                            //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
-                                                            int aa, bb, cc;
-                                                            aa = l - tx + centre;
-                                                            bb = m - ty + centre;
-                                                            cc = n - tz + centre;
-
-                                                            //resulting value
-                                                            double value = PSF(ii, jj, kk) * weight / sum;
-
-                                                            //Check that we are in tPSF
-                                                            if ((aa < 0) || (aa >= dim) || (bb < 0) || (bb >= dim) || (cc < 0)
-                                                                || (cc >= dim)) {
-                                                                cerr << "Error while trying to populate tPSF. " << aa << " " << bb
-                                                                     << " " << cc << endl;
-                                                                cerr << l << " " << m << " " << n << endl;
-                                                                cerr << tx << " " << ty << " " << tz << endl;
-                                                                cerr << centre << endl;
-                                                                tPSF.Write("tPSF.nii.gz");
-                                                                exit(1);
-                                                            }
-                                                            else
-                                                                //update transformed PSF
-                                                                tPSF(aa, bb, cc) += value;
-                                                        }
-
-                                } //end of the loop for PSF points
-
-                        //store tPSF values
-                        for (ii = 0; ii < dim; ii++)
-                            for (jj = 0; jj < dim; jj++)
-                                for (kk = 0; kk < dim; kk++)
-                                    if (tPSF(ii, jj, kk) > 0) {
-                                        p.x = ii + tx - centre;
-                                        p.y = jj + ty - centre;
-                                        p.z = kk + tz - centre;
-                                        p.value = tPSF(ii, jj, kk);
-                                        slicecoeffs[i][j].push_back(p);
-                                    }
-                                    
-                    } //end of loop for slice voxels
-
-                }  // if(_slice_excluded[inputIndex]==0)
-                
-            reconstructor->_volcoeffs[inputIndex] = slicecoeffs;
-            reconstructor->_slice_inside[inputIndex] = slice_inside;
+                reconstructor->_slice_inside[inputIndex] = reconstructor->SliceCoeffsCardiac4D(inputIndex, slicecoeffs);
+            }
+            else {
+                //excluded slices have no coefficients
+                slicecoeffs.Initialize(reconstructor->_slices[inputIndex].GetX(), reconstructor->_slices[inputIndex].GetY());
+                slicecoeffs.Finalize();
+                reconstructor->_slice_inside[inputIndex] = false;
+            }
 
         }  //end of loop through the slices                            
         
@@ -931,27 +999,133 @@ public:
 };
 
 
+// -----------------------------------------------------------------------------
+// Calculate Displacement of Slice Since Coefficient Initialisation
+// -----------------------------------------------------------------------------
+double irtkReconstructionCardiac4D::CalculateCoeffDisplacement( int inputIndex )
+{
+    //the displacement between two rigid transformations is an affine function
+    //of position, so its maximum over the slice is attained at a corner
+    double x, y, z, px, py, pz, disp, max_disp = 0;
+    int i, j;
+    irtkRealImage& slice = _slices[inputIndex];
+    for (i = 0; i < 2; i++)
+        for (j = 0; j < 2; j++) {
+            x = i * (slice.GetX() - 1);
+            y = j * (slice.GetY() - 1);
+            z = 0;
+            slice.ImageToWorld(x, y, z);
+            px = x; py = y; pz = z;
+            _transformations[inputIndex].Transform(x, y, z);
+            _previous_transformations[inputIndex].Transform(px, py, pz);
+            disp = sqrt((x-px)*(x-px) + (y-py)*(y-py) + (z-pz)*(z-pz));
+            if (disp > max_disp)
+                max_disp = disp;
+        }
+    return max_disp;
+}
+
+
 // -----------------------------------------------------------------------------
 // Calculate Transformation Matrix Between Slices and Voxels
 // -----------------------------------------------------------------------------
 void irtkReconstructionCardiac4D::CoeffInitCardiac4D()
 {
+    irtkReconstructionStage stage(_profile, "CoeffInit");
+
     if (_debug)
         cout << "CoeffInit" << endl;
     
-    //clear slice-volume matrix from previous iteration
+    unsigned int inputIndex;
+
+    //coefficients can only be reused if the volume, mask and PSF are unchanged
+    bool reuse = (_coeff_tolerance >= 0)
+                 && (_previous_transformations.size() == _slices.size())
+                 && (_slice_coeffs.size() == _slices.size())
+                 && (_coeff_attributes == _reconstructed4D.GetImageAttributes())
+                 && (_coeff_quality_factor == _quality_factor)
+                 && (_coeff_recon_type == _recon_type)
+                 && (_coeff_mask.GetImageAttributes() == _mask.GetImageAttributes());
+    if (reuse) {
+        irtkRealPixel *pm = _mask.GetPointerToVoxels();
+        irtkRealPixel *pc = _coeff_mask.GetPointerToVoxels();
+        for (int v = 0; v < _mask.GetNumberOfVoxels(); v++)
+            if (pm[v] != pc[v]) {
+                reuse = false;
+                break;
+            }
+    }
+
+    //select slices which need new coefficients
+    int nupdate = 0;
+    _coeff_update.assign(_slices.size(), true);
+    if (reuse) {
+        for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
+            if ((_coeff_excluded[inputIndex] == _slice_excluded[inputIndex])
+                && (CalculateCoeffDisplacement(inputIndex) <= _coeff_tolerance))
+                _coeff_update[inputIndex] = false;
+    }
+    else {
+        //clear slice-volume matrix from previous iteration
+        _slice_coeffs.clear();
+        _slice_coeffs.resize(_slices.size());
+        _previous_transformations = _transformations;
+        _coeff_attributes = _reconstructed4D.GetImageAttributes();
+        _coeff_mask = _mask;
+        _coeff_quality_factor = _quality_factor;
+        _coeff_recon_type = _recon_type;
+    }
     _volcoeffs.clear();
-    _volcoeffs.resize(_slices.size());
 
-    //clear indicator of slice having and overlap with volumetric mask
-    _slice_inside.clear();
+    //indicator of slice having and overlap with volumetric mask,
+    //kept for slices whose coefficients are reused
     _slice_inside.resize(_slices.size());
 
+    for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
+        if (_coeff_update[inputIndex]) {
+            _previous_transformations[inputIndex] = _transformations[inputIndex];
+            nupdate++;
+        }
+    _coeff_excluded = _slice_excluded;
+
+    //compute PSFs of all slice voxel sizes before they are shared between threads
+    double dx, dy, dz;
+    for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
+        if (_coeff_update[inputIndex] && (_slice_excluded[inputIndex] == 0)) {
+            _slices[inputIndex].GetPixelSize(&dx, &dy, &dz);
+            GetPSF(dx, dy, dz);
+        }
+
     cout << "Initialising matrix coefficients...";
     cout.flush();
     ParallelCoeffInitCardiac4D coeffinit(this);
     coeffinit();
     cout << " ... done." << endl;
+    cout << "Recomputed coefficients of " << nupdate << " of " << _slices.size() << " slices." << endl;
+
+    //only recomputed slices count as processed
+    stage.AddSlices(nupdate);
+    if (_profile.IsOn())
+        stage.AddCoefficients(GetNumberOfCoefficients());
+
+    if (_debug) {
+        size_t memory = 0;
+        for (unsigned int s = 0; s < _slice_coeffs.size(); s++)
+            memory += _slice_coeffs[s].GetMemorySize();
+        cout << "Slice-to-volume coefficients use " << memory / 1048576.0 << " MB." << endl;
+    }
+
+    //voxel-major transpose for gather-based superresolution, which is
+    //also the deterministic one
+    if (_use_volume_coeffs || _deterministic) {
+        if (_debug)
+            cout << "Transposing coefficients ... ";
+        _volume_coeffs.Initialize(_slice_coeffs, _reconstructed4D.GetX() * _reconstructed4D.GetY() * _reconstructed4D.GetZ());
+        if (_debug)
+            cout << _volume_coeffs.GetMemorySize() / 1048576.0 << " MB." << endl;
+    }
+    else
+        _volume_coeffs.Clear();
 
     //prepare image for volume weights, will be needed for Gaussian Reconstruction
     cout << "Computing 4D volume weights..." << endl;
@@ -960,24 +1134,20 @@ void irtkReconstructionCardiac4D::CoeffInitCardiac4D()
     _volume_weights = 0;
 
     // TODO: investigate if this loop is taking a long time to compute, and consider parallelisation
-    int i, j, n, k, outputIndex;
-    unsigned int inputIndex;
-    POINT3D p;
+    int i, j, k;
+    int nvox = _reconstructed4D.GetX() * _reconstructed4D.GetY() * _reconstructed4D.GetZ();
+    irtkRealPixel *pw = _volume_weights.GetPointerToVoxels();
     cout << "    ... for input slice: ";
     for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
         cout << inputIndex << ", ";
         cout.flush();
-        for ( i = 0; i < _slices[inputIndex].GetX(); i++)
-            for ( j = 0; j < _slices[inputIndex].GetY(); j++) {
-                n = _volcoeffs[inputIndex][i][j].size();
-                for (k = 0; k < n; k++) {
-                  p = _volcoeffs[inputIndex][i][j][k];
-                  for (outputIndex=0; outputIndex<_reconstructed4D.GetT(); outputIndex++)
-                  {
-                      _volume_weights(p.x, p.y, p.z, outputIndex) += _slice_temporal_weight[outputIndex][inputIndex] * p.value;
-                  }
-                }
-            }
+        irtkSliceCoeffs& coeffs = _slice_coeffs[inputIndex];
+        vector<TEMPORALWEIGHT>& tweights = _slice_temporal_weight_list[inputIndex];
+        for (unsigned int t = 0; t < tweights.size(); t++) {
+            irtkRealPixel *pwt = pw + tweights[t].phase * nvox;
+            for (k = 0; k < coeffs.GetNumberOfCoeffs(); k++)
+                pwt[coeffs.Index(k)] += tweights[t].weight * coeffs.Value(k);
+        }
     }
     cout << "\b\b." << endl;
     // if (_debug)
@@ -1004,79 +1174,253 @@ void irtkReconstructionCardiac4D::CoeffInitCardiac4D()
 } 
 
 
+// -----------------------------------------------------------------------------
+// Parallel Gather of Slice Values for each Voxel
+// -----------------------------------------------------------------------------
+class ParallelSuperresolutionGatherCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+    irtkSlicePool<float> &error;
+    irtkSlicePool<float> &weight;
+    irtkRealPixel *addon;
+    irtkRealPixel *confidence_map;
+    //voxel (v,t) is at addon[v * vstride + t * tstride]
+    int vstride;
+    int tstride;
+
+public:
+    ParallelSuperresolutionGatherCardiac4D( irtkReconstructionCardiac4D *_reconstructor,
+                                            irtkSlicePool<float> &_error,
+                                            irtkSlicePool<float> &_weight,
+                                            irtkRealPixel *_addon,
+                                            irtkRealPixel *_confidence_map,
+                                            int _vstride,
+                                            int _tstride ) :
+        reconstructor(_reconstructor),
+        error(_error),
+        weight(_weight),
+        addon(_addon),
+        confidence_map(_confidence_map),
+        vstride(_vstride),
+        tstride(_tstride) { }
+
+    void operator() (const blocked_range<size_t> &r) const {
+        const irtkVolumeCoeffs& coeffs = reconstructor->_volume_coeffs;
+        const float *pe = error.GetPointerToVoxels();
+        const float *pw = weight.GetPointerToVoxels();
+
+        //each thread owns its range of output voxels, no reduction needed
+        for ( size_t v = r.begin(); v != r.end(); ++v ) {
+            irtkRealPixel *pa = addon + v * vstride;
+            irtkRealPixel *pc = confidence_map + v * vstride;
+            for ( int k = coeffs.Begin(v); k < coeffs.End(v); k++ ) {
+                int pixel = coeffs.Pixel(k);
+                if (pw[pixel] == 0)
+                    continue;
+                int inputIndex = coeffs.GetSlice(pixel);
+                double value = coeffs.Value(k) * pw[pixel];
+                const vector<TEMPORALWEIGHT>& tweights = reconstructor->_slice_temporal_weight_list[inputIndex];
+                for ( unsigned int t = 0; t < tweights.size(); t++ ) {
+                    double tw = tweights[t].weight * value;
+                    pa[tweights[t].phase * tstride] += tw * pe[pixel];
+                    pc[tweights[t].phase * tstride] += tw;
+                }
+            }
+        }
+    }
+
+    // execute
+    void operator() () const {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_for( blocked_range<size_t>(0, reconstructor->_volume_coeffs.GetNumberOfVoxels() ),
+                      *this );
+        init.terminate();
+    }
+
+};
+
+
+// -----------------------------------------------------------------------------
+// Parallel PSF-Weighted Reconstruction
+// -----------------------------------------------------------------------------
+class ParallelGaussianReconstructionCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+    vector<int> &voxel_num;
+public:
+    irtkRealImage reconstructed;
+
+    void operator()( const blocked_range<size_t>& r ) {
+        irtkRealPixel *pr = reconstructed.GetPointerToVoxels();
+        int nvox = reconstructed.GetX() * reconstructed.GetY() * reconstructed.GetZ();
+
+        for ( size_t inputIndex = r.begin(); inputIndex < r.end(); ++inputIndex ) {
+
+            if (reconstructor->_slice_excluded[inputIndex] != 0)
+                continue;
+
+            //copy the current slice
+            irtkRealImage slice = reconstructor->_slices[inputIndex];
+            //alias the current bias image
+            irtkRealImage& b = reconstructor->_bias[inputIndex];
+            //read current scale factor
+            double scale = reconstructor->_scale[inputIndex];
+            //alias the current slice coefficients
+            const irtkSliceCoeffs& coeffs = reconstructor->_slice_coeffs[inputIndex];
+            const vector<TEMPORALWEIGHT>& tweights = reconstructor->_slice_temporal_weight_list[inputIndex];
+
+            int slice_vox_num = 0;
+
+            //Distribute slice intensities to the volume
+            for (int i = 0; i < slice.GetX(); i++)
+                for (int j = 0; j < slice.GetY(); j++)
+                    if (slice(i, j, 0) != -1) {
+                        //biascorrect and scale the slice
+                        slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
+
+                        //calculate num of vox in a slice that have overlap with roi
+                        if (coeffs.GetNumberOfCoeffs(i, j) > 0)
+                            slice_vox_num++;
+
+                        //add contribution of current slice voxel to all voxel volumes
+                        //to which it contributes
+                        for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                            for (unsigned int t = 0; t < tweights.size(); t++)
+                            {
+                                pr[coeffs.Index(k) + tweights[t].phase * nvox] += tweights[t].weight * coeffs.Value(k) * slice(i, j, 0);
+                            }
+                        }
+                    }
+            voxel_num[inputIndex] = slice_vox_num;
+        }
+    }
+
+    ParallelGaussianReconstructionCardiac4D( ParallelGaussianReconstructionCardiac4D& x, split ) :
+        reconstructor(x.reconstructor),
+        voxel_num(x.voxel_num)
+    {
+        reconstructed.Initialize( reconstructor->_reconstructed4D.GetImageAttributes() );
+        reconstructed = 0;
+    }
+
+    void join( const ParallelGaussianReconstructionCardiac4D& y ) {
+        reconstructed += y.reconstructed;
+    }
+
+    ParallelGaussianReconstructionCardiac4D( irtkReconstructionCardiac4D *reconstructor, vector<int> &voxel_num ) :
+        reconstructor(reconstructor),
+        voxel_num(voxel_num)
+    {
+        reconstructed.Initialize( reconstructor->_reconstructed4D.GetImageAttributes() );
+        reconstructed = 0;
+    }
+
+    // execute
+    void operator() () {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_reduce( blocked_range<size_t>(0, reconstructor->_slices.size()),
+                         *this );
+        init.terminate();
+    }
+};
+
+
+// -----------------------------------------------------------------------------
+// Parallel PSF-Weighted Reconstruction: corrected slice intensities for gather
+// -----------------------------------------------------------------------------
+class ParallelGaussianReconstructionPixelsCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+    irtkSlicePool<float> &intensity;
+    irtkSlicePool<float> &weight;
+    vector<int> &voxel_num;
+
+public:
+    ParallelGaussianReconstructionPixelsCardiac4D( irtkReconstructionCardiac4D *_reconstructor,
+                                                   irtkSlicePool<float> &_intensity,
+                                                   irtkSlicePool<float> &_weight,
+                                                   vector<int> &_voxel_num ) :
+        reconstructor(_reconstructor),
+        intensity(_intensity),
+        weight(_weight),
+        voxel_num(_voxel_num) { }
+
+    void operator() (const blocked_range<size_t> &r) const {
+        for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
+            irtkRealImage& slice = reconstructor->_slices[inputIndex];
+            irtkRealImage& b = reconstructor->_bias[inputIndex];
+            double scale = reconstructor->_scale[inputIndex];
+            const irtkSliceCoeffs& coeffs = reconstructor->_slice_coeffs[inputIndex];
+            irtkSliceView<float> in = intensity.GetSlice(inputIndex);
+            irtkSliceView<float> w = weight.GetSlice(inputIndex);
+            int slice_vox_num = 0;
+
+            for ( int i = 0; i < slice.GetX(); i++ )
+                for ( int j = 0; j < slice.GetY(); j++ ) {
+                    if ((reconstructor->_slice_excluded[inputIndex] != 0) || (slice(i, j, 0) == -1)) {
+                        in(i, j) = 0;
+                        w(i, j) = 0;
+                        continue;
+                    }
+                    //biascorrect and scale the slice
+                    in(i, j) = slice(i, j, 0) * exp(-b(i, j, 0)) * scale;
+                    w(i, j) = 1;
+                    if (coeffs.GetNumberOfCoeffs(i, j) > 0)
+                        slice_vox_num++;
+                }
+            voxel_num[inputIndex] = slice_vox_num;
+        }
+    }
+
+    // execute
+    void operator() () const {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ),
+                      *this );
+        init.terminate();
+    }
+
+};
+
+
 // -----------------------------------------------------------------------------
 // PSF-Weighted Reconstruction
 // -----------------------------------------------------------------------------
 void irtkReconstructionCardiac4D::GaussianReconstructionCardiac4D()
 {
+    irtkReconstructionStage stage(_profile, "GaussianReconstruction", _slices.size());
+    if (_profile.IsOn())
+        stage.AddCoefficients(GetNumberOfCoefficients());
+
     if(_debug)
     {
       cout << "Gaussian reconstruction ... " << endl;
-      cout << "\tinput slice:  ";
-      cout.flush();
     }
-    unsigned int inputIndex, outputIndex;
-    int k, n;
-    irtkRealImage slice;
-    double scale;
-    POINT3D p;
+    unsigned int inputIndex;
     vector<int> voxel_num;  
-    int slice_vox_num;
-
-    //clear _reconstructed image
-    _reconstructed4D = 0;
-
-    for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
-        
-      if (_slice_excluded[inputIndex]==0) {
-      
-        if(_debug)
-        {
-          cout << inputIndex << ", ";
-          cout.flush();
-        }
-        //copy the current slice
-        slice = _slices[inputIndex];
-        //alias the current bias image
-        irtkRealImage& b = _bias[inputIndex];
-        //read current scale factor
-        scale = _scale[inputIndex];
-        
-        slice_vox_num=0;
-
-        //Distribute slice intensities to the volume
-        for (int i = 0; i < slice.GetX(); i++)
-            for (int j = 0; j < slice.GetY(); j++)
-                if (slice(i, j, 0) != -1) {
-                    //biascorrect and scale the slice
-                    slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
-
-                    //number of volume voxels with non-zero coefficients
-                    //for current slice voxel
-                    n = _volcoeffs[inputIndex][i][j].size();
-
-                    //if given voxel is not present in reconstructed volume at all,
-                    //pad it
-                    
-                    //if (n == 0)
-                    //_slices[inputIndex].PutAsDouble(i, j, 0, -1);
-                    //calculate num of vox in a slice that have overlap with roi
-                    if (n>0)
-                        slice_vox_num++;
+    vector<int> slice_voxel_num(_slices.size(), 0);
+
+    if (!_volume_coeffs.IsEmpty()) {
+        //gather over output voxels using the voxel-major coefficients,
+        //each voxel sums its contributions in a fixed order
+        irtkSlicePool<float> intensity, weight;
+        intensity.Initialize( _slices );
+        weight.Initialize( _slices );
+        ParallelGaussianReconstructionPixelsCardiac4D parallelPixels( this, intensity, weight, slice_voxel_num );
+        parallelPixels();
+
+        irtkRealImage volume_weights( _reconstructed4D.GetImageAttributes() );
+        _reconstructed4D = 0;
+        ParallelSuperresolutionGatherCardiac4D parallelGather( this, intensity, weight,
+            _reconstructed4D.GetPointerToVoxels(), volume_weights.GetPointerToVoxels(), 1, _volume_coeffs.GetNumberOfVoxels() );
+        parallelGather();
+    }
+    else {
+        ParallelGaussianReconstructionCardiac4D parallelGaussianReconstruction( this, slice_voxel_num );
+        parallelGaussianReconstruction();
+        _reconstructed4D = parallelGaussianReconstruction.reconstructed;
+    }
 
-                    //add contribution of current slice voxel to all voxel volumes
-                    //to which it contributes
-                    for (k = 0; k < n; k++) {
-                        p = _volcoeffs[inputIndex][i][j][k];
-                        for (outputIndex=0; outputIndex<_reconstructed_cardiac_phases.size(); outputIndex++)
-                        {
-                            _reconstructed4D(p.x, p.y, p.z, outputIndex) += _slice_temporal_weight[outputIndex][inputIndex] * p.value * slice(i, j, 0);
-                        }
-                    }
-                }
-        voxel_num.push_back(slice_vox_num);
-      } //end of if (_slice_excluded[inputIndex]==0)
-    } //end of loop for a slice inputIndex
+    for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex)
+        if (_slice_excluded[inputIndex]==0)
+            voxel_num.push_back(slice_voxel_num[inputIndex]);
 
     //normalize the volume by proportion of contributing slice voxels
     //for each volume voxe
@@ -1084,7 +1428,6 @@ void irtkReconstructionCardiac4D::GaussianReconstructionCardiac4D()
     
     if(_debug)
     {
-      cout << inputIndex << "\b\b." << endl;
       cout << "... Gaussian reconstruction done." << endl << endl;
       cout.flush();
     }    
@@ -1118,6 +1461,59 @@ void irtkReconstructionCardiac4D::GaussianReconstructionCardiac4D()
 }
 
 
+// -----------------------------------------------------------------------------
+// Parallel Scale Volume
+// -----------------------------------------------------------------------------
+class ParallelScaleVolumeCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+    vector<double> &scalenum;
+    vector<double> &scaleden;
+
+public:
+    ParallelScaleVolumeCardiac4D( irtkReconstructionCardiac4D *_reconstructor,
+                                  vector<double> &_scalenum,
+                                  vector<double> &_scaleden ) :
+        reconstructor(_reconstructor),
+        scalenum(_scalenum),
+        scaleden(_scaleden) { }
+
+    void operator() (const blocked_range<size_t> &r) const {
+        for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
+            // alias for the current slice
+            irtkRealImage& slice = reconstructor->_slices[inputIndex];
+
+            //alias for the current weight image
+            irtkRealImage& w = reconstructor->_weights[inputIndex];
+
+            // alias for the current simulated slice
+            irtkRealImage& sim = reconstructor->_simulated_slices[inputIndex];
+
+            double num = 0, den = 0;
+            for (int i = 0; i < slice.GetX(); i++)
+                for (int j = 0; j < slice.GetY(); j++)
+                    if (slice(i, j, 0) != -1) {
+                        //scale - intensity matching
+                        if ( reconstructor->_simulated_weights[inputIndex](i,j,0) > 0.99 ) {
+                            num += w(i, j, 0) * reconstructor->_slice_weight[inputIndex] * slice(i, j, 0) * sim(i, j, 0);
+                            den += w(i, j, 0) * reconstructor->_slice_weight[inputIndex] * sim(i, j, 0) * sim(i, j, 0);
+                        }
+                    }
+            scalenum[inputIndex] = num;
+            scaleden[inputIndex] = den;
+        }
+    }
+
+    // execute
+    void operator() () const {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ),
+                      *this );
+        init.terminate();
+    }
+
+};
+
+
 // -----------------------------------------------------------------------------
 // Scale Volume
 // -----------------------------------------------------------------------------
@@ -1127,29 +1523,17 @@ void irtkReconstructionCardiac4D::ScaleVolumeCardiac4D()
         cout << "Scaling volume: ";
     
     unsigned int inputIndex;
-    int i, j;
+    int i;
     double scalenum = 0, scaleden = 0;
 
+    //per-slice sums are added in slice order, independent of scheduling
+    vector<double> slice_scalenum(_slices.size()), slice_scaleden(_slices.size());
+    ParallelScaleVolumeCardiac4D parallelScaleVolume( this, slice_scalenum, slice_scaleden );
+    parallelScaleVolume();
     for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-        // alias for the current slice
-        irtkRealImage& slice = _slices[inputIndex];
-
-        //alias for the current weight image
-        irtkRealImage& w = _weights[inputIndex];
-
-        // alias for the current simulated slice
-        irtkRealImage& sim = _simulated_slices[inputIndex];
-        
-        for (i = 0; i < slice.GetX(); i++)
-            for (j = 0; j < slice.GetY(); j++)
-                if (slice(i, j, 0) != -1) {
-                    //scale - intensity matching
-                    if ( _simulated_weights[inputIndex](i,j,0) > 0.99 ) {
-                        scalenum += w(i, j, 0) * _slice_weight[inputIndex] * slice(i, j, 0) * sim(i, j, 0);
-                        scaleden += w(i, j, 0) * _slice_weight[inputIndex] * sim(i, j, 0) * sim(i, j, 0);
-                    }
-                }
-    } //end of loop for a slice inputIndex
+        scalenum += slice_scalenum[inputIndex];
+        scaleden += slice_scaleden[inputIndex];
+    }
     
     //calculate scale for the volume
     double scale = scalenum / scaleden;
@@ -1200,7 +1584,560 @@ public:
             
         } //end of loop for a slice inputIndex    
     }
-    
+    
+    // execute
+    void operator() () const {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ),
+                      *this );
+        init.terminate();
+    }
+
+};
+
+
+// -----------------------------------------------------------------------------
+// Calculate Corrected Slices
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::CalculateCorrectedSlices()
+{
+  if (_debug)
+      cout<<"Calculating corrected slices..."<<endl;
+
+  ParallelCalculateCorrectedSlices parallelCalculateCorrectedSlices( this );
+  parallelCalculateCorrectedSlices();
+
+  if (_debug)
+      cout<<"\t...calculating corrected slices done."<<endl;   
+}
+
+
+// -----------------------------------------------------------------------------
+// Number of Coefficients
+// -----------------------------------------------------------------------------
+double irtkReconstructionCardiac4D::GetNumberOfCoefficients()
+{
+    //each coefficient is visited once for every phase with a temporal weight
+    double n = 0;
+    for (unsigned int inputIndex = 0; inputIndex < _slice_coeffs.size(); inputIndex++) {
+        double phases = 1;
+        if (inputIndex < _slice_temporal_weight_list.size())
+            phases = _slice_temporal_weight_list[inputIndex].size();
+        n += phases * _slice_coeffs[inputIndex].GetNumberOfCoeffs();
+    }
+    return n;
+}
+
+
+// -----------------------------------------------------------------------------
+// Parallel Simulate Slices
+// -----------------------------------------------------------------------------
+class ParallelSimulateSlicesCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+        
+public:
+    ParallelSimulateSlicesCardiac4D( irtkReconstructionCardiac4D *_reconstructor ) : 
+    reconstructor(_reconstructor) { }
+
+    void operator() (const blocked_range<size_t> &r) const {
+        for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
+            //Calculate simulated slice in the pools, which are set to zero
+            irtkSliceView<float> sim = reconstructor->_simulated_slice_pool.GetSlice(inputIndex);
+            irtkSliceView<float> simw = reconstructor->_simulated_weight_pool.GetSlice(inputIndex);
+
+            reconstructor->_simulated_inside[inputIndex].Initialize( reconstructor->_slices[inputIndex].GetImageAttributes() );
+            reconstructor->_simulated_inside[inputIndex] = 0;            
+
+            reconstructor->_slice_inside[inputIndex] = false;
+            
+            const irtkSliceCoeffs& coeffs = reconstructor->_slice_coeffs[inputIndex];
+            const irtkRealPixel *pm = reconstructor->_mask.GetPointerToVoxels();
+            const vector<TEMPORALWEIGHT>& tweights = reconstructor->_slice_temporal_weight_list[inputIndex];
+
+            //voxel (index,t) is at pr[index * vstride + t * tstride]
+            const irtkRealPixel *pr;
+            int vstride, tstride;
+            if (reconstructor->_use_interleaved) {
+                pr = reconstructor->_reconstructed4D_interleaved.GetPointerToVoxels();
+                vstride = reconstructor->_reconstructed4D.GetT();
+                tstride = 1;
+            }
+            else {
+                pr = reconstructor->_reconstructed4D.GetPointerToVoxels();
+                vstride = 1;
+                tstride = reconstructor->_reconstructed4D.GetX() * reconstructor->_reconstructed4D.GetY() * reconstructor->_reconstructed4D.GetZ();
+            }
+            for ( int i = 0; i < reconstructor->_slices[inputIndex].GetX(); i++ )
+                for ( int j = 0; j < reconstructor->_slices[inputIndex].GetY(); j++ )
+                    if ( reconstructor->_slices[inputIndex](i, j, 0) != -1 ) {
+                        double value = 0, weight = 0;
+                        for ( int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++ ) {
+                            int index = coeffs.Index(k);
+                            double c = coeffs.Value(k);
+                            const irtkRealPixel *prv = pr + index * vstride;
+                            for ( unsigned int t = 0; t < tweights.size(); t++ ) {
+                                value += tweights[t].weight * c * prv[tweights[t].phase * tstride];
+                                weight += tweights[t].weight * c;
+                            }
+                            if (pm[index] == 1) {
+                                reconstructor->_simulated_inside[inputIndex](i, j, 0) = 1;
+                                reconstructor->_slice_inside[inputIndex] = true;
+                            }
+                        }                    
+                        if( weight > 0 ) {
+                            sim(i, j) = value / weight;
+                            simw(i, j) = weight;
+                        }
+                    }
+
+            reconstructor->_simulated_slice_pool.Export(inputIndex, reconstructor->_simulated_slices[inputIndex]);
+            reconstructor->_simulated_weight_pool.Export(inputIndex, reconstructor->_simulated_weights[inputIndex]);
+        }
+    }
+    
+    // execute
+    void operator() () const {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ),
+                      *this );
+        init.terminate();
+    }
+
+};
+
+
+// -----------------------------------------------------------------------------
+// Simulate Slices
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::SimulateSlicesCardiac4D()
+{
+  irtkReconstructionStage stage(_profile, "Simulate", _slices.size());
+  if (_profile.IsOn())
+      stage.AddCoefficients(GetNumberOfCoefficients());
+
+  if (_debug)
+      cout<<"Simulating Slices..."<<endl;
+
+  //all phases of a voxel are read together
+  if (_use_interleaved)
+      _reconstructed4D_interleaved.Import(_reconstructed4D);
+
+  //simulation may precede InitializeEM, so the pools are allocated here
+  _simulated_slice_pool.Initialize( _slices );
+  _simulated_weight_pool.Initialize( _slices );
+
+  ParallelSimulateSlicesCardiac4D parallelSimulateSlices( this );
+  parallelSimulateSlices();
+
+  if (_debug)
+      cout<<"\t...Simulating Slices done."<<endl;   
+}
+
+
+// -----------------------------------------------------------------------------
+// Parallel Simulate Slices and M-step sums in one pass
+// -----------------------------------------------------------------------------
+class ParallelSimulateSlicesRobustStatisticsCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+    bool robust_statistics;
+    vector<double> &slice_sigma;
+    vector<double> &slice_mix;
+    vector<double> &slice_num;
+    vector<double> &slice_min;
+    vector<double> &slice_max;
+
+public:
+    ParallelSimulateSlicesRobustStatisticsCardiac4D( irtkReconstructionCardiac4D *_reconstructor,
+                                                     bool _robust_statistics,
+                                                     vector<double> &_slice_sigma,
+                                                     vector<double> &_slice_mix,
+                                                     vector<double> &_slice_num,
+                                                     vector<double> &_slice_min,
+                                                     vector<double> &_slice_max ) :
+    reconstructor(_reconstructor),
+    robust_statistics(_robust_statistics),
+    slice_sigma(_slice_sigma),
+    slice_mix(_slice_mix),
+    slice_num(_slice_num),
+    slice_min(_slice_min),
+    slice_max(_slice_max) { }
+
+    void operator() (const blocked_range<size_t> &r) const {
+        for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
+            const irtkImageAttributes& attr = reconstructor->_slice_pool.GetImageAttributes(inputIndex);
+            const int nx = attr._x;
+            const int ny = attr._y;
+
+            //error is only materialized for debugging output
+            float *perr = NULL;
+            if (reconstructor->_debug) {
+                reconstructor->_error[inputIndex].Initialize( attr );
+                perr = reconstructor->_error[inputIndex].GetPointerToVoxels();
+            }
+
+            //contiguous voxel buffers of the slice in the pools
+            const float *ps = reconstructor->_slice_pool.GetPointerToVoxels(inputIndex);
+            const float *pb = reconstructor->_bias_pool.GetPointerToVoxels(inputIndex);
+            const float *pw = reconstructor->_weight_pool.GetPointerToVoxels(inputIndex);
+            float *psim = reconstructor->_simulated_slice_pool.GetPointerToVoxels(inputIndex);
+            float *psw = reconstructor->_simulated_weight_pool.GetPointerToVoxels(inputIndex);
+            const double scale = reconstructor->_scale[inputIndex];
+
+            const irtkSliceCoeffs& coeffs = reconstructor->_slice_coeffs[inputIndex];
+            const irtkRealPixel *pm = reconstructor->_mask.GetPointerToVoxels();
+            const vector<TEMPORALWEIGHT>& tweights = reconstructor->_slice_temporal_weight_list[inputIndex];
+
+            //voxel (index,t) is at pr[index * vstride + t * tstride]
+            const irtkRealPixel *pr;
+            int vstride, tstride;
+            if (reconstructor->_use_interleaved) {
+                pr = reconstructor->_reconstructed4D_interleaved.GetPointerToVoxels();
+                vstride = reconstructor->_reconstructed4D.GetT();
+                tstride = 1;
+            }
+            else {
+                pr = reconstructor->_reconstructed4D.GetPointerToVoxels();
+                vstride = 1;
+                tstride = reconstructor->_reconstructed4D.GetX() * reconstructor->_reconstructed4D.GetY() * reconstructor->_reconstructed4D.GetZ();
+            }
+
+            bool inside = false;
+            double sigma = 0, mix = 0, num = 0;
+            double min = voxel_limits<irtkRealPixel>::max();
+            double max = voxel_limits<irtkRealPixel>::min();
+
+            for ( int j = 0; j < ny; j++ )
+                for ( int i = 0; i < nx; i++ ) {
+                    const int p = j * nx + i;
+                    double value = 0, weight = 0;
+                    if ( ps[p] != -1 ) {
+                        for ( int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++ ) {
+                            int index = coeffs.Index(k);
+                            double c = coeffs.Value(k);
+                            const irtkRealPixel *prv = pr + index * vstride;
+                            for ( unsigned int t = 0; t < tweights.size(); t++ ) {
+                                value += tweights[t].weight * c * prv[tweights[t].phase * tstride];
+                                weight += tweights[t].weight * c;
+                            }
+                            if (pm[index] == 1)
+                                inside = true;
+                        }
+                        if ( weight > 0 )
+                            value /= weight;
+                        else
+                            value = weight = 0;
+                    }
+                    psim[p] = value;
+                    psw[p] = weight;
+
+                    //bias correct and scale the voxel, subtract simulated voxel
+                    if ( robust_statistics || (perr != NULL) ) {
+                        double e = ps[p] * exp(-pb[p]) * scale - value;
+
+                        //M-step sums where the simulated slice is fully covered
+                        if ( (ps[p] != -1) && (weight > 0.99) ) {
+                            sigma += e * e * pw[p];
+                            mix += pw[p];
+                            num++;
+                            if (e < min) min = e;
+                            if (e > max) max = e;
+                        }
+
+                        if (perr != NULL)
+                            perr[p] = ( (ps[p] != -1) && (weight > 0) ) ? e : 0;
+                    }
+                }
+
+            reconstructor->_simulated_slice_pool.Export(inputIndex, reconstructor->_simulated_slices[inputIndex]);
+            reconstructor->_simulated_weight_pool.Export(inputIndex, reconstructor->_simulated_weights[inputIndex]);
+
+            reconstructor->_slice_inside[inputIndex] = inside;
+            slice_sigma[inputIndex] = sigma;
+            slice_mix[inputIndex] = mix;
+            slice_num[inputIndex] = num;
+            slice_min[inputIndex] = min;
+            slice_max[inputIndex] = max;
+        }
+    }
+
+    // execute
+    void operator() () const {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ),
+                      *this );
+        init.terminate();
+    }
+
+};
+
+
+// -----------------------------------------------------------------------------
+// Simulate Slices and Robust Statistics
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::SimulateSlicesRobustStatisticsCardiac4D(int iter, bool robust_statistics)
+{
+  if (_debug)
+      cout<<"Simulating Slices and Robust Statistics..."<<endl;
+
+  //all phases of a voxel are read together
+  if (_use_interleaved)
+      _reconstructed4D_interleaved.Import(_reconstructed4D);
+
+  UpdateSlicePools();
+
+  vector<double> slice_sigma(_slices.size()), slice_mix(_slices.size()), slice_num(_slices.size());
+  vector<double> slice_min(_slices.size()), slice_max(_slices.size());
+  {
+      irtkReconstructionStage stage(_profile, "Simulate", _slices.size());
+      if (_profile.IsOn())
+          stage.AddCoefficients(GetNumberOfCoefficients());
+
+      ParallelSimulateSlicesRobustStatisticsCardiac4D parallelSimulateSlices( this, robust_statistics, slice_sigma, slice_mix, slice_num, slice_min, slice_max );
+      parallelSimulateSlices();
+  }
+
+  if (robust_statistics) {
+      //M-step from the sums gathered during simulation
+      {
+          irtkReconstructionStage stage(_profile, "MStep", _slices.size());
+          MStepParameters(iter, slice_sigma, slice_mix, slice_num, slice_min, slice_max);
+      }
+
+      //E-step needs the reduced M-step parameters, it is a pixel-wise pass only
+      EStep();
+  }
+
+  if (_debug)
+      cout<<"\t...Simulating Slices and Robust Statistics done."<<endl;
+}
+
+
+// -----------------------------------------------------------------------------
+// Slice Pools
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::UpdateSlicePools()
+{
+    //slices created or removed since the last import also invalidate the pools
+    if (_slice_pools_valid && (_slice_pool.GetNumberOfSlices() == (int)_slices.size()))
+        return;
+
+    _slice_pool.Import(_slices);
+    _bias_pool.Import(_bias);
+    _weight_pool.Import(_weights);
+    _simulated_slice_pool.Import(_simulated_slices);
+    _simulated_weight_pool.Import(_simulated_weights);
+    _slice_pools_valid = true;
+}
+
+void irtkReconstructionCardiac4D::InvalidateSlicePools()
+{
+    _slice_pools_valid = false;
+}
+
+
+// -----------------------------------------------------------------------------
+// Mask Slices
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::MaskSlices()
+{
+    irtkReconstruction::MaskSlices();
+    InvalidateSlicePools();
+}
+
+
+// -----------------------------------------------------------------------------
+// Initialise EM
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::InitializeEM()
+{
+    irtkReconstruction::InitializeEM();
+    InvalidateSlicePools();
+}
+
+
+// -----------------------------------------------------------------------------
+// Initialise EM Values
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::InitializeEMValues()
+{
+    irtkReconstruction::InitializeEMValues();
+    InvalidateSlicePools();
+}
+
+
+// -----------------------------------------------------------------------------
+// Restore Slice Intensities
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::RestoreSliceIntensities()
+{
+    irtkReconstruction::RestoreSliceIntensities();
+    InvalidateSlicePools();
+}
+
+
+// -----------------------------------------------------------------------------
+// Parallel E-step: voxel weights and slice potentials
+// -----------------------------------------------------------------------------
+class ParallelEStepCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+    vector<double> &slice_potential;
+
+public:
+    ParallelEStepCardiac4D( irtkReconstructionCardiac4D *_reconstructor,
+                            vector<double> &_slice_potential ) :
+        reconstructor(_reconstructor),
+        slice_potential(_slice_potential) { }
+
+    void operator() (const blocked_range<size_t> &r) const {
+        // parameters of the voxel-wise robust statistics
+        const double mix = reconstructor->_mix;
+        const double gnorm = reconstructor->_step / sqrt(6.28 * reconstructor->_sigma);
+        const double gexp = -1.0 / (2 * reconstructor->_sigma);
+        const double outlier = reconstructor->M(reconstructor->_m) * (1 - mix);
+
+        for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
+            //contiguous voxel buffers of the slice in the pools
+            const float *ps = reconstructor->_slice_pool.GetPointerToVoxels(inputIndex);
+            const float *pb = reconstructor->_bias_pool.GetPointerToVoxels(inputIndex);
+            const float *psim = reconstructor->_simulated_slice_pool.GetPointerToVoxels(inputIndex);
+            const float *psw = reconstructor->_simulated_weight_pool.GetPointerToVoxels(inputIndex);
+            float *pw = reconstructor->_weight_pool.GetPointerToVoxels(inputIndex);
+            const int n = reconstructor->_slice_pool.GetNumberOfVoxels(inputIndex);
+
+            //identify scale factor
+            const double scale = reconstructor->_scale[inputIndex];
+
+            //as in irtkReconstruction::EStep, padded voxels and voxels
+            //without coefficients get zero weight
+            double potential = 0, num = 0;
+            for ( int i = 0; i < n; i++ ) {
+                //bias correct and scale the slice, subtract simulated slice
+                double e = ps[i] * exp(-pb[i]) * scale - psim[i];
+
+                //Gaussian distribution for inliers (likelihood)
+                double g = gnorm * exp(e * e * gexp);
+
+                //voxel_wise posterior
+                double weight = g * mix / (g * mix + outlier);
+                bool valid = (ps[i] != -1) && (psw[i] > 0);
+                weight = valid ? weight : 0;
+                pw[i] = weight;
+
+                //calculate slice potentials
+                double inside = (valid && (psw[i] > 0.99)) ? 1 : 0;
+                potential += inside * (1 - weight) * (1 - weight);
+                num += inside;
+            }
+
+            //evaluate slice potential
+            if (num > 0)
+                slice_potential[inputIndex] = sqrt(potential / num);
+            else
+                slice_potential[inputIndex] = -1; // slice has no unpadded voxels
+
+            reconstructor->_weight_pool.Export(inputIndex, reconstructor->_weights[inputIndex]);
+        }
+    }
+
+    // execute
+    void operator() () const {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ),
+                      *this );
+        init.terminate();
+    }
+
+};
+
+
+// -----------------------------------------------------------------------------
+// E-step
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::EStep()
+{
+    irtkReconstructionStage stage(_profile, "EStep", _slices.size());
+
+    if (_debug)
+        cout << "EStep: " << endl;
+
+    UpdateSlicePools();
+
+    vector<double> slice_potential(_slices.size(), 0);
+
+    ParallelEStepCardiac4D parallelEStep( this, slice_potential );
+    parallelEStep();
+
+    EStepParameters(slice_potential);
+}
+
+
+// -----------------------------------------------------------------------------
+// Parallel M-step: per-slice sums of the voxel-wise robust statistics
+// -----------------------------------------------------------------------------
+class ParallelMStepCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+    vector<double> &slice_sigma;
+    vector<double> &slice_mix;
+    vector<double> &slice_num;
+    vector<double> &slice_min;
+    vector<double> &slice_max;
+
+public:
+    ParallelMStepCardiac4D( irtkReconstructionCardiac4D *_reconstructor,
+                            vector<double> &_slice_sigma,
+                            vector<double> &_slice_mix,
+                            vector<double> &_slice_num,
+                            vector<double> &_slice_min,
+                            vector<double> &_slice_max ) :
+        reconstructor(_reconstructor),
+        slice_sigma(_slice_sigma),
+        slice_mix(_slice_mix),
+        slice_num(_slice_num),
+        slice_min(_slice_min),
+        slice_max(_slice_max) { }
+
+    void operator() (const blocked_range<size_t> &r) const {
+        for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
+            //contiguous voxel buffers of the slice in the pools
+            const float *ps = reconstructor->_slice_pool.GetPointerToVoxels(inputIndex);
+            const float *pb = reconstructor->_bias_pool.GetPointerToVoxels(inputIndex);
+            const float *psim = reconstructor->_simulated_slice_pool.GetPointerToVoxels(inputIndex);
+            const float *psw = reconstructor->_simulated_weight_pool.GetPointerToVoxels(inputIndex);
+            const float *pw = reconstructor->_weight_pool.GetPointerToVoxels(inputIndex);
+            const int n = reconstructor->_slice_pool.GetNumberOfVoxels(inputIndex);
+
+            //identify scale factor
+            const double scale = reconstructor->_scale[inputIndex];
+
+            double sigma = 0, mix = 0, num = 0;
+            double min = voxel_limits<irtkRealPixel>::max();
+            double max = voxel_limits<irtkRealPixel>::min();
+
+            //error only where the simulated slice is fully covered
+            for ( int i = 0; i < n; i++ ) {
+                double e = ps[i] * exp(-pb[i]) * scale - psim[i];
+                bool valid = (ps[i] != -1) && (psw[i] > 0.99);
+
+                //sigma and mix
+                sigma += valid ? e * e * pw[i] : 0;
+                mix += valid ? pw[i] : 0;
+                num += valid ? 1 : 0;
+
+                //_m
+                double emin = valid ? e : min;
+                double emax = valid ? e : max;
+                min = (emin < min) ? emin : min;
+                max = (emax > max) ? emax : max;
+            }
+
+            slice_sigma[inputIndex] = sigma;
+            slice_mix[inputIndex] = mix;
+            slice_num[inputIndex] = num;
+            slice_min[inputIndex] = min;
+            slice_max[inputIndex] = max;
+        }
+    }
+
     // execute
     void operator() () const {
         task_scheduler_init init(tbb_no_threads);
@@ -1213,71 +2150,65 @@ public:
 
 
 // -----------------------------------------------------------------------------
-// Calculate Corrected Slices
+// M-step
 // -----------------------------------------------------------------------------
-void irtkReconstructionCardiac4D::CalculateCorrectedSlices()
+void irtkReconstructionCardiac4D::MStep(int iter)
 {
-  if (_debug)
-      cout<<"Calculating corrected slices..."<<endl;
+    irtkReconstructionStage stage(_profile, "MStep", _slices.size());
 
-  ParallelCalculateCorrectedSlices parallelCalculateCorrectedSlices( this );
-  parallelCalculateCorrectedSlices();
+    if (_debug)
+        cout << "MStep" << endl;
 
-  if (_debug)
-      cout<<"\t...calculating corrected slices done."<<endl;   
+    UpdateSlicePools();
+
+    vector<double> slice_sigma(_slices.size()), slice_mix(_slices.size()), slice_num(_slices.size());
+    vector<double> slice_min(_slices.size()), slice_max(_slices.size());
+    ParallelMStepCardiac4D parallelMStep( this, slice_sigma, slice_mix, slice_num, slice_min, slice_max );
+    parallelMStep();
+
+    MStepParameters(iter, slice_sigma, slice_mix, slice_num, slice_min, slice_max);
 }
 
 
 // -----------------------------------------------------------------------------
-// Parallel Simulate Slices
+// Parallel Scale: intensity matching of the slices to the simulated slices
 // -----------------------------------------------------------------------------
-class ParallelSimulateSlicesCardiac4D {
+class ParallelScaleCardiac4D {
     irtkReconstructionCardiac4D *reconstructor;
-        
+
 public:
-    ParallelSimulateSlicesCardiac4D( irtkReconstructionCardiac4D *_reconstructor ) : 
-    reconstructor(_reconstructor) { }
+    ParallelScaleCardiac4D( irtkReconstructionCardiac4D *_reconstructor ) :
+        reconstructor(_reconstructor) { }
 
     void operator() (const blocked_range<size_t> &r) const {
         for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
-            //Calculate simulated slice
-            reconstructor->_simulated_slices[inputIndex].Initialize( reconstructor->_slices[inputIndex].GetImageAttributes() );
-            reconstructor->_simulated_slices[inputIndex] = 0;
-
-            reconstructor->_simulated_weights[inputIndex].Initialize( reconstructor->_slices[inputIndex].GetImageAttributes() );
-            reconstructor->_simulated_weights[inputIndex] = 0;
-
-            reconstructor->_simulated_inside[inputIndex].Initialize( reconstructor->_slices[inputIndex].GetImageAttributes() );
-            reconstructor->_simulated_inside[inputIndex] = 0;            
+            //contiguous voxel buffers of the slice in the pools
+            const float *ps = reconstructor->_slice_pool.GetPointerToVoxels(inputIndex);
+            const float *pb = reconstructor->_bias_pool.GetPointerToVoxels(inputIndex);
+            const float *psim = reconstructor->_simulated_slice_pool.GetPointerToVoxels(inputIndex);
+            const float *psw = reconstructor->_simulated_weight_pool.GetPointerToVoxels(inputIndex);
+            const float *pw = reconstructor->_weight_pool.GetPointerToVoxels(inputIndex);
+            const int n = reconstructor->_slice_pool.GetNumberOfVoxels(inputIndex);
+
+            //initialise calculation of scale
+            double scalenum = 0;
+            double scaleden = 0;
+
+            for ( int i = 0; i < n; i++ ) {
+                bool valid = (ps[i] != -1) && (psw[i] > 0.99);
+                double eb = exp(-pb[i]);
+                scalenum += valid ? pw[i] * ps[i] * eb * psim[i] : 0;
+                scaleden += valid ? pw[i] * ps[i] * eb * ps[i] * eb : 0;
+            }
 
-            reconstructor->_slice_inside[inputIndex] = false;
-            
-            POINT3D p;
-            for ( int i = 0; i < reconstructor->_slices[inputIndex].GetX(); i++ )
-                for ( int j = 0; j < reconstructor->_slices[inputIndex].GetY(); j++ )
-                    if ( reconstructor->_slices[inputIndex](i, j, 0) != -1 ) {
-                        double weight = 0;
-                        int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-                        for ( int k = 0; k < n; k++ ) {
-                            p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                            for ( int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++ ) {
-                                reconstructor->_simulated_slices[inputIndex](i, j, 0) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * reconstructor->_reconstructed4D(p.x, p.y, p.z, outputIndex);
-                                weight += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
-                            }
-                            if (reconstructor->_mask(p.x, p.y, p.z) == 1) {
-                                reconstructor->_simulated_inside[inputIndex](i, j, 0) = 1;
-                                reconstructor->_slice_inside[inputIndex] = true;
-                            }
-                        }                    
-                        if( weight > 0 ) {
-                            reconstructor->_simulated_slices[inputIndex](i,j,0) /= weight;
-                            reconstructor->_simulated_weights[inputIndex](i,j,0) = weight;
-                        }
-                    }
-            
+            //calculate scale for this slice
+            if (scaleden > 0)
+                reconstructor->_scale[inputIndex] = scalenum / scaleden;
+            else
+                reconstructor->_scale[inputIndex] = 1;
         }
     }
-    
+
     // execute
     void operator() () const {
         task_scheduler_init init(tbb_no_threads);
@@ -1290,18 +2221,36 @@ public:
 
 
 // -----------------------------------------------------------------------------
-// Simulate Slices
+// Scale
 // -----------------------------------------------------------------------------
-void irtkReconstructionCardiac4D::SimulateSlicesCardiac4D()
+void irtkReconstructionCardiac4D::Scale()
 {
-  if (_debug)
-      cout<<"Simulating Slices..."<<endl;
+    if (_debug)
+        cout << "Scale" << endl;
 
-  ParallelSimulateSlicesCardiac4D parallelSimulateSlices( this );
-  parallelSimulateSlices();
+    UpdateSlicePools();
 
-  if (_debug)
-      cout<<"\t...Simulating Slices done."<<endl;   
+    ParallelScaleCardiac4D parallelScale( this );
+    parallelScale();
+
+    if (_debug) {
+        cout << setprecision(3);
+        cout << "Slice scale = ";
+        for (unsigned int inputIndex = 0; inputIndex < _slices.size(); ++inputIndex)
+            cout << _scale[inputIndex] << " ";
+        cout << endl;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// Bias
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::Bias()
+{
+    //the bias fields are smoothed as images
+    irtkReconstruction::Bias();
+    InvalidateSlicePools();
 }
 
 
@@ -1324,298 +2273,35 @@ public:
             cout << inputIndex << " ";
             cout.flush();
 
-            //get resolution of the volume
-            double vx, vy, vz;
-            reconstructor->_reconstructed4D.GetPixelSize(&vx, &vy, &vz);
-            //volume is always isotropic
-            double res = vx;
-            //read the slice
-            irtkRealImage& slice = reconstructor->_slices[inputIndex];
+            //coefficients of the slice with the cached PSF, only kept while
+            //the slice is simulated
+            irtkSliceCoeffs slicecoeffs;
+            reconstructor->SliceCoeffsCardiac4D(inputIndex, slicecoeffs);
 
-            //prepare structures for storage
-            POINT3D p;
-            VOXELCOEFFS empty;
-            SLICECOEFFS slicecoeffs(slice.GetX(), vector < VOXELCOEFFS > (slice.GetY(), empty));
-            
-            //PSF will be calculated in slice space in higher resolution
-
-            //get slice voxel size to define PSF
-            double dx, dy, dz;
-            slice.GetPixelSize(&dx, &dy, &dz);
-
-            //sigma of 3D Gaussian (sinc with FWHM=dx or dy in-plane, Gaussian with FWHM = dz through-plane)
-	    
-      			double sigmax, sigmay, sigmaz;
-      			if(reconstructor->_recon_type == _3D)
-      			{
-      				  sigmax = 1.2 * dx / 2.3548;
-      				  sigmay = 1.2 * dy / 2.3548;
-      				  sigmaz = dz / 2.3548;
-      			}
-      	
-      			if(reconstructor->_recon_type == _1D)
-      			{
-      				  sigmax = 0.5 * dx / 2.3548;
-      				  sigmay = 0.5 * dy / 2.3548;
-      				  sigmaz = dz / 2.3548;
-      			}
-      	
-      			if(reconstructor->_recon_type == _interpolate)
-      			{
-      				  sigmax = 0.5 * dx / 2.3548;
-      				  sigmay = 0.5 * dx / 2.3548;
-      				  sigmaz = 0.5 * dx / 2.3548;
-      			}
-        
-            //calculate discretized PSF
-
-            //isotropic voxel size of PSF - derived from resolution of reconstructed volume
-            double size = res / reconstructor->_quality_factor;
-
-            //number of voxels in each direction
-            //the ROI is 2*voxel dimension
-
-            int xDim = round(2 * dx / size);
-            int yDim = round(2 * dy / size);
-            int zDim = round(2 * dz / size);
-      			///test to make dimension alwways odd
-      			xDim = xDim/2*2+1;
-      			yDim = yDim/2*2+1;
-      			zDim = zDim/2*2+1;
-      			///end test
-
-            //image corresponding to PSF
-            irtkImageAttributes attr;
-            attr._x = xDim;
-            attr._y = yDim;
-            attr._z = zDim;
-            attr._dx = size;
-            attr._dy = size;
-            attr._dz = size;
-            irtkRealImage PSF(attr);
-
-            //centre of PSF
-            double cx, cy, cz;
-            cx = 0.5 * (xDim - 1);
-            cy = 0.5 * (yDim - 1);
-            cz = 0.5 * (zDim - 1);
-            PSF.ImageToWorld(cx, cy, cz);
-
-            double x, y, z;
-            double sum = 0;
-            int i, j, k;
-            for (i = 0; i < xDim; i++)
-                for (j = 0; j < yDim; j++)
-                    for (k = 0; k < zDim; k++) {
-                        x = i;
-                        y = j;
-                        z = k;
-                        PSF.ImageToWorld(x, y, z);
-                        x -= cx;
-                        y -= cy;
-                        z -= cz;
-                        //continuous PSF does not need to be normalized as discrete will be
-                        PSF(i, j, k) = exp(
-                                           -x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay)
-                                           - z * z / (2 * sigmaz * sigmaz));
-                        sum += PSF(i, j, k);
-                    }
-            PSF /= sum;
-
-            if (reconstructor->_debug)
-                if (inputIndex == 0)
-                    PSF.Write("PSF.nii.gz");
-
-            //prepare storage for PSF transformed and resampled to the space of reconstructed volume
-            //maximum dim of rotated kernel - the next higher odd integer plus two to accound for rounding error of tx,ty,tz.
-            //Note conversion from PSF image coordinates to tPSF image coordinates *size/res
-            int dim = (floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2))
-                * 2 + 1 + 2;
-            //prepare image attributes. Voxel dimension will be taken from the reconstructed volume
-            attr._x = dim;
-            attr._y = dim;
-            attr._z = dim;
-            attr._dx = res;
-            attr._dy = res;
-            attr._dz = res;
-            //create matrix from transformed PSF
-            irtkRealImage tPSF(attr);
-            //calculate centre of tPSF in image coordinates
-            int centre = (dim - 1) / 2;
-
-            //for each voxel in current slice calculate matrix coefficients
-            int ii, jj, kk;
-            int tx, ty, tz;
-            int nx, ny, nz;
-            int l, m, n;
-            double weight;
-            for (i = 0; i < slice.GetX(); i++)
-                for (j = 0; j < slice.GetY(); j++)
-                    if (slice(i, j, 0) != -1) {
-                        //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
-                        x = i;
-                        y = j;
-                        z = 0;
-                        slice.ImageToWorld(x, y, z);
-                        reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                        reconstructor->_reconstructed4D.WorldToImage(x, y, z);
-                        tx = round(x);
-                        ty = round(y);
-                        tz = round(z);
-
-                        //Clear the transformed PSF
-                        for (ii = 0; ii < dim; ii++)
-                            for (jj = 0; jj < dim; jj++)
-                                for (kk = 0; kk < dim; kk++)
-                                    tPSF(ii, jj, kk) = 0;
-
-                        //for each POINT3D of the PSF
-                        for (ii = 0; ii < xDim; ii++)
-                            for (jj = 0; jj < yDim; jj++)
-                                for (kk = 0; kk < zDim; kk++) {
-                                    //Calculate the position of the POINT3D of
-                                    //PSF centered over current slice voxel                            
-                                    //This is a bit complicated because slices
-                                    //can be oriented in any direction 
-
-                                    //PSF image coordinates
-                                    x = ii;
-                                    y = jj;
-                                    z = kk;
-                                    //change to PSF world coordinates - now real sizes in mm
-                                    PSF.ImageToWorld(x, y, z);
-                                    //centre around the centrepoint of the PSF
-                                    x -= cx;
-                                    y -= cy;
-                                    z -= cz;
-
-                                    //Need to convert (x,y,z) to slice image
-                                    //coordinates because slices can have
-                                    //transformations included in them (they are
-                                    //nifti)  and those are not reflected in
-                                    //PSF. In slice image coordinates we are
-                                    //sure that z is through-plane 
-
-                                    //adjust according to voxel size
-                                    x /= dx;
-                                    y /= dy;
-                                    z /= dz;
-                                    //center over current voxel
-                                    x += i;
-                                    y += j;
-
-                                    //convert from slice image coordinates to world coordinates
-                                    slice.ImageToWorld(x, y, z);
-
-                                    //x+=(vx-cx); y+=(vy-cy); z+=(vz-cz);
-                                    //Transform to space of reconstructed volume
-                                    reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                    //Change to image coordinates
-                                    reconstructor->_reconstructed4D.WorldToImage(x, y, z);
-
-                                    //determine coefficients of volume voxels for position x,y,z
-                                    //using linear interpolation
-
-                                    //Find the 8 closest volume voxels
-
-                                    //lowest corner of the cube
-                                    nx = (int) floor(x);
-                                    ny = (int) floor(y);
-                                    nz = (int) floor(z);
-
-                                    //not all neighbours might be in ROI, thus we need to normalize
-                                    //(l,m,n) are image coordinates of 8 neighbours in volume space
-                                    //for each we check whether it is in volume
-                                    sum = 0;
-                                    //to find wether the current slice voxel has overlap with ROI
-                                    bool inside = false;
-                                    for (l = nx; l <= nx + 1; l++)
-                                        if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
-                                            for (m = ny; m <= ny + 1; m++)
-                                                if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
-                                                    for (n = nz; n <= nz + 1; n++)
-                                                        if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
-                                                            weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-                                                            sum += weight;
-                                                            if (reconstructor->_mask(l, m, n) == 1) {
-                                                                inside = true;
-                                                            }
-                                                        }
-                                    //if there were no voxels do nothing
-                                    if ((sum <= 0) || (!inside))
-                                        continue;
-                                    //now calculate the transformed PSF
-                                    for (l = nx; l <= nx + 1; l++)
-                                        if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
-                                            for (m = ny; m <= ny + 1; m++)
-                                                if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
-                                                    for (n = nz; n <= nz + 1; n++)
-                                                        if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
-                                                            weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-
-                                                            //image coordinates in tPSF
-                                                            //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
-                                                            int aa, bb, cc;
-                                                            aa = l - tx + centre;
-                                                            bb = m - ty + centre;
-                                                            cc = n - tz + centre;
-
-                                                            //resulting value
-                                                            double value = PSF(ii, jj, kk) * weight / sum;
-
-                                                            //Check that we are in tPSF
-                                                            if ((aa < 0) || (aa >= dim) || (bb < 0) || (bb >= dim) || (cc < 0)
-                                                                || (cc >= dim)) {
-                                                                cerr << "Error while trying to populate tPSF. " << aa << " " << bb
-                                                                     << " " << cc << endl;
-                                                                cerr << l << " " << m << " " << n << endl;
-                                                                cerr << tx << " " << ty << " " << tz << endl;
-                                                                cerr << centre << endl;
-                                                                tPSF.Write("tPSF.nii.gz");
-                                                                exit(1);
-                                                            }
-                                                            else
-                                                                //update transformed PSF
-                                                                tPSF(aa, bb, cc) += value;
-                                                        }
-
-                                } //end of the loop for PSF points
-
-                        //store tPSF values
-                        for (ii = 0; ii < dim; ii++)
-                            for (jj = 0; jj < dim; jj++)
-                                for (kk = 0; kk < dim; kk++)
-                                    if (tPSF(ii, jj, kk) > 0) {
-                                        p.x = ii + tx - centre;
-                                        p.y = jj + ty - centre;
-                                        p.z = kk + tz - centre;
-                                        p.value = tPSF(ii, jj, kk);
-                                        slicecoeffs[i][j].push_back(p);
-                                    }
-                                    
-                    } //end of loop for slice voxels
-            
             //Calculate simulated slice
             reconstructor->_simulated_slices[inputIndex].Initialize( reconstructor->_slices[inputIndex].GetImageAttributes() );
             reconstructor->_simulated_slices[inputIndex] = 0;
             
             reconstructor->_simulated_weights[inputIndex].Initialize( reconstructor->_slices[inputIndex].GetImageAttributes() );
             reconstructor->_simulated_weights[inputIndex] = 0;     
-            
+
+            const irtkRealPixel *pr = reconstructor->_reconstructed4D.GetPointerToVoxels();
+            int nvox = reconstructor->_reconstructed4D.GetX() * reconstructor->_reconstructed4D.GetY() * reconstructor->_reconstructed4D.GetZ();
+            const vector<TEMPORALWEIGHT>& tweights = reconstructor->_slice_temporal_weight_list[inputIndex];
             for ( int i = 0; i < reconstructor->_slices[inputIndex].GetX(); i++ )
                 for ( int j = 0; j < reconstructor->_slices[inputIndex].GetY(); j++ )
                     if ( reconstructor->_slices[inputIndex](i, j, 0) != -1 ) {
-                        double weight = 0;
-                        int n = slicecoeffs[i][j].size();
-                        for ( int k = 0; k < n; k++ ) {
-                            p = slicecoeffs[i][j][k];
-                            for ( int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++ ) {
-                                reconstructor->_simulated_slices[inputIndex](i, j, 0) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * reconstructor->_reconstructed4D(p.x, p.y, p.z, outputIndex);
-                                weight += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
+                        double value = 0, weight = 0;
+                        for ( int k = slicecoeffs.Begin(i, j); k < slicecoeffs.End(i, j); k++ ) {
+                            int index = slicecoeffs.Index(k);
+                            double c = slicecoeffs.Value(k);
+                            for ( unsigned int t = 0; t < tweights.size(); t++ ) {
+                                value += tweights[t].weight * c * pr[index + tweights[t].phase * nvox];
+                                weight += tweights[t].weight * c;
                             }
                         }                    
                         if( weight > 0 ) {
-                            reconstructor->_simulated_slices[inputIndex](i,j,0) /= weight;
+                            reconstructor->_simulated_slices[inputIndex](i,j,0) = value / weight;
                             reconstructor->_simulated_weights[inputIndex](i,j,0) = weight;
                         }
                     }
@@ -1653,12 +2339,22 @@ void irtkReconstructionCardiac4D::SimulateStacksCardiac4D(vector<bool> stack_exc
     for (unsigned int inputIndex = 0; inputIndex < _slices.size(); ++inputIndex)  
       _slice_inside.push_back(true);
     
+    //compute PSFs of all slice voxel sizes before they are shared between threads
+    double dx, dy, dz;
+    for (unsigned int inputIndex = 0; inputIndex < _slices.size(); ++inputIndex)
+        if (_slice_excluded[inputIndex] != 1) {
+            _slices[inputIndex].GetPixelSize(&dx, &dy, &dz);
+            GetPSF(dx, dy, dz);
+        }
+    
     //Simulate images
     cout << "Simulating...";
     cout.flush();
     ParallelSimulateStacksCardiac4D simulatestacks(this);
     simulatestacks();
     cout << " ... done." << endl;
+
+    InvalidateSlicePools();
     
 } 
 
@@ -1766,18 +2462,17 @@ void operator()( const blocked_range<size_t>& r ) {
         }
             
         //Distribute slice intensities to the volume
-        POINT3D p;
+        const irtkSliceCoeffs& coeffs = reconstructor->_slice_coeffs[inputIndex];
+        irtkRealPixel *pbias = bias.GetPointerToVoxels();
+        irtkRealPixel *pvw = volweight3d.GetPointerToVoxels();
         for (int i = 0; i < slice.GetX(); i++)
             for (int j = 0; j < slice.GetY(); j++)
                 if (slice(i, j, 0) != -1) {
-                    //number of volume voxels with non-zero coefficients for current slice voxel
-                    int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
                     //add contribution of current slice voxel to all voxel volumes
                     //to which it contributes
-                    for (int k = 0; k < n; k++) {
-                        p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                        bias(p.x, p.y, p.z) += p.value * b(i, j, 0);
-                        volweight3d(p.x,p.y,p.z) += p.value;
+                    for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                        pbias[coeffs.Index(k)] += coeffs.Value(k) * b(i, j, 0);
+                        pvw[coeffs.Index(k)] += coeffs.Value(k);
                     }
                 }
         //end of loop for a slice inputIndex                
@@ -1826,6 +2521,8 @@ void operator() () {
 // -----------------------------------------------------------------------------
 void irtkReconstructionCardiac4D::NormaliseBiasCardiac4D(int iter, int rec_iter)
 {
+    irtkReconstructionStage stage(_profile, "NormaliseBias", _slices.size());
+
     if(_debug)
         cout << "Normalise Bias ... ";
 
@@ -1905,9 +2602,27 @@ void irtkReconstructionCardiac4D::CalculateSliceToVolumeTargetCardiacPhase()
 class ParallelSliceToVolumeRegistrationCardiac4D {
 public:
     irtkReconstructionCardiac4D *reconstructor;
-
-    ParallelSliceToVolumeRegistrationCardiac4D(irtkReconstructionCardiac4D *_reconstructor) : 
-    reconstructor(_reconstructor) { }
+    vector<irtkGreyImage> &targets;
+    vector<irtkMatrix> &offsets;
+    vector<int> &valid;
+    vector<irtkGreyImage*> *sources;
+    vector<irtkRegistrationSourceCache*> *caches;
+
+    // without sources the slices are only prepared for a batch registration,
+    // otherwise each slice is registered on its own to the shared, pre-processed
+    // volume of its target cardiac phase
+    ParallelSliceToVolumeRegistrationCardiac4D(irtkReconstructionCardiac4D *_reconstructor,
+                                               vector<irtkGreyImage> &_targets,
+                                               vector<irtkMatrix> &_offsets,
+                                               vector<int> &_valid,
+                                               vector<irtkGreyImage*> *_sources = NULL,
+                                               vector<irtkRegistrationSourceCache*> *_caches = NULL) : 
+    reconstructor(_reconstructor),
+    targets(_targets),
+    offsets(_offsets),
+    valid(_valid),
+    sources(_sources),
+    caches(_caches) { }
 
     void operator() (const blocked_range<size_t> &r) const {
 
@@ -1917,10 +2632,10 @@ public:
           
           if (reconstructor->_slice_excluded[inputIndex] == 0) {
 
-            irtkImageRigidRegistrationWithPadding registration;
             irtkGreyPixel smin, smax;
-            irtkGreyImage target;
-            irtkRealImage slice, w, b, t;
+            irtkGreyImage slice_target;
+            irtkGreyImage &target = (sources == NULL) ? targets[inputIndex] : slice_target;
+            irtkRealImage t;
             irtkResamplingWithPadding<irtkRealPixel> resampling(attr._dx,attr._dx,attr._dx,-1);         
             irtkReconstruction dummy_reconstruction;
             
@@ -1935,7 +2650,6 @@ public:
             // get pixel value min and max
             target.GetMinMax(&smin, &smax);
         
-            // SOURCE
             if (smax > -1) {
                 // put origin to zero
                 irtkRigidTransformation offset;
@@ -1945,18 +2659,25 @@ public:
                 m=m*mo;
                 reconstructor->_transformations[inputIndex].PutMatrix(m);
 
-                // TODO: extract nearest cardiac phase from reconstructed 4D to use as source
-                irtkGreyImage source = reconstructor->_reconstructed4D.GetRegion( 0, 0, 0, reconstructor->_slice_svr_card_index[inputIndex], attr._x, attr._y, attr._z, reconstructor->_slice_svr_card_index[inputIndex]+1 ); 
-                registration.SetInput(&target, &source);
-                registration.SetOutput(&reconstructor->_transformations[inputIndex]);
-                registration.GuessParameterSliceToVolume();
-                registration.SetTargetPadding(-1);
-                registration.Run();
-                //undo the offset
-                mo.Invert();
-                m = reconstructor->_transformations[inputIndex].GetMatrix();
-                m=m*mo;
-                reconstructor->_transformations[inputIndex].PutMatrix(m);
+                if (sources != NULL) {
+                    // SOURCE
+                    int card_index = reconstructor->_slice_svr_card_index[inputIndex];
+                    irtkImageRigidRegistrationWithPadding registration;
+                    registration.SetInput(&target, (*sources)[card_index]);
+                    registration.SetOutput(&reconstructor->_transformations[inputIndex]);
+                    registration.GuessParameterSliceToVolume();
+                    registration.SetTargetPadding(-1);
+                    registration.SetSourceCache((*caches)[card_index]);
+                    registration.Run();
+                    // undo the offset
+                    mo.Invert();
+                    m = reconstructor->_transformations[inputIndex].GetMatrix();
+                    m=m*mo;
+                    reconstructor->_transformations[inputIndex].PutMatrix(m);
+                } else {
+                    offsets[inputIndex] = mo;
+                    valid[inputIndex] = 1;
+                }
             }      
           }   
         }
@@ -1978,10 +2699,76 @@ public:
 // -----------------------------------------------------------------------------
 void irtkReconstructionCardiac4D::SliceToVolumeRegistrationCardiac4D()
 {
+  irtkReconstructionStage stage(_profile, "SVR", _slices.size());
+
   if (_debug)
       cout << "SliceToVolumeRegistrationCardiac4D" << endl;
-  ParallelSliceToVolumeRegistrationCardiac4D registration(this);
-  registration();
+
+  irtkImageAttributes attr = _reconstructed4D.GetImageAttributes();
+  vector<irtkGreyImage> targets(_slices.size());
+  vector<irtkMatrix> offsets(_slices.size());
+  vector<int> valid(_slices.size(), 0);
+
+  // batches are only used for similarity measures irtkMultiSliceRigidRegistration supports
+  irtkMultiSliceRigidRegistration batch;
+  if (!_batch_svr || !irtkMultiSliceRigidRegistration::IsSupported(batch.GetSimilarityMeasure())) {
+    vector<irtkGreyImage*> sources(attr._t, (irtkGreyImage*)NULL);
+    vector<irtkRegistrationSourceCache*> caches(attr._t, (irtkRegistrationSourceCache*)NULL);
+
+    // extract and pre-process the source volume of each target cardiac phase once,
+    // with the source parameters every slice-to-volume registration would guess
+    for (unsigned int inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+      int card_index = _slice_svr_card_index[inputIndex];
+      if ((_slice_excluded[inputIndex] == 1) || (sources[card_index] != NULL))
+        continue;
+      sources[card_index] = new irtkGreyImage(_reconstructed4D.GetRegion( 0, 0, 0, card_index, attr._x, attr._y, attr._z, card_index+1 ));
+      irtkImageRigidRegistrationWithPadding registration;
+      registration.SetInput(sources[card_index], sources[card_index]);
+      registration.GuessParameterSliceToVolume();
+      caches[card_index] = new irtkRegistrationSourceCache;
+      registration.InitializeSourceCache(caches[card_index]);
+    }
+
+    // register slices one by one
+    ParallelSliceToVolumeRegistrationCardiac4D registration(this, targets, offsets, valid, &sources, &caches);
+    registration();
+
+    for (int card_index = 0; card_index < attr._t; card_index++) {
+      delete caches[card_index];
+      delete sources[card_index];
+    }
+    return;
+  }
+
+  // resample slices and move their origin to zero
+  ParallelSliceToVolumeRegistrationCardiac4D prepare(this, targets, offsets, valid);
+  prepare();
+
+  // register the slices of each target cardiac phase in one batch against the
+  // volume of that phase, which is extracted and pre-processed only once
+  for (int card_index = 0; card_index < attr._t; card_index++) {
+    irtkMultiSliceRigidRegistration registration;
+    for (unsigned int inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+      if ((valid[inputIndex] == 1) && (_slice_svr_card_index[inputIndex] == card_index))
+        registration.AddSlice(&targets[inputIndex], &_transformations[inputIndex]);
+    }
+    if (registration.GetNumberOfSlices() == 0)
+      continue;
+    irtkGreyImage source = _reconstructed4D.GetRegion( 0, 0, 0, card_index, attr._x, attr._y, attr._z, card_index+1 );
+    registration.SetSource(&source);
+    registration.Run();
+  }
+
+  // undo the offset
+  for (unsigned int inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+    if (valid[inputIndex] == 1) {
+      irtkMatrix mo = offsets[inputIndex];
+      mo.Invert();
+      irtkMatrix m = _transformations[inputIndex].GetMatrix();
+      m=m*mo;
+      _transformations[inputIndex].PutMatrix(m);
+    }
+  }
 }
 
 
@@ -2704,7 +3491,11 @@ public:
             //Update reconstructed volume using current slice
 
             //Distribute error to the volume
-            POINT3D p;
+            const irtkSliceCoeffs& coeffs = reconstructor->_slice_coeffs[inputIndex];
+            irtkRealPixel *pa = addon.GetPointerToVoxels();
+            irtkRealPixel *pc = confidence_map.GetPointerToVoxels();
+            const vector<TEMPORALWEIGHT>& tweights = reconstructor->_slice_temporal_weight_list[inputIndex];
+            int nvox = addon.GetX() * addon.GetY() * addon.GetZ();
             for ( int i = 0; i < slice.GetX(); i++)
                 for ( int j = 0; j < slice.GetY(); j++)
                     if (slice(i, j, 0) != -1) {
@@ -2716,20 +3507,21 @@ public:
                         else
                             slice(i,j,0) = 0;
 
-                        int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-                        for (int k = 0; k < n; k++) {
-                            p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                            for (int outputIndex=0; outputIndex<reconstructor->_reconstructed4D.GetT(); outputIndex++) {
+                        for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                            int index = coeffs.Index(k);
+                            double value = coeffs.Value(k);
+                            for (unsigned int t = 0; t < tweights.size(); t++) {
+                            int outputIndex = tweights[t].phase;
 			    if(reconstructor->_robust_slices_only)
 			    {
-                              addon(p.x, p.y, p.z, outputIndex) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * slice(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                              confidence_map(p.x, p.y, p.z, outputIndex) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * reconstructor->_slice_weight[inputIndex];
+                              pa[index + outputIndex * nvox] += tweights[t].weight * value * slice(i, j, 0) * reconstructor->_slice_weight[inputIndex];
+                              pc[index + outputIndex * nvox] += tweights[t].weight * value * reconstructor->_slice_weight[inputIndex];
 			      
 			    }
 			    else
 			    {
-                              addon(p.x, p.y, p.z, outputIndex) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * slice(i, j, 0) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                              confidence_map(p.x, p.y, p.z, outputIndex) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
+                              pa[index + outputIndex * nvox] += tweights[t].weight * value * slice(i, j, 0) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
+                              pc[index + outputIndex * nvox] += tweights[t].weight * value * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
 			    }
                             }
                         }
@@ -2776,11 +3568,79 @@ public:
 };
 
 
+// -----------------------------------------------------------------------------
+// Parallel Super-Resolution: slice errors and weights for gather
+// -----------------------------------------------------------------------------
+class ParallelSuperresolutionErrorCardiac4D {
+    irtkReconstructionCardiac4D *reconstructor;
+    irtkSlicePool<float> &error;
+    irtkSlicePool<float> &weight;
+
+public:
+    ParallelSuperresolutionErrorCardiac4D( irtkReconstructionCardiac4D *_reconstructor,
+                                           irtkSlicePool<float> &_error,
+                                           irtkSlicePool<float> &_weight ) :
+        reconstructor(_reconstructor),
+        error(_error),
+        weight(_weight) { }
+
+    void operator() (const blocked_range<size_t> &r) const {
+        for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
+            //contiguous voxel buffers of the slice, the error and weight
+            //pools have the same layout as the slice pools
+            const float *ps = reconstructor->_slice_pool.GetPointerToVoxels(inputIndex);
+            const float *pb = reconstructor->_bias_pool.GetPointerToVoxels(inputIndex);
+            const float *pw = reconstructor->_weight_pool.GetPointerToVoxels(inputIndex);
+            const float *psim = reconstructor->_simulated_slice_pool.GetPointerToVoxels(inputIndex);
+            float *pe = error.GetPointerToVoxels(inputIndex);
+            float *pew = weight.GetPointerToVoxels(inputIndex);
+            const int n = reconstructor->_slice_pool.GetNumberOfVoxels(inputIndex);
+
+            //identify scale factor
+            const double scale = reconstructor->_scale[inputIndex];
+            const double slice_weight = reconstructor->_slice_weight[inputIndex];
+
+            for ( int i = 0; i < n; i++ ) {
+                if (ps[i] != -1) {
+                    //bias correct and scale the slice, subtract simulated slice
+                    if ( psim[i] > 0 )
+                        pe[i] = ps[i] * exp(-pb[i]) * scale - psim[i];
+                    else
+                        pe[i] = 0;
+
+                    if(reconstructor->_robust_slices_only)
+                        pew[i] = slice_weight;
+                    else
+                        pew[i] = pw[i] * slice_weight;
+                }
+                else {
+                    pe[i] = 0;
+                    pew[i] = 0;
+                }
+            }
+        } //end of loop for a slice inputIndex
+    }
+
+    // execute
+    void operator() () const {
+        task_scheduler_init init(tbb_no_threads);
+        parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ),
+                      *this );
+        init.terminate();
+    }
+
+};
+
+
 // -----------------------------------------------------------------------------
 // Super-Resolution of 4D Volume
 // -----------------------------------------------------------------------------
 void irtkReconstructionCardiac4D::SuperresolutionCardiac4D( int iter )
 {
+  irtkReconstructionStage stage(_profile, "Superresolution", _slices.size());
+  if (_profile.IsOn())
+      stage.AddCoefficients(GetNumberOfCoefficients());
+
   if (_debug)
       cout << "Superresolution " << iter << endl;
   
@@ -2791,11 +3651,43 @@ void irtkReconstructionCardiac4D::SuperresolutionCardiac4D( int iter )
   //Remember current reconstruction for edge-preserving smoothing
   original = _reconstructed4D;
 
-  ParallelSuperresolutionCardiac4D parallelSuperresolution(this);
-  parallelSuperresolution();
+  if (!_volume_coeffs.IsEmpty()) {
+      UpdateSlicePools();
+
+      //gather over output voxels using the voxel-major coefficients
+      addon.Initialize( _reconstructed4D.GetImageAttributes() );
+      addon = 0;
+      _confidence_map.Initialize( _reconstructed4D.GetImageAttributes() );
+      _confidence_map = 0;
+
+      irtkSlicePool<float> error, weight;
+      error.Initialize( _slices );
+      weight.Initialize( _slices );
+      ParallelSuperresolutionErrorCardiac4D parallelSuperresolutionError( this, error, weight );
+      parallelSuperresolutionError();
+      if (_use_interleaved) {
+          //accumulate all phases of a voxel in adjacent memory
+          irtkInterleavedImage iaddon( _reconstructed4D.GetImageAttributes() );
+          irtkInterleavedImage iconfidence( _reconstructed4D.GetImageAttributes() );
+          ParallelSuperresolutionGatherCardiac4D parallelSuperresolutionGather( this, error, weight,
+              iaddon.GetPointerToVoxels(), iconfidence.GetPointerToVoxels(), _reconstructed4D.GetT(), 1 );
+          parallelSuperresolutionGather();
+          iaddon.Export(addon);
+          iconfidence.Export(_confidence_map);
+      }
+      else {
+          ParallelSuperresolutionGatherCardiac4D parallelSuperresolutionGather( this, error, weight,
+              addon.GetPointerToVoxels(), _confidence_map.GetPointerToVoxels(), 1, _volume_coeffs.GetNumberOfVoxels() );
+          parallelSuperresolutionGather();
+      }
+  }
+  else {
+      ParallelSuperresolutionCardiac4D parallelSuperresolution(this);
+      parallelSuperresolution();
 
-  addon = parallelSuperresolution.addon;
-  _confidence_map = parallelSuperresolution.confidence_map;
+      addon = parallelSuperresolution.addon;
+      _confidence_map = parallelSuperresolution.confidence_map;
+  }
   
   if(_debug) {
       // char buffer[256];
@@ -2845,137 +3737,140 @@ void irtkReconstructionCardiac4D::SuperresolutionCardiac4D( int iter )
 
 
 // -----------------------------------------------------------------------------
-// Parallel Adaptive Regularization Class 1: calculate smoothing factor, b
+// Parallel Adaptive Regularization: smoothing factors and update in one sweep,
+// spatially within each cardiac phase and optionally cyclically across phases
 // -----------------------------------------------------------------------------
-class ParallelAdaptiveRegularization1Cardiac4D {
+
+// Edge length in y and z of the tiles of the blocked traversal
+#define IRTK_REGULARIZATION_TILE 8
+
+class ParallelAdaptiveRegularizationCardiac4D {
     irtkReconstructionCardiac4D *reconstructor;
-    vector<irtkRealImage> &b;
     vector<double> &factor;
     irtkRealImage &original;
+    irtkRealImage &original2;
+    int dx, dy, dz, dt;
+    int ny, nz;
+    int offset[13];
         
 public:
-    ParallelAdaptiveRegularization1Cardiac4D( irtkReconstructionCardiac4D *_reconstructor,
-                                     vector<irtkRealImage> &_b,
-                                     vector<double> &_factor,
-                                     irtkRealImage &_original) : 
+    ParallelAdaptiveRegularizationCardiac4D( irtkReconstructionCardiac4D *_reconstructor,
+                                             vector<double> &_factor,
+                                             irtkRealImage &_original,
+                                             irtkRealImage &_original2 ) : 
         reconstructor(_reconstructor),
-        b(_b),
         factor(_factor),
-        original(_original) { }
+        original(_original),
+        original2(_original2) {
+        dx = reconstructor->_reconstructed4D.GetX();
+        dy = reconstructor->_reconstructed4D.GetY();
+        dz = reconstructor->_reconstructed4D.GetZ();
+        dt = reconstructor->_reconstructed4D.GetT();
+        ny = (dy + IRTK_REGULARIZATION_TILE - 1) / IRTK_REGULARIZATION_TILE;
+        nz = (dz + IRTK_REGULARIZATION_TILE - 1) / IRTK_REGULARIZATION_TILE;
+
+        //linear offset of the neighbour in each direction within a phase
+        for (int i = 0; i < 13; i++)
+            offset[i] = reconstructor->_directions[i][0]
+                + reconstructor->_directions[i][1] * dx
+                + reconstructor->_directions[i][2] * dx * dy;
+    }
 
     void operator() (const blocked_range<size_t> &r) const {
-        int dx = reconstructor->_reconstructed4D.GetX();
-        int dy = reconstructor->_reconstructed4D.GetY();
-        int dz = reconstructor->_reconstructed4D.GetZ();
-        int dt = reconstructor->_reconstructed4D.GetT();
-        for ( size_t i = r.begin(); i != r.end(); ++i ) {
-            //b[i] = reconstructor->_reconstructed;
-            // b[i].Initialize( reconstructor->_reconstructed.GetImageAttributes() );
-
-            int x, y, z, xx, yy, zz, t;
-            double diff;
-            for (x = 0; x < dx; x++)
-                for (y = 0; y < dy; y++)
-                    for (z = 0; z < dz; z++) {
-                        xx = x + reconstructor->_directions[i][0];
-                        yy = y + reconstructor->_directions[i][1];
-                        zz = z + reconstructor->_directions[i][2];
-                        for (t = 0; t < dt; t++) {
-                            if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                && (reconstructor->_confidence_map(x, y, z, t) > 0) && (reconstructor->_confidence_map(xx, yy, zz, t) > 0)) {
-                                diff = (original(xx, yy, zz, t) - original(x, y, z, t)) * sqrt(factor[i]) / reconstructor->_delta;
-                                b[i](x, y, z, t) = factor[i] / sqrt(1 + diff * diff);
-
+        const int *d[13];
+        double sqrtfactor[13];
+        for (int i = 0; i < 13; i++) {
+            d[i] = reconstructor->_directions[i];
+            sqrtfactor[i] = sqrt(factor[i]);
+        }
+        const double delta = reconstructor->_delta;
+        const double step = reconstructor->_alpha * reconstructor->_lambda / (delta * delta);
+        const double step_t = step * reconstructor->_temporal_lambda;
+        const int nvox = dx * dy * dz;
+
+        for ( size_t tile = r.begin(); tile != r.end(); ++tile ) {
+            //tiles are ordered as the voxels, t outermost
+            const int t = tile / (ny * nz);
+            const int z0 = ((tile / ny) % nz) * IRTK_REGULARIZATION_TILE;
+            const int y0 = (tile % ny) * IRTK_REGULARIZATION_TILE;
+            const int z1 = min(z0 + IRTK_REGULARIZATION_TILE, dz);
+            const int y1 = min(y0 + IRTK_REGULARIZATION_TILE, dy);
+
+            const int phase = t * nvox;
+
+            //offsets of the neighbouring phases in the cardiac cycle, which
+            //coincide for two phases
+            const int next = ((t + 1) % dt - t) * nvox;
+            const int prev = ((t + dt - 1) % dt - t) * nvox;
+            const bool temporal = (step_t > 0) && (dt > 1);
+            const irtkRealPixel *pc = reconstructor->_confidence_map.GetPointerToVoxels() + phase;
+            const irtkRealPixel *po = original.GetPointerToVoxels() + phase;
+            const irtkRealPixel *po2 = original2.GetPointerToVoxels() + phase;
+            irtkRealPixel *pr = reconstructor->_reconstructed4D.GetPointerToVoxels() + phase;
+
+            for (int z = z0; z < z1; z++)
+                for (int y = y0; y < y1; y++)
+                    for (int x = 0; x < dx; x++) {
+                        const int index = (z * dy + y) * dx + x;
+                        if (pc[index] <= 0)
+                            continue;
+
+                        double val = 0;
+                        double sum = 0;
+                        for (int i = 0; i < 13; i++) {
+                            //smoothing factor of the edge to the forward neighbour
+                            const int xx = x + d[i][0];
+                            const int yy = y + d[i][1];
+                            const int zz = z + d[i][2];
+                            if ((xx < 0) || (xx >= dx) || (yy < 0) || (yy >= dy) || (zz < 0) || (zz >= dz)
+                                || (pc[index + offset[i]] <= 0))
+                                continue;
+                            const double diff = (po[index + offset[i]] - po[index]) * sqrtfactor[i] / delta;
+                            const double b = factor[i] / sqrt(1 + diff * diff);
+
+                            //forward neighbour
+                            val += b * po2[index + offset[i]];
+                            sum += b;
+
+                            //backward neighbour
+                            const int xb = x - d[i][0];
+                            const int yb = y - d[i][1];
+                            const int zb = z - d[i][2];
+                            if ((xb >= 0) && (xb < dx) && (yb >= 0) && (yb < dy) && (zb >= 0) && (zb < dz)
+                                && (pc[index - offset[i]] > 0)) {
+                                val += b * po2[index - offset[i]];
+                                sum += b;
                             }
-                            else
-                                b[i](x, y, z, t) = 0;
                         }
-                    }
-        }
-    }
-
-    // execute
-    void operator() () const {
-        task_scheduler_init init(tbb_no_threads);
-        parallel_for( blocked_range<size_t>(0, 13),
-                      *this );
-        init.terminate();
-    }
-
-};
-
-
-// -----------------------------------------------------------------------------
-// Parallel Adaptive Regularization Class 2: compute regularisation update
-// -----------------------------------------------------------------------------
-class ParallelAdaptiveRegularization2Cardiac4D {
-    irtkReconstructionCardiac4D *reconstructor;
-    vector<irtkRealImage> &b;
-    vector<double> &factor;
-    irtkRealImage &original;
-        
-public:
-    ParallelAdaptiveRegularization2Cardiac4D( irtkReconstructionCardiac4D *_reconstructor,
-                                     vector<irtkRealImage> &_b,
-                                     vector<double> &_factor,
-                                     irtkRealImage &_original) : 
-        reconstructor(_reconstructor),
-        b(_b),
-        factor(_factor),
-        original(_original) { }
 
-    void operator() (const blocked_range<size_t> &r) const {
-      int dx = reconstructor->_reconstructed4D.GetX();
-      int dy = reconstructor->_reconstructed4D.GetY();
-      int dz = reconstructor->_reconstructed4D.GetZ();
-      int dt = reconstructor->_reconstructed4D.GetT();
-      for ( size_t x = r.begin(); x != r.end(); ++x ) {
-        int xx, yy, zz;
-        for (int y = 0; y < dy; y++)
-          for (int z = 0; z < dz; z++) 
-            for (int t = 0; t < dt; t++) {
-              if(reconstructor->_confidence_map(x,y,z,t)>0)
-		          {                    
-                double val = 0;
-                double sum = 0;
-                for (int i = 0; i < 13; i++) 
-                {
-                  xx = x + reconstructor->_directions[i][0];
-                  yy = y + reconstructor->_directions[i][1];
-                  zz = z + reconstructor->_directions[i][2];
-                  if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)) 
-			               if(reconstructor->_confidence_map(xx,yy,zz,t)>0)
-                     {
-                       val += b[i](x, y, z, t) * original(xx, yy, zz, t);
-                       sum += b[i](x, y, z, t);
-                     }
-                }
+                        val -= sum * po2[index];
+                        val *= step;
 
-                for (int i = 0; i < 13; i++) {
-                  xx = x - reconstructor->_directions[i][0];
-                  yy = y - reconstructor->_directions[i][1];
-                  zz = z - reconstructor->_directions[i][2];
-                  if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)) 
-			              if(reconstructor->_confidence_map(xx,yy,zz,t)>0)
-			              {
-                      val += b[i](x, y, z, t) * original(xx, yy, zz, t);
-                      sum += b[i](x, y, z, t);
-                    }    
-                }
+                        //edge-preserving smoothing across the cardiac cycle
+                        if (temporal) {
+                            double val_t = 0;
+                            if (pc[index + next] > 0) {
+                                const double diff = (po[index + next] - po[index]) / delta;
+                                const double b = 1 / sqrt(1 + diff * diff);
+                                val_t += b * (po2[index + next] - po2[index]);
+                            }
+                            if ((dt > 2) && (pc[index + prev] > 0)) {
+                                const double diff = (po[index + prev] - po[index]) / delta;
+                                const double b = 1 / sqrt(1 + diff * diff);
+                                val_t += b * (po2[index + prev] - po2[index]);
+                            }
+                            val += step_t * val_t;
+                        }
 
-                val -= sum * original(x, y, z, t);
-                val = original(x, y, z, t) 
-                      + reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val;
-                reconstructor->_reconstructed4D(x, y, z, t) = val;
-              } 
-            } 
-      } 
+                        pr[index] = po2[index] + val;
+                    }
+        }
     }
 
     // execute
     void operator() () const {
         task_scheduler_init init(tbb_no_threads);
-        parallel_for( blocked_range<size_t>(0, reconstructor->_reconstructed4D.GetX()),
+        parallel_for( blocked_range<size_t>(0, dt * nz * ny),
                       *this );
         init.terminate();
     }
@@ -2988,6 +3883,8 @@ public:
 // -----------------------------------------------------------------------------
 void irtkReconstructionCardiac4D::AdaptiveRegularizationCardiac4D(int iter, irtkRealImage& original)
 {
+    irtkReconstructionStage stage(_profile, "Regularization");
+
     if (_debug)
           cout << "AdaptiveRegularizationCardiac4D."<< endl;
         //cout << "AdaptiveRegularizationCardiac4D: _delta = "<<_delta<<" _lambda = "<<_lambda <<" _alpha = "<<_alpha<< endl;
@@ -2999,27 +3896,25 @@ void irtkReconstructionCardiac4D::AdaptiveRegularizationCardiac4D(int iter, irtk
         factor[i] = 1 / factor[i];
     }
 
-    vector<irtkRealImage> b;//(13);
-    for (int i = 0; i < 13; i++)
-        b.push_back( _reconstructed4D );
-
-    ParallelAdaptiveRegularization1Cardiac4D parallelAdaptiveRegularization1( this,
-                                                                     b,
-                                                                     factor,
-                                                                     original );
-    parallelAdaptiveRegularization1();
-
     irtkRealImage original2 = _reconstructed4D;
-    ParallelAdaptiveRegularization2Cardiac4D parallelAdaptiveRegularization2( this,
-                                                                     b,
-                                                                     factor,
-                                                                     original2 );
-    parallelAdaptiveRegularization2();
-
-    if (_alpha * _lambda / (_delta * _delta) > 0.068) {
+    ParallelAdaptiveRegularizationCardiac4D parallelAdaptiveRegularization( this,
+                                                                            factor,
+                                                                            original,
+                                                                            original2 );
+    parallelAdaptiveRegularization();
+
+    //the explicit update is stable while the weights of all neighbours,
+    //spatial and temporal, do not exceed that of the voxel itself
+    double neighbours = 0;
+    for (int i = 0; i < 13; i++)
+        neighbours += 2 * factor[i];
+    if ((_temporal_lambda > 0) && (_reconstructed4D.GetT() > 1))
+        neighbours += _temporal_lambda * ((_reconstructed4D.GetT() > 2) ? 2 : 1);
+    double limit = 1 / neighbours;
+    if (_alpha * _lambda / (_delta * _delta) > limit) {
         cerr
-            << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068."
-            << endl;
+            << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below "
+            << setprecision(2) << limit << setprecision(6) << "." << endl;
     }
 }
 
@@ -3148,6 +4043,212 @@ void irtkReconstructionCardiac4D::SaveTransformations()
 }
 
 
+// -----------------------------------------------------------------------------
+// Checkpoint
+// -----------------------------------------------------------------------------
+static const char CHECKPOINT_MAGIC[] = "IRTKCARDIAC4D";
+static const int CHECKPOINT_VERSION = 2;
+
+static void WriteCheckpointValue( ofstream &out, double value )
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(double));
+}
+
+static double ReadCheckpointValue( ifstream &in )
+{
+    double value = 0;
+    in.read(reinterpret_cast<char *>(&value), sizeof(double));
+    return value;
+}
+
+static void WriteCheckpointImage( ofstream &out, irtkRealImage &image )
+{
+    int n = image.GetNumberOfVoxels();
+    out.write(reinterpret_cast<const char *>(&n), sizeof(int));
+    out.write(reinterpret_cast<const char *>(image.GetPointerToVoxels()), n * sizeof(irtkRealPixel));
+}
+
+static void WriteCheckpointCount( ofstream &out, int n )
+{
+    out.write(reinterpret_cast<const char *>(&n), sizeof(int));
+}
+
+static int ReadCheckpointCount( ifstream &in )
+{
+    int n = -1;
+    in.read(reinterpret_cast<char *>(&n), sizeof(int));
+    return in ? n : -1;
+}
+
+static bool ReadCheckpointImage( ifstream &in, irtkRealImage &image )
+{
+    int n = 0;
+    in.read(reinterpret_cast<char *>(&n), sizeof(int));
+    if (n != image.GetNumberOfVoxels())
+        return false;
+    in.read(reinterpret_cast<char *>(image.GetPointerToVoxels()), n * sizeof(irtkRealPixel));
+    return in.good();
+}
+
+void irtkReconstructionCardiac4D::WriteCheckpoint( const char *filename, int iter )
+{
+    unsigned int inputIndex;
+    int i, n;
+
+    //write to a temporary file first so that an interrupted write
+    //never replaces the previous checkpoint
+    string tmpname = string(filename) + ".tmp";
+    ofstream out(tmpname.c_str(), ios::out | ios::binary);
+    if (!out) {
+        cerr << "Could not write checkpoint " << tmpname << endl;
+        exit(1);
+    }
+
+    out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    out.write(reinterpret_cast<const char *>(&CHECKPOINT_VERSION), sizeof(int));
+    out.write(reinterpret_cast<const char *>(&iter), sizeof(int));
+    n = _slices.size();
+    out.write(reinterpret_cast<const char *>(&n), sizeof(int));
+
+    //reconstructed volume
+    WriteCheckpointImage(out, _reconstructed4D);
+
+    //slice transformations, bias fields, voxel weights, slice weights, scales
+    //and exclusion flags
+    for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+        n = _transformations[inputIndex].NumberOfDOFs();
+        out.write(reinterpret_cast<const char *>(&n), sizeof(int));
+        for (i = 0; i < n; i++)
+            WriteCheckpointValue(out, _transformations[inputIndex].Get(i));
+        WriteCheckpointImage(out, _bias[inputIndex]);
+        WriteCheckpointImage(out, _weights[inputIndex]);
+        WriteCheckpointValue(out, _slice_weight[inputIndex]);
+        WriteCheckpointValue(out, _scale[inputIndex]);
+        WriteCheckpointValue(out, _slice_excluded[inputIndex]);
+    }
+
+    //outlier slices: slices outside the mask and slices with small overlap
+    //with the ROI, both are empty before they have first been computed
+    WriteCheckpointCount(out, _slice_inside.size());
+    for (i = 0; i < (int)_slice_inside.size(); i++)
+        WriteCheckpointValue(out, _slice_inside[i]);
+    WriteCheckpointCount(out, _small_slices.size());
+    for (i = 0; i < (int)_small_slices.size(); i++)
+        WriteCheckpointCount(out, _small_slices[i]);
+
+    //EM parameters
+    WriteCheckpointValue(out, _sigma);
+    WriteCheckpointValue(out, _mix);
+    WriteCheckpointValue(out, _m);
+    WriteCheckpointValue(out, _mean_s);
+    WriteCheckpointValue(out, _sigma_s);
+    WriteCheckpointValue(out, _mean_s2);
+    WriteCheckpointValue(out, _sigma_s2);
+    WriteCheckpointValue(out, _mix_s);
+    WriteCheckpointValue(out, _step);
+
+    out.close();
+    if (!out || (rename(tmpname.c_str(), filename) != 0)) {
+        cerr << "Could not write checkpoint " << filename << endl;
+        exit(1);
+    }
+
+    if (_debug)
+        cout << "Checkpoint for iteration " << iter << " written to " << filename << endl;
+}
+
+static int ReadCheckpointHeader( ifstream& in, const char *filename )
+{
+    int version, iter;
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+
+    in.read(magic, sizeof(CHECKPOINT_MAGIC));
+    in.read(reinterpret_cast<char *>(&version), sizeof(int));
+    if (!in || (string(magic, sizeof(CHECKPOINT_MAGIC)) != string(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)))
+        || (version != CHECKPOINT_VERSION)) {
+        cerr << filename << " is not a cardiac 4D reconstruction checkpoint." << endl;
+        exit(1);
+    }
+    in.read(reinterpret_cast<char *>(&iter), sizeof(int));
+    return iter;
+}
+
+int irtkReconstructionCardiac4D::ReadCheckpointIteration( const char *filename )
+{
+    ifstream in(filename, ios::in | ios::binary);
+    if (!in)
+        return -1;
+    return ReadCheckpointHeader(in, filename);
+}
+
+int irtkReconstructionCardiac4D::ReadCheckpoint( const char *filename )
+{
+    unsigned int inputIndex;
+    int i, n, iter;
+
+    ifstream in(filename, ios::in | ios::binary);
+    if (!in) {
+        cout << "No checkpoint " << filename << " found, starting from first iteration." << endl;
+        return -1;
+    }
+
+    iter = ReadCheckpointHeader(in, filename);
+    in.read(reinterpret_cast<char *>(&n), sizeof(int));
+    if (n != (int)_slices.size()) {
+        cerr << "Checkpoint " << filename << " has " << n << " slices, expected " << _slices.size() << "." << endl;
+        exit(1);
+    }
+
+    bool ok = ReadCheckpointImage(in, _reconstructed4D);
+    for (inputIndex = 0; ok && (inputIndex < _slices.size()); inputIndex++) {
+        in.read(reinterpret_cast<char *>(&n), sizeof(int));
+        if (n != _transformations[inputIndex].NumberOfDOFs()) {
+            ok = false;
+            break;
+        }
+        for (i = 0; i < n; i++)
+            _transformations[inputIndex].Put(i, ReadCheckpointValue(in));
+        ok = ReadCheckpointImage(in, _bias[inputIndex]) && ReadCheckpointImage(in, _weights[inputIndex]);
+        _slice_weight[inputIndex] = ReadCheckpointValue(in);
+        _scale[inputIndex] = ReadCheckpointValue(in);
+        _slice_excluded[inputIndex] = (ReadCheckpointValue(in) != 0);
+    }
+
+    n = ReadCheckpointCount(in);
+    if ((n != 0) && (n != (int)_slices.size()))
+        ok = false;
+    _slice_inside.resize(ok ? n : 0);
+    for (i = 0; i < (int)_slice_inside.size(); i++)
+        _slice_inside[i] = (ReadCheckpointValue(in) != 0);
+    n = ReadCheckpointCount(in);
+    if ((n < 0) || (n > (int)_slices.size()))
+        ok = false;
+    _small_slices.resize(ok ? n : 0);
+    for (i = 0; i < (int)_small_slices.size(); i++)
+        _small_slices[i] = ReadCheckpointCount(in);
+
+    _sigma = ReadCheckpointValue(in);
+    _mix = ReadCheckpointValue(in);
+    _m = ReadCheckpointValue(in);
+    _mean_s = ReadCheckpointValue(in);
+    _sigma_s = ReadCheckpointValue(in);
+    _mean_s2 = ReadCheckpointValue(in);
+    _sigma_s2 = ReadCheckpointValue(in);
+    _mix_s = ReadCheckpointValue(in);
+    _step = ReadCheckpointValue(in);
+
+    if (!ok || !in) {
+        cerr << "Checkpoint " << filename << " does not match the reconstruction or is truncated." << endl;
+        exit(1);
+    }
+
+    InvalidateSlicePools();
+
+    cout << "Resuming from checkpoint " << filename << " after iteration " << iter << "." << endl;
+    return iter;
+}
+
+
 
 // -----------------------------------------------------------------------------
 // SaveBiasFields
@@ -3424,6 +4525,23 @@ void irtkReconstructionCardiac4D::SaveSimulatedSlices(vector<irtkRealImage>& sta
 }
 
 
+// -----------------------------------------------------------------------------
+// GetSimulatedStacks
+// -----------------------------------------------------------------------------
+void irtkReconstructionCardiac4D::GetSimulatedStacks(vector<irtkRealImage>& stacks)
+{
+    for (unsigned int stackIndex = 0; stackIndex < stacks.size(); stackIndex++)
+      stacks[stackIndex] = 0;
+
+    for (unsigned int inputIndex = 0; inputIndex < _simulated_slices.size(); ++inputIndex) {
+      irtkRealImage& stack = stacks[_stack_index[inputIndex]];
+      for (int i = 0; i < _simulated_slices[inputIndex].GetX(); i++)
+        for (int j = 0; j < _simulated_slices[inputIndex].GetY(); j++)
+          stack(i,j,_stack_loc_index[inputIndex],_stack_dyn_index[inputIndex]) = _simulated_slices[inputIndex](i,j,0);
+    }
+}
+
+
 // -----------------------------------------------------------------------------
 // SaveSimulatedWeights
 // -----------------------------------------------------------------------------
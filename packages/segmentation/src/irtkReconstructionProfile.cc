@@ -0,0 +1,161 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+  Visual Information Processing (VIP), 2011 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+  =========================================================================*/
+
+#include <irtkReconstructionProfile.h>
+
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+
+#ifndef WIN32
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+irtkReconstructionProfile::irtkReconstructionProfile()
+{
+    _on = false;
+}
+
+void irtkReconstructionProfile::Clear()
+{
+    _stages.clear();
+    _stats.clear();
+}
+
+void irtkReconstructionProfile::Add(const string &stage, double wall, double cpu, double slices, double coeffs)
+{
+    map<string, irtkReconstructionStageStats>::iterator it = _stats.find(stage);
+    if (it == _stats.end()) {
+        irtkReconstructionStageStats stats;
+        stats.calls = 0;
+        stats.wall = 0;
+        stats.cpu = 0;
+        stats.slices = 0;
+        stats.coeffs = 0;
+        stats.peak_rss = 0;
+        it = _stats.insert(make_pair(stage, stats)).first;
+        _stages.push_back(stage);
+    }
+
+    irtkReconstructionStageStats &stats = it->second;
+    stats.calls++;
+    stats.wall += wall;
+    stats.cpu += cpu;
+    stats.slices += slices;
+    stats.coeffs += coeffs;
+    long rss = PeakRSS();
+    if (rss > stats.peak_rss)
+        stats.peak_rss = rss;
+}
+
+void irtkReconstructionProfile::WriteJSON(ostream &out) const
+{
+    out << setprecision(9);
+    out << "{" << endl;
+    out << "  \"peak_rss_kb\": " << PeakRSS() << "," << endl;
+    out << "  \"stages\": [";
+    for (unsigned int i = 0; i < _stages.size(); i++) {
+        const irtkReconstructionStageStats &stats = _stats.find(_stages[i])->second;
+        out << (i > 0 ? "," : "") << endl;
+        out << "    {\"stage\": \"" << _stages[i] << "\", "
+            << "\"calls\": " << stats.calls << ", "
+            << "\"wall_s\": " << stats.wall << ", "
+            << "\"cpu_s\": " << stats.cpu << ", "
+            << "\"slices\": " << stats.slices << ", "
+            << "\"coefficients\": " << stats.coeffs << ", "
+            << "\"peak_rss_kb\": " << stats.peak_rss << "}";
+    }
+    out << endl << "  ]" << endl;
+    out << "}" << endl;
+}
+
+void irtkReconstructionProfile::WriteCSV(ostream &out) const
+{
+    out << setprecision(9);
+    out << "stage,calls,wall_s,cpu_s,slices,coefficients,peak_rss_kb" << endl;
+    for (unsigned int i = 0; i < _stages.size(); i++) {
+        const irtkReconstructionStageStats &stats = _stats.find(_stages[i])->second;
+        out << _stages[i] << "," << stats.calls << "," << stats.wall << "," << stats.cpu << ","
+            << stats.slices << "," << stats.coeffs << "," << stats.peak_rss << endl;
+    }
+}
+
+void irtkReconstructionProfile::Write(const char *filename) const
+{
+    ofstream out(filename);
+    if (!out) {
+        cerr << "irtkReconstructionProfile::Write: Can't open file " << filename << endl;
+        exit(1);
+    }
+
+    string name(filename);
+    if ((name.size() >= 4) && (name.compare(name.size() - 4, 4, ".csv") == 0))
+        WriteCSV(out);
+    else
+        WriteJSON(out);
+}
+
+double irtkReconstructionProfile::WallTime()
+{
+#ifndef WIN32
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#else
+    return static_cast<double>(time(NULL));
+#endif
+}
+
+double irtkReconstructionProfile::CPUTime()
+{
+    return static_cast<double>(clock()) / CLOCKS_PER_SEC;
+}
+
+long irtkReconstructionProfile::PeakRSS()
+{
+#ifndef WIN32
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+irtkReconstructionStage::irtkReconstructionStage(irtkReconstructionProfile &profile, const char *name, double slices)
+{
+    _profile = profile.IsOn() ? &profile : NULL;
+    _name = name;
+    _slices = slices;
+    _coeffs = 0;
+    _wall = 0;
+    _cpu = 0;
+    if (_profile != NULL) {
+        _wall = irtkReconstructionProfile::WallTime();
+        _cpu = irtkReconstructionProfile::CPUTime();
+    }
+}
+
+irtkReconstructionStage::~irtkReconstructionStage()
+{
+    if (_profile != NULL)
+        _profile->Add(_name,
+                      irtkReconstructionProfile::WallTime() - _wall,
+                      irtkReconstructionProfile::CPUTime() - _cpu,
+                      _slices, _coeffs);
+}
@@ -0,0 +1,105 @@
+/*=========================================================================
+
+  Library   : Image Registration Toolkit (IRTK)
+  Module    : $Id$
+  Copyright : Imperial College, Department of Computing
+  Visual Information Processing (VIP), 2011 onwards
+  Date      : $Date$
+  Version   : $Revision$
+  Changes   : $Author$
+
+  =========================================================================*/
+
+#include <irtkSliceCoeffs.h>
+
+irtkSliceCoeffs::irtkSliceCoeffs()
+{
+  _x = 0;
+  _y = 0;
+}
+
+void irtkSliceCoeffs::Initialize(int x, int y)
+{
+  Clear();
+  _x = x;
+  _y = y;
+  _offsets.reserve(_x * _y + 1);
+  _offsets.push_back(0);
+}
+
+void irtkSliceCoeffs::Clear()
+{
+  _x = 0;
+  _y = 0;
+  vector<int>().swap(_offsets);
+  vector<int>().swap(_index);
+  vector<float>().swap(_value);
+}
+
+void irtkSliceCoeffs::Finalize()
+{
+  //rows which were never visited, e.g. excluded slices, are empty
+  while ((int)_offsets.size() < _x * _y + 1)
+    _offsets.push_back(_index.size());
+
+  //release the over-allocation of push_back
+  vector<int>(_index).swap(_index);
+  vector<float>(_value).swap(_value);
+}
+
+irtkVolumeCoeffs::irtkVolumeCoeffs()
+{
+  _n = 0;
+}
+
+void irtkVolumeCoeffs::Initialize(const vector<irtkSliceCoeffs> &coeffs, int n)
+{
+  unsigned int s;
+  int i, j, k, v, pixel;
+
+  Clear();
+  _n = n;
+
+  //enumerate the pixels of all slices
+  _pixel_offsets.resize(coeffs.size() + 1);
+  _pixel_offsets[0] = 0;
+  for (s = 0; s < coeffs.size(); s++)
+    _pixel_offsets[s + 1] = _pixel_offsets[s] + coeffs[s].GetX() * coeffs[s].GetY();
+  _pixel_slice.resize(_pixel_offsets.back());
+  for (s = 0; s < coeffs.size(); s++)
+    for (pixel = _pixel_offsets[s]; pixel < _pixel_offsets[s + 1]; pixel++)
+      _pixel_slice[pixel] = s;
+
+  //count the coefficients of each volume voxel
+  _offsets.assign(_n + 1, 0);
+  for (s = 0; s < coeffs.size(); s++)
+    for (k = 0; k < coeffs[s].GetNumberOfCoeffs(); k++)
+      _offsets[coeffs[s].Index(k) + 1]++;
+  for (v = 0; v < _n; v++)
+    _offsets[v + 1] += _offsets[v];
+
+  //scatter the coefficients into their rows
+  _pixel.resize(_offsets[_n]);
+  _value.resize(_offsets[_n]);
+  vector<int> next(_offsets.begin(), _offsets.end() - 1);
+  for (s = 0; s < coeffs.size(); s++)
+    for (i = 0; i < coeffs[s].GetX(); i++)
+      for (j = 0; j < coeffs[s].GetY(); j++) {
+        pixel = _pixel_offsets[s] + i + coeffs[s].GetX() * j;
+        for (k = coeffs[s].Begin(i, j); k < coeffs[s].End(i, j); k++) {
+          v = next[coeffs[s].Index(k)]++;
+          _pixel[v] = pixel;
+          _value[v] = coeffs[s].Value(k);
+        }
+      }
+}
+
+void irtkVolumeCoeffs::Clear()
+{
+  _n = 0;
+  vector<int>().swap(_offsets);
+  vector<int>().swap(_pixel);
+  vector<float>().swap(_value);
+  vector<int>().swap(_pixel_offsets);
+  vector<int>().swap(_pixel_slice);
+}
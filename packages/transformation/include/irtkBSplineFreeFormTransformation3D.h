@@ -14,6 +14,54 @@
 
 #define _IRTKBSPLINEFREEFORMTRANSFORMATION3D_H
 
+class irtkBSplineFreeFormTransformation3D;
+
+/**
+ * Separable B-spline weights of a regular image grid.
+ *
+ * If the axes of an image grid are parallel to the axes of the control point
+ * lattice, the lattice coordinate of voxel (i, j, k) along x only depends on
+ * i, along y only on j and along z only on k. For each axis and grid index the
+ * table stores the four control point indices and B-spline weights which
+ * FFD3D would use, so that the displacements of the whole grid can be
+ * evaluated in three 1D passes instead of one 64-term tensor product per
+ * voxel. Control points outside the lattice have weight zero. The table
+ * remains valid as long as the lattice geometry and the grid do not change.
+ */
+
+class irtkBSplineGridLUT
+{
+
+public:
+
+  /// Size of the image grid
+  int _x, _y, _z;
+
+  /// Size of the control point lattice
+  int _cx, _cy, _cz;
+
+  /// Four control point indices per grid index along each axis
+  vector<int> _xindex, _yindex, _zindex;
+
+  /// Four B-spline weights per grid index along each axis
+  vector<double> _xweight, _yweight, _zweight;
+
+  /// Attributes of the image grid, also kept if the grid is not aligned
+  irtkImageAttributes _attr;
+
+  /// Constructor
+  irtkBSplineGridLUT();
+
+  /** Initializes the table for the grid of an image. Returns false and leaves
+   *  the table invalid if the grid is not aligned with the lattice.
+   */
+  bool Initialize(const irtkBSplineFreeFormTransformation3D &, const irtkImageAttributes &);
+
+  /// Whether the table has been initialized
+  bool IsValid() const;
+
+};
+
 
 /**
  * Class for free form transformations based on tensor product B-splines.
@@ -27,8 +75,12 @@
 class irtkBSplineFreeFormTransformation3D : public irtkFreeFormTransformation3D
 {
 
+  friend class irtkBSplineGridLUT;
+
   friend class irtkImageFreeFormRegistration2;
 
+  friend class irtkMultiThreadedImageFreeFormRegistration2UpdateSource;
+
   friend class irtkImageGradientFreeFormRegistration2;
 
   friend class irtkMultipleImageFreeFormRegistration2;
@@ -253,6 +305,16 @@ public:
   /// Calculates displacement using the local transformation component only
   virtual void LocalDisplacement(double &, double &, double &, double = 0);
 
+  /** Calculates the displacements of the slices [k1, k2) of the grid of a
+   *  lookup table in three separable passes. The displacement of voxel n in
+   *  grid order is written to dx[n*step], dy[n*step] and dz[n*step]. If the
+   *  table does not match the lattice the voxels are evaluated point by point.
+   */
+  virtual void LocalDisplacement(const irtkBSplineGridLUT &, double *, double *, double *, int, int, int) const;
+
+  /// Calculate displacement vectors for image, separable if the image grid is aligned with the lattice
+  virtual void Displacement(irtkGenericImage<double> &, double = 0);
+
   /// Calculate the Jacobian of the transformation
   virtual void Jacobian(irtkMatrix &, double, double, double, double = 0);
 
@@ -332,6 +394,11 @@ protected:
 
 };
 
+inline bool irtkBSplineGridLUT::IsValid() const
+{
+  return (_x > 0);
+}
+
 inline double irtkBSplineFreeFormTransformation3D::B(double x)
 {
   x = fabs(x);
@@ -103,6 +103,9 @@ public:
   /// Checks whether transformation is an identity mapping
   virtual bool IsIdentity();
 
+  /// Points are transformed by the matrix only
+  virtual bool IsThreadSafe();
+
   /// Prints the parameters of the transformation
   virtual void Print();
 
@@ -226,6 +229,11 @@ inline void irtkHomogeneousTransformation::LocalDisplacement(double &x, double &
   z = 0;
 }
 
+inline bool irtkHomogeneousTransformation::IsThreadSafe()
+{
+  return true;
+}
+
 inline const char *irtkHomogeneousTransformation::NameOfClass()
 {
   return "irtkHomogeneousTransformation";
@@ -138,6 +138,12 @@ public:
   /// Runs the filter
   virtual void Run();
 
+  /** Runs the filter with an inlined kernel if the transformation is
+   *  homogeneous, the interpolation is nearest neighbor or linear and input
+   *  and output have the same voxel type. Returns false otherwise.
+   */
+  virtual bool RunHomogeneous();
+
 };
 
 inline void irtkImageTransformation::PutTargetPaddingValue(double PaddingValue)
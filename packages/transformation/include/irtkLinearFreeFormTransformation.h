@@ -152,6 +152,9 @@ public:
   /// Prints the parameters of the transformation
   virtual void Print();
 
+  /// Points are interpolated from the lattice only
+  virtual bool IsThreadSafe();
+
   /// Check file header
   static int CheckHeader(char *);
 
@@ -254,6 +257,11 @@ inline void irtkLinearFreeFormTransformation::Displacement(double &x, double &y,
 	this->LocalDisplacement(x, y, z);
 }
 
+inline bool irtkLinearFreeFormTransformation::IsThreadSafe()
+{
+  return true;
+}
+
 inline const char *irtkLinearFreeFormTransformation::NameOfClass()
 {
   return "irtkLinearFreeFormTransformation";
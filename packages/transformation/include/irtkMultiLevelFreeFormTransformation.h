@@ -82,6 +82,9 @@ public:
   /// Calculates displacement using global and local transformation components
   virtual void Displacement(double& x, double& y, double& z, double = 0);
 
+  /// Calculate displacement vectors for image, level by level
+  virtual void Displacement(irtkGenericImage<double> &, double = 0);
+
   /// Transforms a single point using the global transformation component only
   virtual void GlobalTransform(double &, double &, double &, double = 0);
 
@@ -139,6 +142,9 @@ public:
   /// Checks whether transformation is an identity mapping
   virtual bool IsIdentity();
 
+  /// Local transformations have not been checked, unlike the affine part
+  virtual bool IsThreadSafe();
+
   /// Prints the parameters of the transformation
   virtual void Print();
 
@@ -248,6 +254,11 @@ inline irtkFreeFormTransformation *irtkMultiLevelFreeFormTransformation::RemoveL
   return localTransformation;
 }
 
+inline bool irtkMultiLevelFreeFormTransformation::IsThreadSafe()
+{
+  return false;
+}
+
 inline const char *irtkMultiLevelFreeFormTransformation::NameOfClass()
 {
   return "irtkMultiLevelFreeFormTransformation";
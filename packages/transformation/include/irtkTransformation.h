@@ -44,6 +44,7 @@ typedef enum { _Active, _Passive, _Unknown } _Status;
 
 #define FFDLOOKUPTABLESIZE 1000
 
+class irtkLinearFreeFormTransformation;
 
 /**
  * Abstract base class for general transformations.
@@ -143,12 +144,27 @@ public:
   /// Calculate the determinant of the Jacobian of the global transformation with respect to world coordinates
   double GlobalJacobian(double, double, double, double = 0);
 
-  /// Calculate displacement vectors for image
+  /// Calculate displacement vectors for image, in parallel if IsThreadSafe()
   virtual void Displacement(irtkGenericImage<double> &, double = 0);
 
+  /** Bakes the transformation at a given time into a dense displacement field
+   *  on the lattice of the image attributes. The returned transformation
+   *  interpolates the field linearly, it can be written to disk and used in
+   *  place of this transformation, e.g. to warp several images onto the same
+   *  lattice at the cost of a single evaluation of this transformation. The
+   *  lattice needs at least two points along x and y.
+   */
+  virtual irtkLinearFreeFormTransformation *DisplacementCache(const irtkImageAttributes &, double = 0);
+
   /// Checks whether transformation is an identity mapping (abstract)
   virtual bool IsIdentity() = 0;
 
+  /** Checks whether points may be transformed concurrently, i.e. whether
+   *  Transform and Displacement leave the transformation unchanged. Classes
+   *  which have been checked return true, the default is false.
+   */
+  virtual bool IsThreadSafe();
+
   /// Reads a transformation from a file
   virtual void Read (char *);
 
@@ -255,6 +271,11 @@ inline void irtkTransformation::LocalDisplacement(double &x, double &y, double &
   z = c - z;
 }
 
+inline bool irtkTransformation::IsThreadSafe()
+{
+  return false;
+}
+
 inline void irtkTransformation::JacobianDOFs(double [3], int, double, double, double, double)
 {
 	cerr << this->NameOfClass() << ": JacobianDOFs() not implemented for this class" << endl;
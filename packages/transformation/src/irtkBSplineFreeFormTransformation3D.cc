@@ -697,6 +697,233 @@ void irtkBSplineFreeFormTransformation3D::FFD3D(double &x, double &y, double &z)
 	}
 }
 
+class irtkMultiThreadedBSplineFreeFormTransformation3DDisplacement
+{
+
+	/// Pointer to transformation
+	const irtkBSplineFreeFormTransformation3D *_ffd;
+
+	/// Lookup table of the image grid
+	const irtkBSplineGridLUT &_lut;
+
+	/// Output displacements
+	double *_dx, *_dy, *_dz;
+
+public:
+
+	irtkMultiThreadedBSplineFreeFormTransformation3DDisplacement(const irtkBSplineFreeFormTransformation3D *ffd, const irtkBSplineGridLUT &lut, double *dx, double *dy, double *dz) : _lut(lut) {
+		_ffd = ffd;
+		_dx  = dx;
+		_dy  = dy;
+		_dz  = dz;
+	}
+
+	void operator()(const blocked_range<int> &r) const {
+		_ffd->LocalDisplacement(_lut, _dx, _dy, _dz, 1, r.begin(), r.end());
+	}
+
+};
+
+irtkBSplineGridLUT::irtkBSplineGridLUT()
+{
+	_x  = 0;
+	_y  = 0;
+	_z  = 0;
+	_cx = 0;
+	_cy = 0;
+	_cz = 0;
+}
+
+/// Fills the indices and weights of the four B-splines for the grid positions p0 + i * dp
+static void irtkBSplineGridLUTAxis(double p0, double dp, int n, int size, double (*table)[4], vector<int> &index, vector<double> &weight)
+{
+	int i, a, l, c, S;
+
+	index.resize(4*n);
+	weight.resize(4*n);
+	for (i = 0; i < n; i++) {
+		double p = p0 + i * dp;
+		l = (int)floor(p);
+		S = round(LUTSIZE*(p-l));
+		for (a = 0; a < 4; a++) {
+			c = l - 1 + a;
+			if ((c >= 0) && (c < size)) {
+				index[4*i+a]  = c;
+				weight[4*i+a] = table[S][a];
+			} else {
+				index[4*i+a]  = 0;
+				weight[4*i+a] = 0;
+			}
+		}
+	}
+}
+
+bool irtkBSplineGridLUT::Initialize(const irtkBSplineFreeFormTransformation3D &ffd, const irtkImageAttributes &attr)
+{
+	int i;
+	double p[4][3];
+
+	_x = 0;
+	_attr = attr;
+
+	// Lattice coordinates of the grid origin and of its neighbours along each axis
+	irtkMatrix i2w = irtkBaseImage::GetImageToWorldMatrix(attr);
+	for (i = 0; i < 4; i++) {
+		double v[3] = {0, 0, 0};
+		if (i > 0) v[i-1] = 1;
+		p[i][0] = i2w(0, 0) * v[0] + i2w(0, 1) * v[1] + i2w(0, 2) * v[2] + i2w(0, 3);
+		p[i][1] = i2w(1, 0) * v[0] + i2w(1, 1) * v[1] + i2w(1, 2) * v[2] + i2w(1, 3);
+		p[i][2] = i2w(2, 0) * v[0] + i2w(2, 1) * v[1] + i2w(2, 2) * v[2] + i2w(2, 3);
+		ffd.WorldToLattice(p[i][0], p[i][1], p[i][2]);
+	}
+	for (i = 1; i < 4; i++) {
+		p[i][0] -= p[0][0];
+		p[i][1] -= p[0][1];
+		p[i][2] -= p[0][2];
+	}
+
+	// Check that each image axis only moves along the corresponding lattice axis
+	if ((fabs(p[1][1]) > 1e-9) || (fabs(p[1][2]) > 1e-9) ||
+	    (fabs(p[2][0]) > 1e-9) || (fabs(p[2][2]) > 1e-9) ||
+	    (fabs(p[3][0]) > 1e-9) || (fabs(p[3][1]) > 1e-9)) {
+		return false;
+	}
+
+	_cx = ffd._x;
+	_cy = ffd._y;
+	_cz = ffd._z;
+	irtkBSplineGridLUTAxis(p[0][0], p[1][0], attr._x, _cx, irtkBSplineFreeFormTransformation3D::LookupTable, _xindex, _xweight);
+	irtkBSplineGridLUTAxis(p[0][1], p[2][1], attr._y, _cy, irtkBSplineFreeFormTransformation3D::LookupTable, _yindex, _yweight);
+	irtkBSplineGridLUTAxis(p[0][2], p[3][2], attr._z, _cz, irtkBSplineFreeFormTransformation3D::LookupTable, _zindex, _zweight);
+	_x = attr._x;
+	_y = attr._y;
+	_z = attr._z;
+
+	return true;
+}
+
+void irtkBSplineFreeFormTransformation3D::LocalDisplacement(const irtkBSplineGridLUT &lut, double *dx, double *dy, double *dz, int step, int k1, int k2) const
+{
+	int i, j, k, a, x, y, n;
+	double w, u, v, s;
+	const int *index;
+	const double *weight;
+	const irtkVector3D<double> *ptr;
+
+	// Evaluate point by point if the table does not match the lattice
+	if ((lut.IsValid() == false) || (lut._cx != _x) || (lut._cy != _y) || (lut._cz != _z)) {
+		irtkMatrix i2w = irtkBaseImage::GetImageToWorldMatrix(lut._attr);
+		for (k = k1; k < k2; k++) {
+			for (j = 0; j < lut._attr._y; j++) {
+				n = (k * lut._attr._y + j) * lut._attr._x;
+				for (i = 0; i < lut._attr._x; i++, n++) {
+					u = i2w(0, 0) * i + i2w(0, 1) * j + i2w(0, 2) * k + i2w(0, 3);
+					v = i2w(1, 0) * i + i2w(1, 1) * j + i2w(1, 2) * k + i2w(1, 3);
+					s = i2w(2, 0) * i + i2w(2, 1) * j + i2w(2, 2) * k + i2w(2, 3);
+					this->WorldToLattice(u, v, s);
+					if (_z == 1) {
+						this->FFD2D(u, v);
+						s = 0;
+					} else {
+						this->FFD3D(u, v, s);
+					}
+					dx[n*step] = u;
+					dy[n*step] = v;
+					dz[n*step] = s;
+				}
+			}
+		}
+		return;
+	}
+
+	// Slice of the lattice after the pass along z and of the grid after the pass along y
+	vector<irtkVector3D<double> > zpass(_x*_y), ypass(_x*lut._y);
+
+	for (k = k1; k < k2; k++) {
+
+		// Pass along z over the control points of a lattice slice
+		index  = &(lut._zindex[4*k]);
+		weight = &(lut._zweight[4*k]);
+		for (y = 0; y < _y; y++) {
+			for (x = 0; x < _x; x++) {
+				u = 0;
+				v = 0;
+				s = 0;
+				for (a = 0; a < 4; a++) {
+					ptr = &(_data[index[a]][y][x]);
+					w = weight[a];
+					u += w * ptr->_x;
+					v += w * ptr->_y;
+					s += w * ptr->_z;
+				}
+				zpass[y*_x+x]._x = u;
+				zpass[y*_x+x]._y = v;
+				zpass[y*_x+x]._z = s;
+			}
+		}
+
+		// Pass along y
+		for (j = 0; j < lut._y; j++) {
+			index  = &(lut._yindex[4*j]);
+			weight = &(lut._yweight[4*j]);
+			for (x = 0; x < _x; x++) {
+				u = 0;
+				v = 0;
+				s = 0;
+				for (a = 0; a < 4; a++) {
+					ptr = &(zpass[index[a]*_x+x]);
+					w = weight[a];
+					u += w * ptr->_x;
+					v += w * ptr->_y;
+					s += w * ptr->_z;
+				}
+				ypass[j*_x+x]._x = u;
+				ypass[j*_x+x]._y = v;
+				ypass[j*_x+x]._z = s;
+			}
+		}
+
+		// Pass along x
+		for (j = 0; j < lut._y; j++) {
+			n = (k * lut._y + j) * lut._x;
+			for (i = 0; i < lut._x; i++, n++) {
+				index  = &(lut._xindex[4*i]);
+				weight = &(lut._xweight[4*i]);
+				u = 0;
+				v = 0;
+				s = 0;
+				for (a = 0; a < 4; a++) {
+					ptr = &(ypass[j*_x+index[a]]);
+					w = weight[a];
+					u += w * ptr->_x;
+					v += w * ptr->_y;
+					s += w * ptr->_z;
+				}
+				dx[n*step] = u;
+				dy[n*step] = v;
+				dz[n*step] = s;
+			}
+		}
+	}
+}
+
+void irtkBSplineFreeFormTransformation3D::Displacement(irtkGenericImage<double> &image, double t)
+{
+	irtkBSplineGridLUT lut;
+
+	// Fall back to point-wise evaluation for 2D lattices and unaligned grids
+	if ((_z == 1) || (lut.Initialize(*this, image.GetImageAttributes()) == false)) {
+		this->irtkTransformation::Displacement(image, t);
+		return;
+	}
+
+	irtkMultiThreadedBSplineFreeFormTransformation3DDisplacement evaluate(this, lut,
+	    image.GetPointerToVoxels(0, 0, 0, 0), image.GetPointerToVoxels(0, 0, 0, 1), image.GetPointerToVoxels(0, 0, 0, 2));
+	task_scheduler_init init(tbb_no_threads);
+	parallel_for(blocked_range<int>(0, image.GetZ()), evaluate);
+	init.terminate();
+}
+
 void irtkBSplineFreeFormTransformation3D::Jacobian(irtkMatrix &jac, double x, double y, double z, double t)
 {
 	this->LocalJacobian(jac, x, y, z, t);
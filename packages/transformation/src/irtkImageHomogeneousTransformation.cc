@@ -136,6 +136,9 @@ void irtkImageHomogeneousTransformation::Run()
   this->_interpolator->SetInput(this->_input);
   this->_interpolator->Initialize();
 
+  // Use specialized kernel if possible
+  if (this->RunHomogeneous() == true) return;
+
   // Invert transformation
   if (this->_Invert == true) ((irtkHomogeneousTransformation *)this->_transformation)->Invert();
 
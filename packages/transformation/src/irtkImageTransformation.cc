@@ -78,6 +78,171 @@ public:
 
 #endif
 
+/// Converts a value to the voxel type in the same way as irtkGenericImage::PutAsDouble
+template <class VoxelType> static inline VoxelType irtkImageTransformationCast(double val)
+{
+  if (val > voxel_limits<VoxelType>::max()) val = voxel_limits<VoxelType>::max();
+  if (val < voxel_limits<VoxelType>::min()) val = voxel_limits<VoxelType>::min();
+  return static_cast<VoxelType>(val);
+}
+
+/// Nearest neighbor interpolation at a point inside the FOV of the input
+template <class VoxelType> static inline double irtkImageTransformationNearestNeighbor(const VoxelType *ptr, int X, int Y, int, double x, double y, double z)
+{
+  return ptr[(round(z) * Y + round(y)) * X + round(x)];
+}
+
+/// Linear interpolation as in irtkLinearInterpolateImageFunction::Evaluate
+template <class VoxelType> static inline double irtkImageTransformationLinear(const VoxelType *ptr, int X, int Y, int Z, double x, double y, double z)
+{
+  int i, j, k, l, m, n;
+  double t1, t2, u1, u2, v1, v2, val, weight, w;
+
+  i = (int)floor(x);
+  j = (int)floor(y);
+  k = (int)floor(z);
+
+  if ((i >= 0) && (i < X-1) && (j >= 0) && (j < Y-1) && (k >= 0) && (k < Z-1)) {
+    const VoxelType *p = ptr + (k * Y + j) * X + i;
+    t1 = x - i;
+    u1 = y - j;
+    v1 = z - k;
+    t2 = 1 - t1;
+    u2 = 1 - u1;
+    v2 = 1 - v1;
+    return (t1 * (u2 * (v2 * p[1]   + v1 * p[X*Y+1]) +
+                  u1 * (v2 * p[X+1] + v1 * p[X*Y+X+1])) +
+            t2 * (u2 * (v2 * p[0]   + v1 * p[X*Y]) +
+                  u1 * (v2 * p[X]   + v1 * p[X*Y+X])));
+  }
+
+  // Close to the boundary only the neighbours inside the image are used
+  val = 0;
+  weight = 0;
+  for (n = k; n <= k+1; n++) {
+    if ((n >= 0) && (n < Z)) {
+      for (m = j; m <= j+1; m++) {
+        if ((m >= 0) && (m < Y)) {
+          for (l = i; l <= i+1; l++) {
+            if ((l >= 0) && (l < X)) {
+              w = (1 - fabs(l - x))*(1 - fabs(m - y))*(1 - fabs(n - z));
+              val    += w * ptr[(n * Y + m) * X + l];
+              weight += w;
+            }
+          }
+        }
+      }
+    }
+  }
+  if (weight > 0) val /= weight;
+  return val;
+}
+
+/**
+ * Resamples slices of the output for a homogeneous transformation with
+ * nearest neighbor or linear interpolation. Input and output have the same
+ * voxel type, the interpolation is inlined and the transformed position is
+ * stepped along each row instead of being mapped from world coordinates.
+ * The range runs over all slices of all frames of the output.
+ */
+
+template <class VoxelType, irtkInterpolationMode Interpolation>
+class irtkMultiThreadedImageTransformationHomogeneous
+{
+
+  /// Pointer to image transformation class
+  irtkImageTransformation *_imagetransformation;
+
+  /// Input and output image
+  irtkGenericImage<VoxelType> *_input, *_output;
+
+  /// Matrix mapping output voxels to input voxels
+  double _m[3][4];
+
+  /// Whether interpolated values are rounded as for short images
+  bool _round;
+
+public:
+
+  irtkMultiThreadedImageTransformationHomogeneous(irtkImageTransformation *imagetransformation, irtkMatrix &m) {
+    int i, j;
+
+    _imagetransformation = imagetransformation;
+    _input  = dynamic_cast<irtkGenericImage<VoxelType> *>(imagetransformation->_input);
+    _output = dynamic_cast<irtkGenericImage<VoxelType> *>(imagetransformation->_output);
+    for (j = 0; j < 3; j++) {
+      for (i = 0; i < 4; i++) {
+        _m[j][i] = m(j, i);
+      }
+    }
+    _round = (Interpolation == Interpolation_Linear) &&
+             ((_input->GetScalarType() == IRTK_VOXEL_SHORT) || (_input->GetScalarType() == IRTK_VOXEL_UNSIGNED_SHORT));
+  }
+
+  void operator()(const blocked_range<int> &r) const {
+    int i, j, k, l, n, t, X, Y, Z;
+    double x, y, z, x0, y0, z0, val;
+    VoxelType padding, *out;
+    const VoxelType *in;
+
+    X = _input->GetX();
+    Y = _input->GetY();
+    Z = _input->GetZ();
+    padding = irtkImageTransformationCast<VoxelType>(_imagetransformation->_SourcePaddingValue);
+
+    for (n = r.begin(); n != r.end(); n++) {
+      l = n / _output->GetZ();
+      k = n % _output->GetZ();
+      t = round(_input->TimeToImage(_output->ImageToTime(l)));
+      out = _output->GetPointerToVoxels(0, 0, k, l);
+
+      if ((t < 0) || (t >= _input->GetT())) {
+        for (i = 0; i < _output->GetX() * _output->GetY(); i++) out[i] = padding;
+        continue;
+      }
+      in = _input->GetPointerToVoxels(0, 0, 0, t);
+
+      for (j = 0; j < _output->GetY(); j++) {
+        x0 = _m[0][1] * j + _m[0][2] * k + _m[0][3];
+        y0 = _m[1][1] * j + _m[1][2] * k + _m[1][3];
+        z0 = _m[2][1] * j + _m[2][2] * k + _m[2][3];
+        for (i = 0; i < _output->GetX(); i++, out++) {
+          if (*out > _imagetransformation->_TargetPaddingValue) {
+            x = x0 + _m[0][0] * i;
+            y = y0 + _m[1][0] * i;
+            z = z0 + _m[2][0] * i;
+            // Check whether transformed point is in FOV of input
+            if ((x > -0.5) && (x < X-0.5) && (y > -0.5) && (y < Y-0.5) && (z > -0.5) && (z < Z-0.5)) {
+              if (Interpolation == Interpolation_Linear) {
+                val = irtkImageTransformationLinear(in, X, Y, Z, x, y, z);
+                if (_round) val = round(val);
+              } else {
+                val = irtkImageTransformationNearestNeighbor(in, X, Y, Z, x, y, z);
+              }
+              *out = irtkImageTransformationCast<VoxelType>(_imagetransformation->_ScaleFactor * val + _imagetransformation->_Offset);
+            } else {
+              *out = padding;
+            }
+          } else {
+            *out = padding;
+          }
+        }
+      }
+    }
+  }
+};
+
+template <class VoxelType> static void irtkImageTransformationHomogeneous(irtkImageTransformation *imagetransformation, irtkMatrix &m, bool linear)
+{
+  blocked_range<int> range(0, imagetransformation->_output->GetZ() * imagetransformation->_output->GetT(), 1);
+
+  if (linear) {
+    parallel_for(range, irtkMultiThreadedImageTransformationHomogeneous<VoxelType, Interpolation_Linear>(imagetransformation, m));
+  } else {
+    parallel_for(range, irtkMultiThreadedImageTransformationHomogeneous<VoxelType, Interpolation_NN>(imagetransformation, m));
+  }
+}
+
 irtkImageTransformation::irtkImageTransformation()
 {
   // Set input and output
@@ -196,6 +361,65 @@ void irtkImageTransformation::SetOutput(irtkImage *image)
   }
 }
 
+bool irtkImageTransformation::RunHomogeneous()
+{
+  bool linear;
+
+  // Transformation must be homogeneous, i.e. the same for all time frames
+  if ((strcmp(_transformation->NameOfClass(), "irtkHomogeneousTransformation") != 0) &&
+      (strcmp(_transformation->NameOfClass(), "irtkRigidTransformation") != 0) &&
+      (strcmp(_transformation->NameOfClass(), "irtkAffineTransformation") != 0)) return false;
+
+  if (strcmp(_interpolator->NameOfClass(), "irtkLinearInterpolateImageFunction") == 0) {
+    linear = true;
+  } else if (strcmp(_interpolator->NameOfClass(), "irtkNearestNeighborInterpolateImageFunction") == 0) {
+    linear = false;
+  } else {
+    return false;
+  }
+
+  if ((_2D == true) || (_input->GetScalarType() != _output->GetScalarType())) return false;
+
+  // Map output voxels via world coordinates to input voxels
+  irtkMatrix matrix = ((irtkHomogeneousTransformation *)_transformation)->GetMatrix();
+  if (_Invert == true) matrix.Invert();
+  irtkMatrix m = _input->GetWorldToImageMatrix() * matrix * _output->GetImageToWorldMatrix();
+
+#ifdef HAS_TBB
+  tick_count t_start = tick_count::now();
+#endif
+
+  task_scheduler_init init(tbb_no_threads);
+  switch (_input->GetScalarType()) {
+  case IRTK_VOXEL_UNSIGNED_CHAR:
+    irtkImageTransformationHomogeneous<unsigned char>(this, m, linear);
+    break;
+  case IRTK_VOXEL_SHORT:
+    irtkImageTransformationHomogeneous<short>(this, m, linear);
+    break;
+  case IRTK_VOXEL_UNSIGNED_SHORT:
+    irtkImageTransformationHomogeneous<unsigned short>(this, m, linear);
+    break;
+  case IRTK_VOXEL_FLOAT:
+    irtkImageTransformationHomogeneous<float>(this, m, linear);
+    break;
+  case IRTK_VOXEL_DOUBLE:
+    irtkImageTransformationHomogeneous<double>(this, m, linear);
+    break;
+  default:
+    init.terminate();
+    return false;
+  }
+  init.terminate();
+
+#ifdef HAS_TBB
+  tick_count t_end = tick_count::now();
+  if (tbb_debug) cout << "irtkImageTransformation (homogeneous) = " << (t_end - t_start).seconds() << " secs." << endl;
+#endif
+
+  return true;
+}
+
 void irtkImageTransformation::Run()
 {
   int i, j, k, l;
@@ -241,6 +465,9 @@ void irtkImageTransformation::Run()
   _interpolator->SetInput(_input);
   _interpolator->Initialize();
 
+  // Use specialized kernel if possible
+  if (this->RunHomogeneous() == true) return;
+
 #ifdef HAS_TBB
   task_scheduler_init init(tbb_no_threads);
 
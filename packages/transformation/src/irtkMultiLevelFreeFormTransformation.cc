@@ -154,6 +154,49 @@ void irtkMultiLevelFreeFormTransformation::Displacement(double& x, double& y, do
   z = globalZ + localZ;
 }
 
+void irtkMultiLevelFreeFormTransformation::Displacement(irtkGenericImage<double> &image, double t)
+{
+  int i, j, k, n;
+  double x, y, z, *ptr1, *ptr2;
+
+  // Summing the levels is only valid for this class, subclasses such as
+  // irtkFluidFreeFormTransformation combine their levels differently
+  if (strcmp(this->NameOfClass(), "irtkMultiLevelFreeFormTransformation") != 0) {
+    this->irtkTransformation::Displacement(image, t);
+    return;
+  }
+
+  // Global displacement
+  for (k = 0; k < image.GetZ(); k++) {
+    for (j = 0; j < image.GetY(); j++) {
+      for (i = 0; i < image.GetX(); i++) {
+        x = i;
+        y = j;
+        z = k;
+        image.ImageToWorld(x, y, z);
+        this->GlobalDisplacement(x, y, z, t);
+        image(i, j, k, 0) = x;
+        image(i, j, k, 1) = y;
+        image(i, j, k, 2) = z;
+      }
+    }
+  }
+
+  // Add the displacement of each local transformation, so that levels which
+  // can evaluate a whole grid at once (e.g. B-spline FFDs) do so
+  if (_NumberOfLevels > 0) {
+    irtkGenericImage<double> local(image.GetImageAttributes());
+    for (n = 0; n < _NumberOfLevels; n++) {
+      _localTransformation[n]->Displacement(local, t);
+      ptr1 = image.GetPointerToVoxels(0, 0, 0, 0);
+      ptr2 = local.GetPointerToVoxels(0, 0, 0, 0);
+      for (i = 0; i < 3 * image.GetX() * image.GetY() * image.GetZ(); i++) {
+        ptr1[i] += ptr2[i];
+      }
+    }
+  }
+}
+
 void irtkMultiLevelFreeFormTransformation::Transform(int n, double &x, double &y, double &z, double t)
 {
   int i;
@@ -188,29 +188,84 @@ irtkTransformation *irtkTransformation::New(char *name)
   }
 }
 
-void irtkTransformation::Displacement(irtkGenericImage<double> &image, double t)
+class irtkMultiThreadedTransformationDisplacement
 {
-	int i, j, k;
-	double x, y, z;
-
-  // Calculate displacement field
-  for (k = 0; k < image.GetZ(); k++) {
-    for (j = 0; j < image.GetY(); j++) {
-      for (i = 0; i < image.GetX(); i++) {
-        x = i;
-        y = j;
-        z = k;
-        // Transform point into world coordinates
-        image.ImageToWorld(x, y, z);
-        // Calculate displacement
-        this->Displacement(x, y, z, t);
-        // Store displacement
-        image(i, j, k, 0) = x;
-        image(i, j, k, 1) = y;
-        image(i, j, k, 2) = z;
-       }
+
+  /// Pointer to transformation
+  irtkTransformation *_transformation;
+
+  /// Displacement field
+  irtkGenericImage<double> *_image;
+
+  /// Time at which the displacements are calculated
+  double _t;
+
+public:
+
+  irtkMultiThreadedTransformationDisplacement(irtkTransformation *transformation, irtkGenericImage<double> *image, double t) {
+    _transformation = transformation;
+    _image = image;
+    _t = t;
+  }
+
+  void operator()(const blocked_range<int> &r) const {
+    int i, j, k;
+    double x, y, z;
+
+    for (k = r.begin(); k != r.end(); k++) {
+      for (j = 0; j < _image->GetY(); j++) {
+        for (i = 0; i < _image->GetX(); i++) {
+          x = i;
+          y = j;
+          z = k;
+          // Transform point into world coordinates
+          _image->ImageToWorld(x, y, z);
+          // Calculate displacement
+          _transformation->Displacement(x, y, z, _t);
+          // Store displacement
+          _image->Put(i, j, k, 0, x);
+          _image->Put(i, j, k, 1, y);
+          _image->Put(i, j, k, 2, z);
+        }
+      }
     }
   }
+
+};
+
+void irtkTransformation::Displacement(irtkGenericImage<double> &image, double t)
+{
+  irtkMultiThreadedTransformationDisplacement evaluate(this, &image, t);
+
+  // Calculate displacement field, slices are independent
+  if (this->IsThreadSafe()) {
+    task_scheduler_init init(tbb_no_threads);
+    parallel_for(blocked_range<int>(0, image.GetZ(), 1), evaluate);
+    init.terminate();
+  } else {
+    evaluate(blocked_range<int>(0, image.GetZ(), 1));
+  }
+}
+
+irtkLinearFreeFormTransformation *irtkTransformation::DisplacementCache(const irtkImageAttributes &attr, double t)
+{
+  irtkImageAttributes fieldattr = attr;
+
+  // The linear FFD needs at least two lattice points along x and y
+  if ((attr._x < 2) || (attr._y < 2)) {
+    cerr << "irtkTransformation::DisplacementCache: Lattice must have at least two points along x and y" << endl;
+    exit(1);
+  }
+
+  // Displacement field has one frame per component
+  fieldattr._t  = 3;
+  fieldattr._dt = 1;
+  irtkGenericImage<double> field(fieldattr);
+
+  // Evaluate transformation once for every voxel
+  this->Displacement(field, t);
+
+  return new irtkLinearFreeFormTransformation(field);
 }
 
 void irtkTransformation::Read(char *name)